@@ -68,6 +68,8 @@ PYBIND11_MODULE(MODULE_NAME, m) {
            get_config
            from_ascii_to_binary
            from_binary_to_ascii
+           from_ascii_to_binary_bytes
+           from_binary_to_ascii_bytes
     )pbdoc";
 
     // Auxiliary FILE API:
@@ -167,9 +169,11 @@ PYBIND11_MODULE(MODULE_NAME, m) {
     py::enum_<core::EGCodeEncodingType>(m, "GCodeEncodingType")
         .value("none", core::EGCodeEncodingType::None)
         .value("MeatPack", core::EGCodeEncodingType::MeatPack)
-        .value("MeatPackComments", core::EGCodeEncodingType::MeatPackComments);
+        .value("MeatPackComments", core::EGCodeEncodingType::MeatPackComments)
+        .value("TokenPack", core::EGCodeEncodingType::TokenPack);
     py::enum_<core::EMetadataEncodingType>(m, "MetadataEncodingType")
-        .value("INI", core::EMetadataEncodingType::INI);
+        .value("INI", core::EMetadataEncodingType::INI)
+        .value("Binary", core::EMetadataEncodingType::Binary);
     py::enum_<core::EChecksumType>(m, "ChecksumType")
         .value("none", core::EChecksumType::None)
         .value("CRC32", core::EChecksumType::CRC32);
@@ -446,6 +450,25 @@ PYBIND11_MODULE(MODULE_NAME, m) {
                 return self.read_data(*file.fptr, file_header, block_header);
             }, R"pbdoc(Read block data)pbdoc", py::arg("file"), py::arg("file_header"), py::arg("block_header"));
 
+    py::class_<binarize::ThumbnailHandle>(m, "ThumbnailHandle")
+        .def(py::init<>())
+        .def_readonly("params", &binarize::ThumbnailHandle::params)
+        .def_readonly("data_offset", &binarize::ThumbnailHandle::data_offset)
+        .def_readonly("data_size", &binarize::ThumbnailHandle::data_size)
+        .def("read", [](binarize::ThumbnailHandle &self, FILEWrapper &file, const core::FileHeader& file_header, const core::BlockHeader& block_header) {
+                return self.read(*file.fptr, file_header, block_header);
+            }, R"pbdoc(Read block params and skip the image data)pbdoc", py::arg("file"), py::arg("file_header"), py::arg("block_header"))
+        .def("load_data", [](const binarize::ThumbnailHandle &self, FILEWrapper &file) {
+                std::vector<std::byte> data;
+                const core::EResult res = self.load_data(*file.fptr, data);
+                return std::make_pair(res, py::bytes(reinterpret_cast<const char*>(data.data()), data.size()));
+            }, R"pbdoc(Load the image data)pbdoc", py::arg("file"))
+        .def("copy_data", [](const binarize::ThumbnailHandle &self, FILEWrapper &file, int fd) {
+                core::FdOutputSink sink(fd);
+                const core::EResult res = self.copy_data(*file.fptr, sink);
+                return (res == core::EResult::Success && !sink.flush()) ? core::EResult::WriteError : res;
+            }, R"pbdoc(Copy the image data to the given file descriptor)pbdoc", py::arg("file"), py::arg("fd"));
+
     py::class_<binarize::GCodeBlock>(m, "GCodeBlock")
         .def(py::init<>())
         .def_readonly("encoding_type", &binarize::GCodeBlock::encoding_type)
@@ -507,6 +530,30 @@ PYBIND11_MODULE(MODULE_NAME, m) {
         .def("append_gcode", &binarize::Binarizer::append_gcode)
         .def("finalize", &binarize::Binarizer::finalize);
 
+    m.def("find_metadata", [](FILEWrapper &file, core::EBlockType block_type, const std::vector<std::string>& keys) {
+            const std::vector<std::string_view> key_views(keys.begin(), keys.end());
+            std::vector<std::optional<std::string>> values;
+            const core::EResult res = binarize::find_metadata(*file.fptr, block_type, key_views, values);
+            py::dict found;
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (values[i].has_value())
+                    found[py::str(keys[i])] = py::str(*values[i]);
+            }
+            return std::make_pair(res, found);
+        },
+        R"pbdoc(Search the metadata block of the given type for the given keys, returns the result and a dict of the found ones)pbdoc",
+        py::arg("file"), py::arg("block_type"), py::arg("keys")
+    );
+
+    m.def("select_thumbnail", [](FILEWrapper &file, uint16_t width, uint16_t height, const std::vector<core::EThumbnailFormat>& preferred_formats) {
+            binarize::ThumbnailBlock thumbnail;
+            const core::EResult res = binarize::select_thumbnail(*file.fptr, width, height, preferred_formats, thumbnail);
+            return std::make_pair(res, thumbnail);
+        },
+        R"pbdoc(Select the thumbnail which best fits the given size and formats, returns the result and the thumbnail, reading the image data of the selected one only)pbdoc",
+        py::arg("file"), py::arg("width"), py::arg("height"), py::arg("preferred_formats") = std::vector<core::EThumbnailFormat>()
+    );
+
     // Convert API:
 
     m.def("get_config", &get_config,  R"pbdoc(Create a default configuration for ascii to binary gcode conversion)pbdoc");
@@ -525,6 +572,26 @@ PYBIND11_MODULE(MODULE_NAME, m) {
         py::arg("infile"), py::arg("outfile"), py::arg("verify_checksum") = true
     );
 
+    m.def("from_ascii_to_binary_bytes", [](FILEWrapper &infile, const binarize::BinarizerConfig &config) {
+            core::MemoryOutputSink sink;
+            core::EResult res = convert::from_ascii_to_binary(*infile.fptr, sink, config);
+            const std::vector<std::byte>& data = sink.get_data();
+            return std::make_pair(res, py::bytes(reinterpret_cast<const char*>(data.data()), data.size()));
+        },
+        R"pbdoc(Convert ascii gcode to binary format, returns the result and the binary data as bytes)pbdoc",
+        py::arg("infile"), py::arg("config") = get_config()
+    );
+
+    m.def("from_binary_to_ascii_bytes", [] (FILEWrapper &infile, bool verify_checksum) {
+            core::MemoryOutputSink sink;
+            core::EResult res = convert::from_binary_to_ascii(*infile.fptr, sink, verify_checksum);
+            const std::vector<std::byte>& data = sink.get_data();
+            return std::make_pair(res, py::bytes(reinterpret_cast<const char*>(data.data()), data.size()));
+        },
+        R"pbdoc(Convert binary gcode to textual format, returns the result and the text as bytes)pbdoc",
+        py::arg("infile"), py::arg("verify_checksum") = true
+    );
+
 #ifdef VERSION_INFO
     m.attr("__version__") = VERSION_INFO;
 #else
@@ -14,9 +14,13 @@ from ._bgcode import (  # type: ignore
     SlicerMetadataBlock,
     FileMetadataBlock,
     ThumbnailBlock,
+    ThumbnailHandle,
     close,
+    find_metadata,
     from_ascii_to_binary,
+    from_ascii_to_binary_bytes,
     from_binary_to_ascii,
+    from_binary_to_ascii_bytes,
     get_config,
     is_open,
     open,
@@ -24,6 +28,7 @@ from ._bgcode import (  # type: ignore
     read_header,
     read_next_block_header,
     rewind,
+    select_thumbnail,
     translate_result,
     version,
 )
@@ -41,15 +46,21 @@ __all__ = [
         "PrintMetadataBlock",
         "PrinterMetadataBlock",
         "ThumbnailBlock",
+        "ThumbnailHandle",
         "close",
+        "find_metadata",
         "from_ascii_to_binary",
+        "from_ascii_to_binary_bytes",
         "from_binary_to_ascii",
+        "from_binary_to_ascii_bytes",
         "get_config",
         "is_open",
         "open",
         "read_header",
         "read_next_block_header",
+        "read_thumbnail",
         "rewind",
+        "select_thumbnail",
         "translate_result"]
 
 
@@ -109,6 +120,19 @@ def read_thumbnails(gcodefile: FILEWrapper):
 
     return thumbnails
 
+def read_thumbnail(gcodefile: FILEWrapper, width: int, height: int,
+                   preferred_formats: Union[list, None] = None):
+    """Read the thumbnail which best fits the given size from binary gcode
+    file, preferring formats in the given order. Only the image data of the
+    selected thumbnail are read. Returns None if there are no thumbnails."""
+    res, thumbnail_block = select_thumbnail(gcodefile, width, height,
+                                            preferred_formats or [])
+    if res == EResult.BlockNotFound:
+        return None
+    if res != EResult.Success:
+        raise ResultError(res)
+    return {"meta": thumbnail_block.params, "bytes": thumbnail_block.data()}
+
 def read_metadata(gcodefile: FILEWrapper, type: str = 'printer'):
     """Read metadata from binary gcode file.
     Possible variants for metadata type are 'file', 'print', 'printer'
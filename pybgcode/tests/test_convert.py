@@ -5,8 +5,12 @@ import pytest
 
 import pybgcode
 from pybgcode import (
+    EBlockType,
     EResult,
     EThumbnailFormat,
+    get_block_header,
+    get_header,
+    read_thumbnail,
     read_thumbnails,
     read_metadata,
     read_connect_metadata,
@@ -112,5 +116,74 @@ def test_main():
     assert filecmp.cmp(TEST_GCODE, TEST_REVERSE_GCODE, shallow=False)
 
 
+def test_find_metadata():
+    in_f = pybgcode.open(TEST_BGCODE, "rb")
+    res, found = pybgcode.find_metadata(
+        in_f, pybgcode.EBlockType.PrinterMetadata,
+        ['printer_model', 'filament used [g]', 'missing key'])
+    pybgcode.close(in_f)
+    assert res == EResult.Success
+    assert found == {'printer_model': 'MINI', 'filament used [g]': '3.01'}
+
+
+def test_convert_to_bytes():
+    in_f = pybgcode.open(TEST_GCODE, "r")
+    cfg = pybgcode.get_config()
+    cfg.compression.file_metadata = pybgcode.CompressionType.Heatshrink_11_4
+    res, binary = pybgcode.from_ascii_to_binary_bytes(in_f, cfg)
+    pybgcode.close(in_f)
+    assert res == EResult.Success
+
+    with open(TEST_BGCODE, "rb") as bgcode:
+        assert binary == bgcode.read()
+
+    in_f = pybgcode.open(TEST_BGCODE, "rb")
+    res, text = pybgcode.from_binary_to_ascii_bytes(in_f, True)
+    pybgcode.close(in_f)
+    assert res == EResult.Success
+
+    with open(TEST_GCODE, "rb") as gcode:
+        assert text == gcode.read()
+
+
+def test_thumbnail_handles():
+    in_f = pybgcode.open(TEST_BGCODE, "rb")
+    thumbnails = read_thumbnails(in_f)
+
+    _, header = get_header(in_f)
+    handles = []
+    while True:
+        block_header = get_block_header(in_f, header, EBlockType.Thumbnail)
+        if not block_header:
+            break
+        handle = pybgcode.ThumbnailHandle()
+        assert handle.read(in_f, header, block_header) == EResult.Success
+        handles.append(handle)
+
+    assert len(handles) == TEST_THUMBNAILS
+    for handle, thumb in zip(handles, thumbnails):
+        assert handle.params.width == thumb["meta"].width
+        assert handle.data_size == len(thumb["bytes"])
+        res, data = handle.load_data(in_f)
+        assert res == EResult.Success
+        assert data == thumb["bytes"]
+    pybgcode.close(in_f)
+
+
+def test_read_thumbnail():
+    in_f = pybgcode.open(TEST_BGCODE, "rb")
+    thumbnails = read_thumbnails(in_f)
+    largest = max(thumbnails,
+                  key=lambda t: t["meta"].width * t["meta"].height)
+    smallest = min(thumbnails,
+                   key=lambda t: t["meta"].width * t["meta"].height)
+
+    thumb = read_thumbnail(in_f, 4096, 4096)
+    assert thumb["bytes"] == largest["bytes"]
+    thumb = read_thumbnail(in_f, 1, 1)
+    assert thumb["bytes"] == smallest["bytes"]
+    pybgcode.close(in_f)
+
+
 if __name__ == "__main__":
     pytest.main()
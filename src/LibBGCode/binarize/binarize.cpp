@@ -1,7 +1,9 @@
 #include "binarize.hpp"
 #include "meatpack.hpp"
+#include "tokenpack.hpp"
 
 #include "core/core_impl.hpp"
+#include "core/thread_pool.hpp"
 
 extern "C" {
 #include <heatshrink/heatshrink_encoder.h>
@@ -11,6 +13,11 @@ extern "C" {
 
 #include <cstring>
 #include <cassert>
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <limits>
+#include <tuple>
 
 namespace bgcode {
 
@@ -19,10 +26,9 @@ using namespace core;
 namespace binarize {
 
 template<class T>
-static bool write_to_file(FILE& file, const T* data, size_t data_size)
+static bool write_to_sink(OutputSink& sink, const T* data, size_t data_size)
 {
-    const size_t wsize = fwrite(static_cast<const void*>(data), 1, data_size, &file);
-    return !ferror(&file) && wsize == data_size;
+    return sink.write(static_cast<const void*>(data), data_size);
 }
 
 template<class T>
@@ -34,68 +40,114 @@ static bool read_from_file(FILE& file, T *data, size_t data_size)
     return !ferror(&file) && rsize == data_size;
 }
 
-void update_checksum(Checksum& checksum, const ThumbnailBlock &th)
+static uint16_t metadata_encoding_types_count() { return 1 + (uint16_t)EMetadataEncodingType::Binary; }
+static uint16_t thumbnail_formats_count()       { return 1 + (uint16_t)EThumbnailFormat::QOI; }
+static uint16_t gcode_encoding_types_count()    { return 1 + (uint16_t)EGCodeEncodingType::TokenPack; }
+
+// Keys which the Binary metadata encoding stores as an index into this table.
+// The table is part of the file format: entries can only be appended.
+static constexpr const std::array<std::string_view, 30> InternedMetadataKeys = {
+    "printer_model", "filament_type", "filament_abrasive", "nozzle_diameter", "nozzle_high_flow", "bed_temperature",
+    "brim_width", "fill_density", "layer_height", "temperature", "ironing", "support_material", "max_layer_z",
+    "extruder_colour", "filament used [mm]", "filament used [g]", "estimated printing time (normal mode)",
+    "filament used [cm3]", "filament cost", "total filament used [g]", "total filament cost",
+    "total filament used for wipe tower [g]", "estimated printing time (silent mode)",
+    "estimated first layer printing time (normal mode)", "estimated first layer printing time (silent mode)",
+    "objects_info", "total toolchanges", "Producer", "Produced on", "Prepared by"
+};
+
+// Maximum size of the prefix a front coded key of the Binary metadata encoding shares with the previous key,
+// bounding the size of the keys rebuilt while decoding to a fixed multiple of the payload size
+static constexpr uint32_t MaxSharedKeyPrefix = 255;
+
+// Unsigned LEB128
+static void append_varint(std::vector<uint8_t>& dst, uint32_t value)
 {
-    checksum.append(th.params.format);
-    checksum.append(th.params.width);
-    checksum.append(th.params.height);
-    checksum.append(th.data);
+    while (value >= 0x80) {
+        dst.emplace_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    dst.emplace_back((uint8_t)value);
 }
 
-static std::vector<uint8_t> encode(const std::byte* data, size_t data_size)
+// Returns false if the varint is truncated or does not fit into 32 bits
+static bool read_varint(const uint8_t*& it, const uint8_t* end, uint32_t& value)
 {
-    std::vector<uint8_t> ret(data_size);
-    memcpy(ret.data(), data, data_size);
-    return ret;
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (it == end)
+            return false;
+        const uint8_t byte = *it++;
+        if (shift == 28 && byte > 0x0f)
+            return false;
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
 }
 
-static uint16_t metadata_encoding_types_count() { return 1 + (uint16_t)EMetadataEncodingType::INI; }
-static uint16_t thumbnail_formats_count()       { return 1 + (uint16_t)EThumbnailFormat::QOI; }
-static uint16_t gcode_encoding_types_count()    { return 1 + (uint16_t)EGCodeEncodingType::MeatPackComments; }
-
 static bool encode_metadata(const std::vector<std::pair<std::string, std::string>>& src, std::vector<uint8_t>& dst,
     EMetadataEncodingType encoding_type)
 {
-    for (const auto& [key, value] : src) {
-        switch (encoding_type)
-        {
-        case EMetadataEncodingType::INI:
-        {
+    switch (encoding_type)
+    {
+    case EMetadataEncodingType::INI:
+    {
+        for (const auto& [key, value] : src) {
             dst.insert(dst.end(), key.begin(), key.end());
             dst.emplace_back('=');
             dst.insert(dst.end(), value.begin(), value.end());
             dst.emplace_back('\n');
-            break;
-        }
         }
+        break;
     }
-    return true;
-}
-
-static bool decode_metadata(const std::vector<uint8_t>& src, std::vector<std::pair<std::string, std::string>>& dst,
-    EMetadataEncodingType encoding_type)
-{
-    switch (encoding_type)
-    {
-    case EMetadataEncodingType::INI:
+    case EMetadataEncodingType::Binary:
     {
-        auto begin_it = src.begin();
-        auto end_it = src.begin();
-        while (end_it != src.end()) {
-            while (end_it != src.end() && *end_it != '\n') {
-                ++end_it;
+        // the key references and all the lengths come first, then the key data and the values:
+        // the values, not interleaved with lengths, stay compressible
+        if (src.size() > UINT32_MAX)
+            return false;
+        append_varint(dst, (uint32_t)src.size());
+        // length of the prefix shared with the previous key, for front coded keys
+        std::vector<uint32_t> prefixes(src.size());
+        std::string_view prev_key;
+        for (size_t i = 0; i < src.size(); ++i) {
+            const std::string& key = src[i].first;
+            if (key.size() > UINT32_MAX / 2 || src[i].second.size() > UINT32_MAX)
+                return false;
+            const auto interned_it = std::find(InternedMetadataKeys.begin(), InternedMetadataKeys.end(), key);
+            if (interned_it != InternedMetadataKeys.end()) {
+                // interned key: odd reference
+                append_varint(dst, 1 + 2 * (uint32_t)std::distance(InternedMetadataKeys.begin(), interned_it));
+                prefixes[i] = (uint32_t)key.size();
             }
-            const std::string item(begin_it, end_it);
-            const size_t pos = item.find_first_of('=');
-            if (pos != std::string::npos) {
-                dst.emplace_back(std::make_pair(item.substr(0, pos), item.substr(pos + 1)));
-                begin_it = ++end_it;
+            else {
+                // front coded key: even reference holding the length of the prefix shared with the previous key,
+                // followed by the length of the remaining key data
+                const size_t max_prefix = std::min({ prev_key.size(), key.size(), (size_t)MaxSharedKeyPrefix });
+                size_t prefix = 0;
+                while (prefix < max_prefix && prev_key[prefix] == key[prefix]) {
+                    ++prefix;
+                }
+                append_varint(dst, 2 * (uint32_t)prefix);
+                append_varint(dst, (uint32_t)(key.size() - prefix));
+                prefixes[i] = (uint32_t)prefix;
             }
+            prev_key = key;
+        }
+        for (const auto& [key, value] : src) {
+            append_varint(dst, (uint32_t)value.size());
+        }
+        for (size_t i = 0; i < src.size(); ++i) {
+            dst.insert(dst.end(), src[i].first.begin() + prefixes[i], src[i].first.end());
+        }
+        for (const auto& [key, value] : src) {
+            dst.insert(dst.end(), value.begin(), value.end());
         }
         break;
     }
     }
-
     return true;
 }
 
@@ -114,51 +166,25 @@ static bool encode_gcode(const std::string& src, std::vector<uint8_t>& dst, EGCo
         uint8_t binarizer_flags = (encoding_type == EGCodeEncodingType::MeatPack) ? MeatPack::Flag_RemoveComments : 0;
         binarizer_flags |= MeatPack::Flag_OmitWhitespaces;
         MeatPack::MPBinarizer binarizer(binarizer_flags);
-        binarizer.initialize(dst);
-        auto begin_it = src.begin();
-        auto end_it = src.begin();
-        while (end_it != src.end()) {
-            while (end_it != src.end() && *end_it != '\n') {
-                ++end_it;
-            }
-            const std::string line(begin_it, ++end_it);
-            binarizer.binarize_line(line, dst);
-            begin_it = end_it;
-        }
-        binarizer.finalize(dst);
-        break;
-    }
-    }
-    return true;
-}
-
-static bool decode_gcode(const std::vector<uint8_t>& src, std::string& dst, EGCodeEncodingType encoding_type)
-{
-    switch (encoding_type)
-    {
-    case EGCodeEncodingType::None:
-    {
-        dst.insert(dst.end(), src.begin(), src.end());
+        binarizer.binarize(src, dst);
         break;
     }
-    case EGCodeEncodingType::MeatPack:
-    case EGCodeEncodingType::MeatPackComments:
+    case EGCodeEncodingType::TokenPack:
     {
-        MeatPack::unbinarize(src, dst);
+        TokenPack::encode(src, dst);
         break;
     }
     }
     return true;
 }
 
+// Appends the compressed data to dst
 static bool compress(std::vector<uint8_t>& src, std::vector<uint8_t>& dst, ECompressionType compression_type)
 {
     switch (compression_type)
     {
     case ECompressionType::Deflate:
     {
-        dst.clear();
-
         const size_t BUFSIZE = 2048;
         std::vector<uint8_t> temp_buffer(BUFSIZE);
 
@@ -217,10 +243,11 @@ static bool compress(std::vector<uint8_t>& src, std::vector<uint8_t>& dst, EComp
         // calculate the maximum compressed size (assuming a conservative estimate)
         const size_t src_size = src.size();
         const size_t max_compressed_size = src_size + (src_size >> 2);
-        dst.resize(max_compressed_size);
+        const size_t dst_offset = dst.size();
+        dst.resize(dst_offset + max_compressed_size);
 
         uint8_t* buf = src.data();
-        uint8_t* outbuf = dst.data();
+        uint8_t* outbuf = dst.data() + dst_offset;
 
         // compress data
         size_t tosink = src_size;
@@ -262,7 +289,7 @@ static bool compress(std::vector<uint8_t>& src, std::vector<uint8_t>& dst, EComp
             heatshrink_encoder_free(encoder);
             return false;
         }
-        dst.resize(output_size + polled);
+        dst.resize(dst_offset + output_size + polled);
         heatshrink_encoder_free(encoder);
         break;
     }
@@ -389,57 +416,545 @@ static bool uncompress(const std::vector<uint8_t>& src, std::vector<uint8_t>& ds
 }
 
 
-// write block header and data in encoded format
-core::EResult write(const BaseMetadataBlock &block, FILE& file, core::EBlockType block_type, core::ECompressionType compression_type, core::Checksum &checksum)
+// Reads through the given function bool(uint8_t* data, size_t size) the payload data of the given block
+// (following the block parameters) in chunks and passes them, uncompressed, to the given function
+// bool(const uint8_t* data, size_t size).
+// The consumer function returns false to stop reading, in which case the source is left inside the block.
+template<class Reader, class Consumer>
+static EResult read_payload_chunks(const BlockHeader& block_header, Reader&& reader, Consumer&& consumer)
 {
-    if (block.encoding_type > metadata_encoding_types_count())
-        return EResult::InvalidMetadataEncodingType;
+    const ECompressionType compression_type = (ECompressionType)block_header.compression;
+    size_t to_read = (compression_type == ECompressionType::None) ? block_header.uncompressed_size : block_header.compressed_size;
 
-    BlockHeader block_header((uint16_t)block_type, (uint16_t)compression_type, (uint32_t)0);
-    std::vector<uint8_t> out_data;
-    if (!block.raw_data.empty()) {
-        // process payload encoding
-        std::vector<uint8_t> uncompressed_data;
-        if (!encode_metadata(block.raw_data, uncompressed_data, (EMetadataEncodingType)block.encoding_type))
-            return EResult::MetadataEncodingError;
-        // process payload compression
-        block_header.uncompressed_size = (uint32_t)uncompressed_data.size();
-        std::vector<uint8_t> compressed_data;
-        if (compression_type != ECompressionType::None) {
-            if (!compress(uncompressed_data, compressed_data, compression_type))
-                return EResult::DataCompressionError;
-            block_header.compressed_size = (uint32_t)compressed_data.size();
+    const size_t BUFSIZE = 4096;
+    std::array<uint8_t, BUFSIZE> in_buffer;
+    std::array<uint8_t, BUFSIZE> out_buffer;
+
+    auto read_chunk = [&](size_t& size) {
+        size = std::min(to_read, BUFSIZE);
+        if (!reader(in_buffer.data(), size))
+            return false;
+        to_read -= size;
+        return true;
+    };
+
+    switch (compression_type)
+    {
+    case ECompressionType::None:
+    {
+        while (to_read > 0) {
+            size_t size;
+            if (!read_chunk(size))
+                return EResult::ReadError;
+            if (!consumer(in_buffer.data(), size))
+                break;
+        }
+        break;
+    }
+    case ECompressionType::Deflate:
+    {
+        z_stream strm{};
+        if (inflateInit(&strm) != Z_OK)
+            return EResult::DataUncompressionError;
+
+        int res = Z_OK;
+        bool stopped = false;
+        while (res != Z_STREAM_END && !stopped) {
+            if (strm.avail_in == 0 && to_read > 0) {
+                size_t size;
+                if (!read_chunk(size)) {
+                    inflateEnd(&strm);
+                    return EResult::ReadError;
+                }
+                strm.next_in = in_buffer.data();
+                strm.avail_in = (uInt)size;
+            }
+            strm.next_out = out_buffer.data();
+            strm.avail_out = BUFSIZE;
+            res = inflate(&strm, Z_NO_FLUSH);
+            if (res != Z_OK && res != Z_STREAM_END) {
+                inflateEnd(&strm);
+                return EResult::DataUncompressionError;
+            }
+            const size_t produced = BUFSIZE - strm.avail_out;
+            if (produced > 0 && !consumer(out_buffer.data(), produced))
+                stopped = true;
         }
-        out_data.swap((compression_type == ECompressionType::None) ? uncompressed_data : compressed_data);
+        inflateEnd(&strm);
+        break;
     }
+    case ECompressionType::Heatshrink_11_4:
+    case ECompressionType::Heatshrink_12_4:
+    {
+        const uint8_t window_sz = (compression_type == ECompressionType::Heatshrink_11_4) ? 11 : 12;
+        const uint8_t lookahead_sz = 4;
+        const uint16_t input_buffer_size = 2048;
+        heatshrink_decoder* decoder = heatshrink_decoder_alloc(input_buffer_size, window_sz, lookahead_sz);
+        if (decoder == nullptr)
+            return EResult::DataUncompressionError;
 
-    // write block header
-    EResult res = block_header.write(file);
-    if (res != EResult::Success)
-        // propagate error
+        // polls all the available output, returns false if stopped by the consumer
+        EResult res = EResult::Success;
+        auto poll = [&]() {
+            HSD_poll_res poll_res;
+            do {
+                size_t count = 0;
+                poll_res = heatshrink_decoder_poll(decoder, out_buffer.data(), BUFSIZE, &count);
+                if (poll_res < 0) {
+                    res = EResult::DataUncompressionError;
+                    return false;
+                }
+                if (count > 0 && !consumer(out_buffer.data(), count))
+                    return false;
+            } while (poll_res == HSDR_POLL_MORE);
+            return true;
+        };
+
+        bool proceed = true;
+        while (proceed && to_read > 0) {
+            size_t size;
+            if (!read_chunk(size)) {
+                res = EResult::ReadError;
+                break;
+            }
+            size_t sunk = 0;
+            while (proceed && sunk < size) {
+                size_t count = 0;
+                if (heatshrink_decoder_sink(decoder, &in_buffer[sunk], size - sunk, &count) < 0) {
+                    res = EResult::DataUncompressionError;
+                    proceed = false;
+                    break;
+                }
+                sunk += count;
+                proceed = poll();
+            }
+        }
+        if (proceed && res == EResult::Success && heatshrink_decoder_finish(decoder) == HSDR_FINISH_MORE)
+            poll();
+
+        heatshrink_decoder_free(decoder);
         return res;
+    }
+    default:
+    {
+        return EResult::InvalidCompressionType;
+    }
+    }
 
-    // write block payload
-    if (!write_to_file(file, &block.encoding_type, sizeof(block.encoding_type)))
-        return EResult::WriteError;
-    if (!out_data.empty()) {
-        if (!write_to_file(file, out_data.data(), out_data.size()))
-            return EResult::WriteError;
+    return EResult::Success;
+}
+
+// As above, reading from the given file
+template<class Consumer>
+static EResult read_payload_chunks(FILE& file, const BlockHeader& block_header, Consumer&& consumer)
+{
+    return read_payload_chunks(block_header, [&file](uint8_t* data, size_t size) { return read_from_file(file, data, size); },
+        std::forward<Consumer>(consumer));
+}
+
+// Capacity to reserve for the uncompressed payload of the given block, whose data start at the current position of the given file:
+// the header is not trusted beyond the size of the payload stored into the file, which must fit into the rest of the file
+static size_t payload_reserve_size(FILE& file, const BlockHeader& block_header)
+{
+    const size_t stored_size = (block_header.compression == (uint16_t)ECompressionType::None) ?
+        block_header.uncompressed_size : block_header.compressed_size;
+    const long pos = ftell(&file);
+    if (pos < 0 || fseek(&file, 0, SEEK_END) != 0)
+        return 0;
+    const long file_size = ftell(&file);
+    if (fseek(&file, pos, SEEK_SET) != 0 || file_size < pos)
+        return 0;
+    return std::min({ (size_t)block_header.uncompressed_size, stored_size, (size_t)(file_size - pos) });
+}
+
+// Scans INI data received in chunks, passing each key/value item to the given function
+// bool(std::string_view key, std::string_view value), which returns false to stop the scan.
+// Lines split between chunks are the only ones copied.
+class IniScanner
+{
+public:
+    template<class Callback>
+    bool append(const uint8_t* data, size_t size, Callback&& callback) {
+        const char* begin = reinterpret_cast<const char*>(data);
+        const char* end = begin + size;
+        while (begin < end) {
+            const char* line_end = static_cast<const char*>(memchr(begin, '\n', end - begin));
+            if (line_end == nullptr) {
+                // incomplete line, wait for more data
+                m_partial_line.append(begin, end);
+                break;
+            }
+            bool proceed;
+            if (m_partial_line.empty())
+                proceed = scan_line(std::string_view(begin, line_end - begin), callback);
+            else {
+                m_partial_line.append(begin, line_end);
+                proceed = scan_line(m_partial_line, callback);
+                m_partial_line.clear();
+            }
+            if (!proceed)
+                return false;
+            begin = line_end + 1;
+        }
+        return true;
+    }
+
+    // Scans the last line, if not terminated by a newline
+    template<class Callback>
+    bool finalize(Callback&& callback) {
+        const bool ret = m_partial_line.empty() || scan_line(m_partial_line, callback);
+        m_partial_line.clear();
+        return ret;
     }
 
-    if (checksum.get_type() != EChecksumType::None) {
-        // update checksum with block header
-        update_checksum(checksum, block_header);
-        // update checksum with block payload
-        checksum.append(block.encoding_type);
-        if (!out_data.empty())
-            checksum.append(static_cast<unsigned char*>(out_data.data()), out_data.size());
+private:
+    std::string m_partial_line;
+
+    template<class Callback>
+    static bool scan_line(std::string_view line, Callback&& callback) {
+        const size_t pos = line.find('=');
+        return (pos == std::string_view::npos) || callback(line.substr(0, pos), line.substr(pos + 1));
+    }
+};
+
+// Buffer used to assemble a whole block (header, parameters, payload and checksum),
+// so that the block is sent to the sink with a single write.
+// Kept per thread and reused, to avoid reallocations for every block.
+static std::vector<uint8_t>& block_buffer()
+{
+    static thread_local std::vector<uint8_t> buffer;
+    return buffer;
+}
+
+// Scratch buffer for the uncompressed payload of compressed blocks
+static std::vector<uint8_t>& uncompressed_buffer()
+{
+    static thread_local std::vector<uint8_t> buffer;
+    return buffer;
+}
+
+// Capacity above which the per thread buffers are released once the block is written,
+// so that a single large block (i.e. a big thumbnail) does not stay allocated for the thread lifetime
+static constexpr size_t MaxKeptBufferCapacity = 1024 * 1024;
+
+// Releases the memory of the given per thread buffer, on scope exit, if it grew above MaxKeptBufferCapacity
+class BufferReleaser
+{
+public:
+    explicit BufferReleaser(std::vector<uint8_t>& buffer) : m_buffer(buffer) {}
+    ~BufferReleaser() {
+        if (m_buffer.capacity() > MaxKeptBufferCapacity)
+            std::vector<uint8_t>().swap(m_buffer);
+    }
+    BufferReleaser(const BufferReleaser&) = delete;
+    BufferReleaser& operator=(const BufferReleaser&) = delete;
+
+private:
+    std::vector<uint8_t>& m_buffer;
+};
+
+// Stores the given block header at the beginning of the given buffer,
+// which must be at least block_header.get_size() bytes long
+static void store_block_header(const BlockHeader& block_header, uint8_t* dst)
+{
+    store_integer_le(block_header.type, dst);
+    store_integer_le(block_header.compression, dst + 2);
+    store_integer_le(block_header.uncompressed_size, dst + 4);
+    if (block_header.compression != (uint16_t)ECompressionType::None)
+        store_integer_le(block_header.compressed_size, dst + 8);
+}
+
+// Completes the block assembled in the given buffer with the header and the checksum
+// and writes it to the sink.
+// The buffer must contain block_header.get_size() bytes reserved for the header, followed by the payload.
+static EResult write_block(OutputSink& sink, const BlockHeader& block_header, std::vector<uint8_t>& block, EChecksumType checksum_type)
+{
+    store_block_header(block_header, block.data());
+
+    if (checksum_type != EChecksumType::None) {
+        // the checksum covers the block header and the block payload
+        Checksum cs(checksum_type);
+        cs.append(block.data(), block.size());
+        const uint8_t* checksum_data = reinterpret_cast<const uint8_t*>(cs.get_data());
+        block.insert(block.end(), checksum_data, checksum_data + cs.get_size());
     }
 
+    if (!write_to_sink(sink, block.data(), block.size()))
+        return EResult::WriteError;
+
     return EResult::Success;
 }
 
+// Assembles in the block buffer and writes a block having the 16 bit encoding type as parameter
+// and the payload produced by the given encode function, compressed with the given compression type
+template<class EncodeFn>
+static EResult write_encoded_block(OutputSink& sink, EBlockType block_type, ECompressionType compression_type, EChecksumType checksum_type,
+    uint16_t encoding_type, bool has_payload, EResult encoding_error, EncodeFn&& encode_payload)
+{
+    BlockHeader block_header((uint16_t)block_type, (uint16_t)compression_type, (uint32_t)0);
+    const size_t header_size = block_header.get_size();
+    const size_t payload_offset = header_size + sizeof(encoding_type);
+
+    std::vector<uint8_t>& block = block_buffer();
+    BufferReleaser block_releaser(block);
+    block.resize(header_size);
+    store_integer_le(encoding_type, std::back_inserter(block));
+
+    if (has_payload) {
+        if (compression_type == ECompressionType::None) {
+            // process payload encoding, directly into the block
+            if (!encode_payload(block))
+                return encoding_error;
+            block_header.uncompressed_size = (uint32_t)(block.size() - payload_offset);
+        }
+        else {
+            // process payload encoding
+            std::vector<uint8_t>& uncompressed_data = uncompressed_buffer();
+            BufferReleaser uncompressed_releaser(uncompressed_data);
+            uncompressed_data.clear();
+            if (!encode_payload(uncompressed_data))
+                return encoding_error;
+            block_header.uncompressed_size = (uint32_t)uncompressed_data.size();
+            // process payload compression, directly into the block
+            if (!compress(uncompressed_data, block, compression_type))
+                return EResult::DataCompressionError;
+            block_header.compressed_size = (uint32_t)(block.size() - payload_offset);
+        }
+    }
+
+    return write_block(sink, block_header, block, checksum_type);
+}
+
+// write block header, data in encoded format and checksum
+static EResult write(const BaseMetadataBlock& block, OutputSink& sink, EBlockType block_type, ECompressionType compression_type, EChecksumType checksum_type)
+{
+    if (block.encoding_type > metadata_encoding_types_count())
+        return EResult::InvalidMetadataEncodingType;
+
+    return write_encoded_block(sink, block_type, compression_type, checksum_type, block.encoding_type, !block.raw_data.empty(),
+        EResult::MetadataEncodingError, [&block](std::vector<uint8_t>& dst) {
+            return encode_metadata(block.raw_data, dst, (EMetadataEncodingType)block.encoding_type);
+        });
+}
+
+MetadataStorage::value_type MetadataStorage::operator[](size_t id) const
+{
+    const Item& item = m_items[id];
+    const char* data = reinterpret_cast<const char*>(m_buffer.data());
+    return { std::string_view(data + item.key_offset, item.key_size), std::string_view(data + item.value_offset, item.value_size) };
+}
+
+void MetadataStorage::clear()
+{
+    m_buffer.clear();
+    m_items.clear();
+    m_index.clear();
+}
+
+void MetadataStorage::emplace_back(std::string_view key, std::string_view value)
+{
+    m_index.clear();
+    const uint32_t key_offset = (uint32_t)m_buffer.size();
+    m_buffer.insert(m_buffer.end(), key.begin(), key.end());
+    const uint32_t value_offset = (uint32_t)m_buffer.size();
+    m_buffer.insert(m_buffer.end(), value.begin(), value.end());
+    m_items.push_back({ key_offset, (uint32_t)key.size(), value_offset, (uint32_t)value.size() });
+}
+
+bool MetadataStorage::decode(std::vector<uint8_t>&& data, EMetadataEncodingType encoding_type)
+{
+    m_items.clear();
+    m_index.clear();
+    m_buffer = std::move(data);
+    if (m_buffer.size() > UINT32_MAX)
+        return false;
+
+    const uint8_t* begin = m_buffer.data();
+    const uint8_t* end = begin + m_buffer.size();
+    switch (encoding_type)
+    {
+    case EMetadataEncodingType::INI:
+    {
+        // one item per line, in the form key=value
+        const uint8_t* line = begin;
+        while (line < end) {
+            const uint8_t* line_end = static_cast<const uint8_t*>(memchr(line, '\n', end - line));
+            if (line_end == nullptr)
+                line_end = end;
+            const uint8_t* separator = static_cast<const uint8_t*>(memchr(line, '=', line_end - line));
+            if (separator != nullptr) {
+                m_items.push_back({ (uint32_t)(line - begin), (uint32_t)(separator - line),
+                    (uint32_t)(separator + 1 - begin), (uint32_t)(line_end - separator - 1) });
+            }
+            line = line_end + 1;
+        }
+        break;
+    }
+    case EMetadataEncodingType::Binary:
+    {
+        // single bounds checked pass, values are referenced in place,
+        // keys are referenced in place unless they are interned or share a prefix with the previous key,
+        // in which case they are rebuilt at the end of the buffer
+        const size_t payload_size = m_buffer.size();
+        if (payload_size == 0)
+            break;
+        const uint8_t* it = m_buffer.data();
+        const uint8_t* const end = m_buffer.data() + payload_size;
+        uint32_t count;
+        // each item takes at least 2 bytes
+        if (!read_varint(it, end, count) || count > payload_size / 2)
+            return false;
+
+        // items not published if the data are invalid
+        std::vector<Item> items(count);
+        // key references: the key size, and the size of the prefix shared with the previous key or UINT32_MAX for interned keys,
+        // temporarily stored into key_size and key_offset
+        size_t key_data_size = 0;
+        for (Item& item : items) {
+            uint32_t key_ref;
+            if (!read_varint(it, end, key_ref))
+                return false;
+            if ((key_ref & 1) != 0) {
+                if ((key_ref >> 1) >= InternedMetadataKeys.size())
+                    return false;
+                item.key_offset = UINT32_MAX;
+                item.key_size = key_ref >> 1;
+            }
+            else {
+                uint32_t suffix;
+                if (!read_varint(it, end, suffix))
+                    return false;
+                key_data_size += suffix;
+                if (key_data_size > payload_size)
+                    return false;
+                item.key_offset = key_ref >> 1;
+                item.key_size = suffix;
+            }
+        }
+        // value lengths
+        size_t value_data_size = 0;
+        for (Item& item : items) {
+            if (!read_varint(it, end, item.value_size))
+                return false;
+            value_data_size += item.value_size;
+            if (value_data_size > payload_size)
+                return false;
+        }
+        // the key data and the values take the rest of the payload
+        size_t pos = it - m_buffer.data();
+        if (payload_size - pos != key_data_size + value_data_size)
+            return false;
+
+        uint32_t prev_key_offset = 0;
+        uint32_t prev_key_size = 0;
+        size_t value_pos = pos + key_data_size;
+        for (Item& item : items) {
+            if (item.key_offset == UINT32_MAX) {
+                const std::string_view key = InternedMetadataKeys[item.key_size];
+                item.key_offset = (uint32_t)m_buffer.size();
+                item.key_size = (uint32_t)key.size();
+                m_buffer.insert(m_buffer.end(), key.begin(), key.end());
+            }
+            else {
+                const uint32_t prefix = item.key_offset;
+                const uint32_t suffix = item.key_size;
+                if (prefix > prev_key_size || prefix > MaxSharedKeyPrefix)
+                    return false;
+                if (prefix == 0)
+                    item.key_offset = (uint32_t)pos;
+                else {
+                    item.key_offset = (uint32_t)m_buffer.size();
+                    m_buffer.resize(m_buffer.size() + prefix + suffix);
+                    memcpy(m_buffer.data() + item.key_offset, m_buffer.data() + prev_key_offset, prefix);
+                    memcpy(m_buffer.data() + item.key_offset + prefix, m_buffer.data() + pos, suffix);
+                }
+                item.key_size = prefix + suffix;
+                pos += suffix;
+            }
+            prev_key_offset = item.key_offset;
+            prev_key_size = item.key_size;
+            item.value_offset = (uint32_t)value_pos;
+            value_pos += item.value_size;
+        }
+        if (m_buffer.size() > UINT32_MAX)
+            return false;
+        m_items = std::move(items);
+        break;
+    }
+    default:
+    {
+        return false;
+    }
+    }
+
+    return true;
+}
+
+std::vector<std::pair<std::string, std::string>> MetadataStorage::to_vector() const
+{
+    std::vector<std::pair<std::string, std::string>> ret;
+    ret.reserve(m_items.size());
+    for (const auto& [key, value] : *this) {
+        ret.emplace_back(key, value);
+    }
+    return ret;
+}
+
+std::optional<std::string_view> MetadataStorage::find(std::string_view key) const
+{
+    if (m_index.empty()) {
+        for (const auto& [item_key, item_value] : *this) {
+            if (item_key == key)
+                return item_value;
+        }
+        return std::nullopt;
+    }
+
+    const size_t mask = m_index.size() - 1;
+    for (size_t slot = std::hash<std::string_view>()(key) & mask; m_index[slot] != 0; slot = (slot + 1) & mask) {
+        const value_type item = (*this)[m_index[slot] - 1];
+        if (item.first == key)
+            return item.second;
+    }
+    return std::nullopt;
+}
+
+void MetadataStorage::build_index()
+{
+    // keep the load factor at most 0.5
+    size_t index_size = 16;
+    while (index_size < 2 * m_items.size()) {
+        index_size *= 2;
+    }
+    m_index.assign(index_size, 0);
+
+    // items are inserted in order, so that the probing finds the first of duplicated keys first
+    const size_t mask = index_size - 1;
+    for (uint32_t id = 0; id < (uint32_t)m_items.size(); ++id) {
+        size_t slot = std::hash<std::string_view>()((*this)[id].first) & mask;
+        while (m_index[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        m_index[slot] = id + 1;
+    }
+}
+
 EResult BaseMetadataBlock::read_data(FILE& file, const BlockHeader& block_header)
+{
+    MetadataStorage storage;
+    EResult res = read_data(file, block_header, storage);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    raw_data.reserve(raw_data.size() + storage.size());
+    for (const auto& [key, value] : storage) {
+        raw_data.emplace_back(key, value);
+    }
+    return EResult::Success;
+}
+
+EResult BaseMetadataBlock::read_data(FILE& file, const BlockHeader& block_header, MetadataStorage& storage)
 {
     const ECompressionType compression_type = (ECompressionType)block_header.compression;
 
@@ -462,33 +977,17 @@ EResult BaseMetadataBlock::read_data(FILE& file, const BlockHeader& block_header
             return EResult::DataUncompressionError;
     }
 
-    if (!decode_metadata((compression_type == ECompressionType::None) ? data : uncompressed_data, raw_data, (EMetadataEncodingType)encoding_type))
+    // the storage takes ownership of the decoded payload, no copies of the items are made
+    if (!storage.decode(std::move((compression_type == ECompressionType::None) ? data : uncompressed_data), (EMetadataEncodingType)encoding_type))
         return EResult::MetadataDecodingError;
 
     return EResult::Success;
 }
 
-EResult FileMetadataBlock::write(FILE& file, ECompressionType compression_type, EChecksumType checksum_type) const
-{
-    Checksum cs(checksum_type);
-
-    // write block header, payload
-    EResult res = binarize::write(*this, file, EBlockType::FileMetadata, compression_type, cs);
-    if (res != EResult::Success)
-        // propagate error
-        return res;
-
-    // write block checksum
-    if (checksum_type != EChecksumType::None)
-        return cs.write(file);
-
-    return EResult::Success;
-}
-
-EResult FileMetadataBlock::read_data(FILE& file, const FileHeader& file_header, const BlockHeader& block_header)
+EResult BaseMetadataBlock::read_data(FILE& file, const FileHeader& file_header, const BlockHeader& block_header, MetadataStorage& storage)
 {
     // read block payload
-    EResult res = BaseMetadataBlock::read_data(file, block_header);
+    EResult res = read_data(file, block_header, storage);
     if (res != EResult::Success)
         // propagate error
         return res;
@@ -505,23 +1004,48 @@ EResult FileMetadataBlock::read_data(FILE& file, const FileHeader& file_header,
     return EResult::Success;
 }
 
-EResult PrintMetadataBlock::write(FILE& file, ECompressionType compression_type, EChecksumType checksum_type) const
+EResult FileMetadataBlock::write(FILE& file, ECompressionType compression_type, EChecksumType checksum_type) const
+{
+    FileOutputSink sink(file);
+    return write(sink, compression_type, checksum_type);
+}
+
+EResult FileMetadataBlock::write(OutputSink& sink, ECompressionType compression_type, EChecksumType checksum_type) const
 {
-    Checksum cs(checksum_type);
+    return binarize::write(*this, sink, EBlockType::FileMetadata, compression_type, checksum_type);
+}
 
-    // write block header, payload
-    EResult res = binarize::write(*this, file, EBlockType::PrintMetadata, compression_type, cs);
+EResult FileMetadataBlock::read_data(FILE& file, const FileHeader& file_header, const BlockHeader& block_header)
+{
+    // read block payload
+    EResult res = BaseMetadataBlock::read_data(file, block_header);
     if (res != EResult::Success)
         // propagate error
         return res;
 
-    // write block checksum
-    if (checksum_type != EChecksumType::None)
-        return cs.write(file);
-
+    const EChecksumType checksum_type = (EChecksumType)file_header.checksum_type;
+    if (checksum_type != EChecksumType::None) {
+        // read block checksum
+        Checksum cs(checksum_type);
+        res = cs.read(file);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+    }
     return EResult::Success;
 }
 
+EResult PrintMetadataBlock::write(FILE& file, ECompressionType compression_type, EChecksumType checksum_type) const
+{
+    FileOutputSink sink(file);
+    return write(sink, compression_type, checksum_type);
+}
+
+EResult PrintMetadataBlock::write(OutputSink& sink, ECompressionType compression_type, EChecksumType checksum_type) const
+{
+    return binarize::write(*this, sink, EBlockType::PrintMetadata, compression_type, checksum_type);
+}
+
 EResult PrintMetadataBlock::read_data(FILE& file, const FileHeader& file_header, const BlockHeader& block_header)
 {
     // read block payload
@@ -544,19 +1068,13 @@ EResult PrintMetadataBlock::read_data(FILE& file, const FileHeader& file_header,
 
 EResult PrinterMetadataBlock::write(FILE& file, ECompressionType compression_type, EChecksumType checksum_type) const
 {
-    Checksum cs(checksum_type);
-
-    // write block header, payload
-    EResult res = binarize::write(*this, file, EBlockType::PrinterMetadata, compression_type, cs);
-    if (res != EResult::Success)
-        // propagate error
-        return res;
-
-    // write block checksum
-    if (checksum_type != EChecksumType::None)
-        return cs.write(file);
+    FileOutputSink sink(file);
+    return write(sink, compression_type, checksum_type);
+}
 
-    return EResult::Success;
+EResult PrinterMetadataBlock::write(OutputSink& sink, ECompressionType compression_type, EChecksumType checksum_type) const
+{
+    return binarize::write(*this, sink, EBlockType::PrinterMetadata, compression_type, checksum_type);
 }
 
 EResult PrinterMetadataBlock::read_data(FILE& file, const FileHeader& file_header, const BlockHeader& block_header)
@@ -580,6 +1098,12 @@ EResult PrinterMetadataBlock::read_data(FILE& file, const FileHeader& file_heade
 }
 
 EResult ThumbnailBlock::write(FILE& file, EChecksumType checksum_type)
+{
+    FileOutputSink sink(file);
+    return write(sink, checksum_type);
+}
+
+EResult ThumbnailBlock::write(OutputSink& sink, EChecksumType checksum_type)
 {
     if (params.format >= thumbnail_formats_count())
         return EResult::InvalidThumbnailFormat;
@@ -590,35 +1114,19 @@ EResult ThumbnailBlock::write(FILE& file, EChecksumType checksum_type)
     if (data.size() == 0)
         return EResult::InvalidThumbnailDataSize;
 
-    // write block header
     BlockHeader block_header((uint16_t)EBlockType::Thumbnail, (uint16_t)ECompressionType::None, (uint32_t)data.size());
-    EResult res = block_header.write(file);
-    if (res != EResult::Success)
-        // propagate error
-        return res;
-
-    res = params.write(file);
-    if (res != EResult::Success){
-        // propagate error
-        return res;
-    }
 
-    if (!write_to_file(file, data.data(), data.size()))
-        return EResult::WriteError;
-
-    if (checksum_type != EChecksumType::None) {
-        Checksum cs(checksum_type);
-        // update checksum with block header
-        update_checksum(cs, block_header);
-        // update checksum with block payload
-        update_checksum(cs, *this);
-        // write block checksum
-        res = cs.write(file);
-        if (res != EResult::Success)
-            // propagate error
-            return res;
-    }
-    return EResult::Success;
+    // assemble block header, params and payload
+    std::vector<uint8_t>& block = block_buffer();
+    BufferReleaser block_releaser(block);
+    block.resize(block_header.get_size());
+    store_integer_le(params.format, std::back_inserter(block));
+    store_integer_le(params.width, std::back_inserter(block));
+    store_integer_le(params.height, std::back_inserter(block));
+    const uint8_t* payload = reinterpret_cast<const uint8_t*>(data.data());
+    block.insert(block.end(), payload, payload + data.size());
+
+    return write_block(sink, block_header, block, checksum_type);
 }
 
 EResult ThumbnailBlock::read_data(FILE& file, const FileHeader& file_header, const BlockHeader& block_header)
@@ -653,93 +1161,178 @@ EResult ThumbnailBlock::read_data(FILE& file, const FileHeader& file_header, con
     return EResult::Success;
 }
 
-EResult GCodeBlock::write(FILE& file, ECompressionType compression_type, EChecksumType checksum_type) const
+EResult ThumbnailHandle::read(FILE& file, const FileHeader& file_header, const BlockHeader& block_header)
 {
-    if (encoding_type > gcode_encoding_types_count())
-        return EResult::InvalidGCodeEncodingType;
-
-    BlockHeader block_header((uint16_t)EBlockType::GCode, (uint16_t)compression_type, (uint32_t)0);
-    std::vector<uint8_t> out_data;
-    if (!raw_data.empty()) {
-        // process payload encoding
-        std::vector<uint8_t> uncompressed_data;
-        if (!encode_gcode(raw_data, uncompressed_data, (EGCodeEncodingType)encoding_type))
-            return EResult::GCodeEncodingError;
-        // process payload compression
-        block_header.uncompressed_size = (uint32_t)uncompressed_data.size();
-        std::vector<uint8_t> compressed_data;
-        if (compression_type != ECompressionType::None) {
-            if (!compress(uncompressed_data, compressed_data, compression_type))
-                return EResult::DataCompressionError;
-            block_header.compressed_size = (uint32_t)compressed_data.size();
-        }
-        out_data.swap((compression_type == ECompressionType::None) ? uncompressed_data : compressed_data);
-    }
-
-    // write block header
-    EResult res = block_header.write(file);
+    EResult res = params.read(file);
     if (res != EResult::Success)
         // propagate error
         return res;
+    if (params.format >= thumbnail_formats_count())
+        return EResult::InvalidThumbnailFormat;
+    if (params.width == 0)
+        return EResult::InvalidThumbnailWidth;
+    if (params.height == 0)
+        return EResult::InvalidThumbnailHeight;
+    if (block_header.uncompressed_size == 0)
+        return EResult::InvalidThumbnailDataSize;
 
-    // write block payload
-    if (!write_to_file(file, &encoding_type, sizeof(encoding_type)))
-        return EResult::WriteError;
-    if (!out_data.empty()) {
-        if (!write_to_file(file, out_data.data(), out_data.size()))
-            return EResult::WriteError;
-    }
+    data_offset = ftell(&file);
+    data_size = block_header.uncompressed_size;
 
-    // write checksum
-    if (checksum_type != EChecksumType::None) {
-        Checksum cs(checksum_type);
-        // update checksum with block header
-        update_checksum(cs, block_header);
-        // update checksum with block payload
-        std::vector<uint8_t> data_to_encode =
-            encode(reinterpret_cast<const std::byte*>(&encoding_type), sizeof(encoding_type));
-        cs.append(data_to_encode.data(), data_to_encode.size());
-        if (!out_data.empty())
-            cs.append(static_cast<unsigned char *>(out_data.data()), out_data.size());
-        res = cs.write(file);
-        if (res != EResult::Success)
-            // propagate error
-            return res;
+    // move to next block header
+    return skip_block(file, file_header, block_header);
+}
+
+EResult ThumbnailHandle::load_data(FILE& file, std::vector<std::byte>& data) const
+{
+    if (fseek(&file, data_offset, SEEK_SET) != 0)
+        return EResult::ReadError;
+    data.resize(data_size);
+    if (!read_from_file(file, data.data(), data_size))
+        return EResult::ReadError;
+    return EResult::Success;
+}
+
+EResult ThumbnailHandle::copy_data(FILE& file, OutputSink& sink) const
+{
+    if (fseek(&file, data_offset, SEEK_SET) != 0)
+        return EResult::ReadError;
+
+    std::array<std::byte, 4096> buffer;
+    size_t to_copy = data_size;
+    while (to_copy > 0) {
+        const size_t size = std::min(to_copy, buffer.size());
+        if (!read_from_file(file, buffer.data(), size))
+            return EResult::ReadError;
+        if (!write_to_sink(sink, buffer.data(), size))
+            return EResult::WriteError;
+        to_copy -= size;
     }
     return EResult::Success;
 }
 
+const std::byte* ThumbnailHandle::get_data(const MappedFile& mapped_file) const
+{
+    if (!mapped_file.is_mapped() || data_offset < 0 || (size_t)data_offset > mapped_file.size() ||
+        data_size > mapped_file.size() - (size_t)data_offset)
+        return nullptr;
+    return mapped_file.data() + data_offset;
+}
+
+EResult GCodeBlock::write(FILE& file, ECompressionType compression_type, EChecksumType checksum_type) const
+{
+    FileOutputSink sink(file);
+    return write(sink, compression_type, checksum_type);
+}
+
+EResult GCodeBlock::write(OutputSink& sink, ECompressionType compression_type, EChecksumType checksum_type) const
+{
+    if (encoding_type > gcode_encoding_types_count())
+        return EResult::InvalidGCodeEncodingType;
+
+    return write_encoded_block(sink, EBlockType::GCode, compression_type, checksum_type, encoding_type, !raw_data.empty(),
+        EResult::GCodeEncodingError, [this](std::vector<uint8_t>& dst) {
+            return encode_gcode(raw_data, dst, (EGCodeEncodingType)encoding_type);
+        });
+}
+
+// Sink appending to a string
+class StringOutputSink : public OutputSink
+{
+public:
+    explicit StringOutputSink(std::string& str) : m_str(str) {}
+
+    bool write(const void* data, size_t data_size) override {
+        m_str.append(static_cast<const char*>(data), data_size);
+        return true;
+    }
+    long tell() const override { return static_cast<long>(m_str.size()); }
+
+private:
+    std::string& m_str;
+};
+
 EResult GCodeBlock::read_data(FILE& file, const FileHeader& file_header, const BlockHeader& block_header)
 {
-    const ECompressionType compression_type = (ECompressionType)block_header.compression;
+    raw_data.reserve(raw_data.size() + block_header.uncompressed_size);
+    StringOutputSink sink(raw_data);
+    return read_data(file, file_header, block_header, sink);
+}
 
-    if (!read_from_file(file, (void*)&encoding_type, sizeof(encoding_type)))
+// Reads the parameters and the data of a gcode block through the given function bool(uint8_t* data, size_t size),
+// writing the decoded gcode to the given sink
+template<class Reader>
+static EResult read_gcode_payload(const BlockHeader& block_header, Reader&& reader, uint16_t& encoding_type, OutputSink& sink)
+{
+    if (!reader(reinterpret_cast<uint8_t*>(&encoding_type), sizeof(encoding_type)))
         return EResult::ReadError;
     if (encoding_type > gcode_encoding_types_count())
         return EResult::InvalidGCodeEncodingType;
 
-    std::vector<uint8_t> data;
-    const size_t data_size = (compression_type == ECompressionType::None) ? block_header.uncompressed_size : block_header.compressed_size;
-    if (data_size > 0) {
-        data.resize(data_size);
-        if (!read_from_file(file, (void*)data.data(), data_size))
-            return EResult::ReadError;
+    bool write_error = false;
+    EResult res = EResult::Success;
+    switch ((EGCodeEncodingType)encoding_type)
+    {
+    case EGCodeEncodingType::None:
+    {
+        res = read_payload_chunks(block_header, reader, [&](const uint8_t* data, size_t size) {
+            write_error = !sink.write(data, size);
+            return !write_error;
+        });
+        break;
     }
-
-    std::vector<uint8_t> uncompressed_data;
-    if (compression_type != ECompressionType::None) {
-        if (!uncompress(data, uncompressed_data, compression_type, block_header.uncompressed_size))
-            return EResult::DataUncompressionError;
+    case EGCodeEncodingType::MeatPack:
+    case EGCodeEncodingType::MeatPackComments:
+    {
+        // the decompressed chunks go straight into the decoder
+        MeatPack::MPUnbinarizer unbinarizer;
+        res = read_payload_chunks(block_header, reader, [&](const uint8_t* data, size_t size) {
+            write_error = !unbinarizer.unbinarize(data, size, sink);
+            return !write_error;
+        });
+        break;
+    }
+    case EGCodeEncodingType::TokenPack:
+    {
+        // the decompressed chunks go straight into the decoder
+        TokenPack::Decoder decoder;
+        std::string decoded;
+        bool decoding_error = false;
+        res = read_payload_chunks(block_header, reader, [&](const uint8_t* data, size_t size) {
+            decoded.clear();
+            decoding_error = !decoder.decode(data, size, decoded);
+            if (decoding_error)
+                return false;
+            write_error = !sink.write(decoded.data(), decoded.size());
+            return !write_error;
+        });
+        if (decoding_error || (res == EResult::Success && !write_error && !decoder.finish()))
+            return EResult::GCodeDecodingError;
+        break;
+    }
+    default:
+    {
+        return EResult::InvalidGCodeEncodingType;
     }
+    }
+    if (write_error)
+        return EResult::WriteError;
+    return res;
+}
 
-    if (!decode_gcode((compression_type == ECompressionType::None) ? data : uncompressed_data, raw_data, (EGCodeEncodingType)encoding_type))
-        return EResult::GCodeDecodingError;
+EResult GCodeBlock::read_data(FILE& file, const FileHeader& file_header, const BlockHeader& block_header, OutputSink& sink)
+{
+    EResult res = read_gcode_payload(block_header, [&file](uint8_t* data, size_t size) { return read_from_file(file, data, size); },
+        encoding_type, sink);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
 
     const EChecksumType checksum_type = (EChecksumType)file_header.checksum_type;
     if (checksum_type != EChecksumType::None) {
         // read block checksum
         Checksum cs(checksum_type);
-        const EResult res = cs.read(file);
+        res = cs.read(file);
         if (res != EResult::Success)
             // propagate error
             return res;
@@ -747,21 +1340,27 @@ EResult GCodeBlock::read_data(FILE& file, const FileHeader& file_header, const B
     return EResult::Success;
 }
 
-EResult SlicerMetadataBlock::write(FILE& file, ECompressionType compression_type, EChecksumType checksum_type) const
+EResult GCodeBlock::read_data(const std::byte* payload, size_t payload_size, const BlockHeader& block_header, OutputSink& sink)
 {
-    Checksum cs(checksum_type);
-
-    // write block header, payload
-    EResult res = binarize::write(*this, file, EBlockType::SlicerMetadata, compression_type, cs);
-    if (res != EResult::Success)
-        // propagate error
-        return res;
+    return read_gcode_payload(block_header, [&payload, &payload_size](uint8_t* data, size_t size) {
+        if (size > payload_size)
+            return false;
+        std::memcpy(data, payload, size);
+        payload += size;
+        payload_size -= size;
+        return true;
+    }, encoding_type, sink);
+}
 
-    // write block checksum
-    if (checksum_type != EChecksumType::None)
-        return cs.write(file);
+EResult SlicerMetadataBlock::write(FILE& file, ECompressionType compression_type, EChecksumType checksum_type) const
+{
+    FileOutputSink sink(file);
+    return write(sink, compression_type, checksum_type);
+}
 
-    return EResult::Success;
+EResult SlicerMetadataBlock::write(OutputSink& sink, ECompressionType compression_type, EChecksumType checksum_type) const
+{
+    return binarize::write(*this, sink, EBlockType::SlicerMetadata, compression_type, checksum_type);
 }
 
 EResult SlicerMetadataBlock::read_data(FILE& file, const FileHeader& file_header, const BlockHeader& block_header)
@@ -784,82 +1383,368 @@ EResult SlicerMetadataBlock::read_data(FILE& file, const FileHeader& file_header
     return EResult::Success;
 }
 
+class GCodeSpool : public OutputSink
+{
+public:
+    GCodeSpool() : m_file(std::tmpfile()) {}
+    ~GCodeSpool() override {
+        if (m_file != nullptr)
+            fclose(m_file);
+    }
+
+    GCodeSpool(const GCodeSpool&) = delete;
+    GCodeSpool& operator=(const GCodeSpool&) = delete;
+
+    bool write(const void* data, size_t data_size) override {
+        m_size += static_cast<long>(data_size);
+        if (m_file == nullptr)
+            return m_memory.write(data, data_size);
+        return fwrite(data, 1, data_size, m_file) == data_size;
+    }
+    long tell() const override { return m_size; }
+
+    // Writes the spooled data into the given sink
+    bool copy_to(OutputSink& sink) {
+        if (m_file == nullptr)
+            return m_memory.get_data().empty() || sink.write(m_memory.get_data().data(), m_memory.get_data().size());
+        if (fflush(m_file) != 0)
+            return false;
+        rewind(m_file);
+        std::vector<std::byte> buffer(65536);
+        for (long remaining = m_size; remaining > 0; ) {
+            const size_t size = std::min<size_t>(buffer.size(), static_cast<size_t>(remaining));
+            if (fread(buffer.data(), 1, size, m_file) != size || !sink.write(buffer.data(), size))
+                return false;
+            remaining -= static_cast<long>(size);
+        }
+        return true;
+    }
+
+private:
+    FILE* m_file;
+    // used if the temporary file cannot be created
+    MemoryOutputSink m_memory;
+    long m_size{ 0 };
+};
+
+Binarizer::Binarizer() = default;
+Binarizer::~Binarizer() = default;
+
 bool Binarizer::is_enabled() const { return m_enabled; }
 void Binarizer::set_enabled(bool enable) { m_enabled = enable; }
 BinaryData& Binarizer::get_binary_data() { return m_binary_data; }
 const BinaryData& Binarizer::get_binary_data() const { return m_binary_data; }
 size_t Binarizer::get_max_gcode_cache_size() const { return m_gcode_cache_size; }
 void Binarizer::set_max_gcode_cache_size(size_t size) { m_gcode_cache_size = size; }
+size_t Binarizer::get_threads_count() const { return m_threads_count; }
+void Binarizer::set_threads_count(size_t threads_count) { m_threads_count = resolve_threads_count(threads_count); }
 
 EResult Binarizer::initialize(FILE& file, const BinarizerConfig& config)
 {
     if (!m_enabled)
         return EResult::Success;
 
-    m_file = &file;
-    m_config = config;
+    m_file_sink = std::make_unique<FileOutputSink>(file);
+    return initialize(*m_file_sink, config);
+}
+
+EResult Binarizer::initialize(OutputSink& sink, const BinarizerConfig& config)
+{
+    if (!m_enabled)
+        return EResult::Success;
 
     // save header
-    FileHeader file_header;
-    file_header.checksum_type = (uint16_t)m_config.checksum;
-    EResult res = file_header.write(*m_file);
+    EResult res = begin(sink, config);
     if (res != EResult::Success)
         // propagate error
         return res;
 
     // save file metadata block, if present
     if (!m_binary_data.file_metadata.raw_data.empty()) {
-        m_binary_data.file_metadata.encoding_type = (uint16_t)config.metadata_encoding;
-        res = m_binary_data.file_metadata.write(*m_file, m_config.compression.file_metadata, m_config.checksum);
+        res = write_file_metadata(m_binary_data.file_metadata);
         if (res != EResult::Success)
             // propagate error
             return res;
     }
 
     // save printer metadata block
-    if (m_binary_data.printer_metadata.raw_data.empty())
-        return EResult::MissingPrinterMetadata;
-    m_binary_data.printer_metadata.encoding_type = (uint16_t)config.metadata_encoding;
-    res = m_binary_data.printer_metadata.write(*m_file, m_config.compression.printer_metadata, m_config.checksum);
+    res = write_printer_metadata(m_binary_data.printer_metadata);
     if (res != EResult::Success)
         // propagate error
         return res;
 
     // save thumbnail blocks
     for (ThumbnailBlock& block : m_binary_data.thumbnails) {
-        res = block.write(*m_file, m_config.checksum);
+        res = write_thumbnail(block);
         if (res != EResult::Success)
             // propagate error
             return res;
     }
 
     // save print metadata block
-    if (m_binary_data.print_metadata.raw_data.empty())
-        return EResult::MissingPrintMetadata;
-    m_binary_data.print_metadata.encoding_type = (uint16_t)config.metadata_encoding;
-    res = m_binary_data.print_metadata.write(*m_file, m_config.compression.print_metadata, m_config.checksum);
+    res = write_print_metadata(m_binary_data.print_metadata);
     if (res != EResult::Success)
         // propagate error
         return res;
 
     // save slicer metadata block
-    if (m_binary_data.slicer_metadata.raw_data.empty())
+    return write_slicer_metadata(m_binary_data.slicer_metadata);
+}
+
+EResult Binarizer::begin(FILE& file, const BinarizerConfig& config)
+{
+    if (!m_enabled)
+        return EResult::Success;
+
+    m_file_sink = std::make_unique<FileOutputSink>(file);
+    return begin(*m_file_sink, config);
+}
+
+EResult Binarizer::begin(OutputSink& sink, const BinarizerConfig& config)
+{
+    if (!m_enabled)
+        return EResult::Success;
+
+    // the gcode appended before is kept by the spool, already encoded with the spool config
+    if (m_gcode_spool != nullptr) {
+        if (config.checksum != m_config.checksum)
+            return EResult::InvalidChecksumType;
+        if (config.compression.gcode != m_config.compression.gcode)
+            return EResult::InvalidCompressionType;
+        if (config.gcode_encoding != m_config.gcode_encoding)
+            return EResult::InvalidGCodeEncodingType;
+    }
+    else {
+        m_gcode_cache.clear();
+        m_gcode_encoder.reset();
+    }
+    m_sink = &sink;
+    m_config = config;
+    m_stage = EStage::None;
+
+    FileHeader file_header;
+    file_header.checksum_type = (uint16_t)m_config.checksum;
+    const EResult res = file_header.write(*m_sink);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    m_stage = EStage::FileHeader;
+    return EResult::Success;
+}
+
+EResult Binarizer::write_file_metadata(FileMetadataBlock& block)
+{
+    if (!m_enabled)
+        return EResult::Success;
+    if (m_stage != EStage::FileHeader)
+        return EResult::InvalidSequenceOfBlocks;
+
+    block.encoding_type = (uint16_t)m_config.metadata_encoding;
+    const EResult res = block.write(*m_sink, m_config.compression.file_metadata, m_config.checksum);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    m_stage = EStage::FileMetadata;
+    return EResult::Success;
+}
+
+EResult Binarizer::write_printer_metadata(PrinterMetadataBlock& block)
+{
+    if (!m_enabled)
+        return EResult::Success;
+    if (m_stage != EStage::FileHeader && m_stage != EStage::FileMetadata)
+        return EResult::InvalidSequenceOfBlocks;
+    if (block.raw_data.empty())
+        return EResult::MissingPrinterMetadata;
+
+    block.encoding_type = (uint16_t)m_config.metadata_encoding;
+    const EResult res = block.write(*m_sink, m_config.compression.printer_metadata, m_config.checksum);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    m_stage = EStage::PrinterMetadata;
+    return EResult::Success;
+}
+
+EResult Binarizer::write_thumbnail(ThumbnailBlock& block)
+{
+    if (!m_enabled)
+        return EResult::Success;
+    if (m_stage != EStage::PrinterMetadata && m_stage != EStage::Thumbnails)
+        return EResult::InvalidSequenceOfBlocks;
+
+    EResult res = write_spooled_thumbnails();
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    res = block.write(*m_sink, m_config.checksum);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    m_stage = EStage::Thumbnails;
+    return EResult::Success;
+}
+
+EResult Binarizer::write_spooled_thumbnails()
+{
+    if (m_thumbnails_spool == nullptr)
+        return EResult::Success;
+
+    const bool copied = m_thumbnails_spool->copy_to(*m_sink);
+    m_thumbnails_spool.reset();
+    if (!copied)
+        return EResult::WriteError;
+
+    m_stage = EStage::Thumbnails;
+    return EResult::Success;
+}
+
+EResult Binarizer::write_print_metadata(PrintMetadataBlock& block)
+{
+    if (!m_enabled)
+        return EResult::Success;
+    if (m_stage != EStage::PrinterMetadata && m_stage != EStage::Thumbnails)
+        return EResult::InvalidSequenceOfBlocks;
+    if (block.raw_data.empty())
+        return EResult::MissingPrintMetadata;
+
+    EResult res = write_spooled_thumbnails();
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    block.encoding_type = (uint16_t)m_config.metadata_encoding;
+    res = block.write(*m_sink, m_config.compression.print_metadata, m_config.checksum);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    m_stage = EStage::PrintMetadata;
+    return EResult::Success;
+}
+
+EResult Binarizer::write_slicer_metadata(SlicerMetadataBlock& block)
+{
+    if (!m_enabled)
+        return EResult::Success;
+    if (m_stage != EStage::PrintMetadata)
+        return EResult::InvalidSequenceOfBlocks;
+    if (block.raw_data.empty())
         return EResult::MissingSlicerMetadata;
-    m_binary_data.slicer_metadata.encoding_type = (uint16_t)config.metadata_encoding;
-    res = m_binary_data.slicer_metadata.write(*m_file, m_config.compression.slicer_metadata, m_config.checksum);
+
+    block.encoding_type = (uint16_t)m_config.metadata_encoding;
+    const EResult res = block.write(*m_sink, m_config.compression.slicer_metadata, m_config.checksum);
     if (res != EResult::Success)
         // propagate error
         return res;
 
+    m_stage = EStage::SlicerMetadata;
     return EResult::Success;
 }
 
-static EResult write_gcode_block(FILE& file, const std::string& raw_data, const BinarizerConfig& config)
+static EResult write_gcode_block(OutputSink& sink, std::string& raw_data, const BinarizerConfig& config)
 {
     GCodeBlock block;
     block.encoding_type = (uint16_t)config.gcode_encoding;
-    block.raw_data = raw_data;
-    return block.write(file, config.compression.gcode, config.checksum);
+    // borrow the data, to avoid copying it
+    block.raw_data.swap(raw_data);
+    const EResult res = block.write(sink, config.compression.gcode, config.checksum);
+    block.raw_data.swap(raw_data);
+    return res;
+}
+
+// Encodes and compresses the gcode blocks on a pool of threads, and writes them in the order they are pushed.
+// At most 2 blocks per thread are pushed and not yet written, to bound the memory used.
+class GCodeBlocksEncoder
+{
+public:
+    GCodeBlocksEncoder(size_t threads_count, const BinarizerConfig& config)
+        : m_config(config), m_window_size(2 * threads_count), m_pool(threads_count) {}
+
+    // Takes the gcode of a block, writing into the sink the oldest blocks if the window is full
+    EResult push(std::string&& gcode, OutputSink& sink) {
+        auto task = std::make_shared<std::packaged_task<EncodedBlock()>>([gcode = std::move(gcode), config = m_config]() mutable {
+            MemoryOutputSink encoded;
+            const EResult res = write_gcode_block(encoded, gcode, config);
+            return EncodedBlock(res, encoded.release());
+        });
+        m_window.push_back(task->get_future());
+        m_pool.push([task]() { (*task)(); });
+        return (m_window.size() < m_window_size) ? EResult::Success : write_oldest(sink);
+    }
+
+    // Writes all the blocks pushed into the sink
+    EResult flush(OutputSink& sink) {
+        while (!m_window.empty()) {
+            const EResult res = write_oldest(sink);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+        }
+        return EResult::Success;
+    }
+
+private:
+    using EncodedBlock = std::pair<EResult, std::vector<std::byte>>;
+
+    BinarizerConfig m_config;
+    size_t m_window_size;
+    std::deque<std::future<EncodedBlock>> m_window;
+    ThreadPool m_pool;
+
+    EResult write_oldest(OutputSink& sink) {
+        EncodedBlock encoded = m_window.front().get();
+        m_window.pop_front();
+        if (encoded.first != EResult::Success)
+            // propagate error
+            return encoded.first;
+        return sink.write(encoded.second.data(), encoded.second.size()) ? EResult::Success : EResult::WriteError;
+    }
+};
+
+EResult Binarizer::write_gcode_cache(OutputSink& sink)
+{
+    if (m_threads_count <= 1)
+        return write_gcode_block(sink, m_gcode_cache, m_config);
+
+    if (m_gcode_encoder == nullptr)
+        m_gcode_encoder = std::make_unique<GCodeBlocksEncoder>(m_threads_count, m_config);
+    // the cache is handed over to the encoder, and replaced
+    std::string gcode;
+    gcode.reserve(m_gcode_cache_size);
+    gcode.swap(m_gcode_cache);
+    return m_gcode_encoder->push(std::move(gcode), sink);
+}
+
+EResult Binarizer::begin_gcode_spool(const BinarizerConfig& config)
+{
+    if (!m_enabled)
+        return EResult::Success;
+    if (m_stage != EStage::None)
+        return EResult::InvalidSequenceOfBlocks;
+
+    m_config = config;
+    m_gcode_cache.clear();
+    m_gcode_encoder.reset();
+    m_gcode_spool = std::make_unique<GCodeSpool>();
+    m_thumbnails_spool.reset();
+    return EResult::Success;
+}
+
+EResult Binarizer::spool_thumbnail(ThumbnailBlock& block)
+{
+    if (!m_enabled)
+        return EResult::Success;
+    // the spooled thumbnails are written with the begin() call, which must follow
+    if (m_gcode_spool == nullptr || m_stage != EStage::None)
+        return EResult::InvalidSequenceOfBlocks;
+
+    if (m_thumbnails_spool == nullptr)
+        m_thumbnails_spool = std::make_unique<GCodeSpool>();
+    return block.write(*m_thumbnails_spool, m_config.checksum);
 }
 
 EResult Binarizer::append_gcode(const std::string& gcode)
@@ -867,9 +1752,14 @@ EResult Binarizer::append_gcode(const std::string& gcode)
     if (gcode.empty())
         return EResult::Success;
 
-    assert(m_file != nullptr);
-    if (m_file == nullptr)
-        return EResult::WriteError;
+    if (m_gcode_spool == nullptr) {
+        assert(m_sink != nullptr);
+        if (m_sink == nullptr)
+            return EResult::WriteError;
+        if (m_stage != EStage::SlicerMetadata)
+            return EResult::InvalidSequenceOfBlocks;
+    }
+    OutputSink& sink = (m_gcode_spool != nullptr) ? static_cast<OutputSink&>(*m_gcode_spool) : *m_sink;
 
     auto it_begin = gcode.begin();
     do {
@@ -881,7 +1771,7 @@ EResult Binarizer::append_gcode(const std::string& gcode)
         const size_t line_size = 1 + end_line_pos - begin_pos;
         if (line_size + m_gcode_cache.length() > m_gcode_cache_size) {
             if (!m_gcode_cache.empty()) {
-                const EResult res = write_gcode_block(*m_file, m_gcode_cache, m_config);
+                const EResult res = write_gcode_cache(sink);
                 if (res != EResult::Success)
                     // propagate error
                     return res;
@@ -903,16 +1793,214 @@ EResult Binarizer::finalize()
 {
     if (!m_enabled)
         return EResult::Success;
+    if (m_stage != EStage::SlicerMetadata)
+        return EResult::InvalidSequenceOfBlocks;
 
     // save gcode cache, if not empty
+    OutputSink& gcode_sink = (m_gcode_spool != nullptr) ? static_cast<OutputSink&>(*m_gcode_spool) : *m_sink;
     if (!m_gcode_cache.empty()) {
-        const EResult res = write_gcode_block(*m_file, m_gcode_cache, m_config);
+        const EResult res = write_gcode_cache(gcode_sink);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+        m_gcode_cache.clear();
+    }
+    if (m_gcode_encoder != nullptr) {
+        const EResult res = m_gcode_encoder->flush(gcode_sink);
+        m_gcode_encoder.reset();
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+    }
+    m_stage = EStage::None;
+
+    // copy the spooled gcode blocks after the metadata blocks
+    m_thumbnails_spool.reset();
+    if (m_gcode_spool != nullptr) {
+        const bool copied = m_gcode_spool->copy_to(*m_sink);
+        m_gcode_spool.reset();
+        if (!copied)
+            return EResult::WriteError;
+    }
+
+    if (m_sink != nullptr && !m_sink->flush())
+        return EResult::WriteError;
+
+    return EResult::Success;
+}
+
+EResult find_metadata(FILE& file, EBlockType block_type, const std::vector<std::string_view>& keys,
+    std::vector<std::optional<std::string>>& values)
+{
+    values.assign(keys.size(), std::nullopt);
+    if (block_type != EBlockType::FileMetadata && block_type != EBlockType::PrinterMetadata &&
+        block_type != EBlockType::PrintMetadata && block_type != EBlockType::SlicerMetadata)
+        return EResult::InvalidBlockType;
+
+    rewind(&file);
+    FileHeader file_header;
+    EResult res = read_header(file, file_header, nullptr);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    BlockHeader block_header;
+    res = read_next_block_header(file, file_header, block_header, block_type, nullptr, 0);
+    if (res == EResult::ReadError && feof(&file))
+        // the search reached the end of the file
+        return EResult::BlockNotFound;
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    uint16_t encoding_type;
+    if (!read_from_file(file, &encoding_type, sizeof(encoding_type)))
+        return EResult::ReadError;
+
+    size_t missing_count = keys.size();
+    // stores the value if the key is one of the requested ones, returns false when all keys have been found
+    auto process_item = [&](std::string_view key, std::string_view value) {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (!values[i].has_value() && keys[i] == key) {
+                values[i] = std::string(value);
+                --missing_count;
+            }
+        }
+        return missing_count > 0;
+    };
+
+    if (missing_count == 0)
+        return EResult::Success;
+
+    switch ((EMetadataEncodingType)encoding_type)
+    {
+    case EMetadataEncodingType::INI:
+    {
+        IniScanner scanner;
+        bool proceed = true;
+        res = read_payload_chunks(file, block_header, [&](const uint8_t* data, size_t size) {
+            proceed = scanner.append(data, size, process_item);
+            return proceed;
+        });
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+        if (proceed)
+            scanner.finalize(process_item);
+        break;
+    }
+    case EMetadataEncodingType::Binary:
+    {
+        // items are not line based, decode the whole block
+        std::vector<uint8_t> data;
+        data.reserve(payload_reserve_size(file, block_header));
+        res = read_payload_chunks(file, block_header, [&data](const uint8_t* chunk, size_t size) {
+            data.insert(data.end(), chunk, chunk + size);
+            return true;
+        });
         if (res != EResult::Success)
             // propagate error
             return res;
+        MetadataStorage storage;
+        if (!storage.decode(std::move(data), EMetadataEncodingType::Binary))
+            return EResult::MetadataDecodingError;
+        for (const auto& [item_key, item_value] : storage) {
+            if (!process_item(item_key, item_value))
+                break;
+        }
+        break;
+    }
+    default:
+    {
+        return EResult::InvalidMetadataEncodingType;
+    }
     }
 
     return EResult::Success;
 }
 
+EResult find_metadata(FILE& file, EBlockType block_type, std::string_view key, std::optional<std::string>& value)
+{
+    std::vector<std::optional<std::string>> values;
+    const EResult res = find_metadata(file, block_type, std::vector<std::string_view>{ key }, values);
+    value = std::move(values.front());
+    return res;
+}
+
+EResult select_thumbnail(FILE& file, uint16_t target_width, uint16_t target_height,
+    const std::vector<EThumbnailFormat>& preferred_formats, ThumbnailHandle& thumbnail)
+{
+    rewind(&file);
+    FileHeader file_header;
+    EResult res = read_header(file, file_header, nullptr);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    // lower is better: format rank, size class, size distance
+    using Score = std::tuple<size_t, int, uint64_t>;
+    auto score = [&](const ThumbnailParams& params) {
+        const auto it = std::find(preferred_formats.begin(), preferred_formats.end(), (EThumbnailFormat)params.format);
+        const size_t format_rank = (size_t)std::distance(preferred_formats.begin(), it);
+        const uint64_t area = (uint64_t)params.width * (uint64_t)params.height;
+        const uint64_t target_area = (uint64_t)target_width * (uint64_t)target_height;
+        if (params.width == target_width && params.height == target_height)
+            return Score{ format_rank, 0, 0 };
+        else if (params.width >= target_width && params.height >= target_height)
+            return Score{ format_rank, 1, area - target_area };
+        else
+            return Score{ format_rank, 2, std::numeric_limits<uint64_t>::max() - area };
+    };
+
+    bool found = false;
+    Score best_score;
+    BlockHeader block_header;
+    while (true) {
+        res = read_next_block_header(file, file_header, block_header, nullptr, 0);
+        if (res == EResult::ReadError && feof(&file))
+            // the search reached the end of the file
+            break;
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+
+        const EBlockType block_type = (EBlockType)block_header.type;
+        if (block_type == EBlockType::Thumbnail) {
+            ThumbnailHandle handle;
+            res = handle.read(file, file_header, block_header);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+            const Score handle_score = score(handle.params);
+            if (!found || handle_score < best_score) {
+                thumbnail = handle;
+                best_score = handle_score;
+                found = true;
+            }
+        }
+        else if (block_type == EBlockType::FileMetadata || block_type == EBlockType::PrinterMetadata) {
+            res = skip_block(file, file_header, block_header);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+        }
+        else
+            // thumbnails precede all the other blocks
+            break;
+    }
+
+    return found ? EResult::Success : EResult::BlockNotFound;
+}
+
+EResult select_thumbnail(FILE& file, uint16_t target_width, uint16_t target_height,
+    const std::vector<EThumbnailFormat>& preferred_formats, ThumbnailBlock& thumbnail)
+{
+    ThumbnailHandle handle;
+    const EResult res = select_thumbnail(file, target_width, target_height, preferred_formats, handle);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    thumbnail.params = handle.params;
+    return handle.load_data(file, thumbnail.data);
+}
+
 }} // namespace bgcode
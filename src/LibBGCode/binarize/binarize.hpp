@@ -4,8 +4,89 @@
 #include "binarize/export.h"
 #include "core/core.hpp"
 
+#include <memory>
+#include <iterator>
+#include <optional>
+
 namespace bgcode { namespace binarize {
 
+// Metadata in key/value form, stored without per item allocations.
+// All the keys and values live in a single buffer owned by the storage (typically the
+// decoded payload of a metadata block) and are accessed as string_views into it.
+// Views are invalidated by any non const method call.
+class BGCODE_BINARIZE_EXPORT MetadataStorage
+{
+public:
+    using value_type = std::pair<std::string_view, std::string_view>;
+
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = MetadataStorage::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = value_type;
+        struct pointer
+        {
+            value_type item;
+            const value_type* operator->() const { return &item; }
+        };
+
+        const_iterator() = default;
+        const_iterator(const MetadataStorage* storage, size_t id) : m_storage(storage), m_id(id) {}
+
+        reference operator*() const { return (*m_storage)[m_id]; }
+        pointer operator->() const { return { (*m_storage)[m_id] }; }
+        const_iterator& operator++() { ++m_id; return *this; }
+        const_iterator operator++(int) { const_iterator ret = *this; ++m_id; return ret; }
+        bool operator==(const const_iterator& other) const { return m_id == other.m_id && m_storage == other.m_storage; }
+        bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+    private:
+        const MetadataStorage* m_storage{ nullptr };
+        size_t m_id{ 0 };
+    };
+
+    bool empty() const { return m_items.empty(); }
+    size_t size() const { return m_items.size(); }
+    value_type operator[](size_t id) const;
+    const_iterator begin() const { return { this, 0 }; }
+    const_iterator end() const { return { this, m_items.size() }; }
+
+    void clear();
+    // Appends a copy of the given key/value pair
+    void emplace_back(std::string_view key, std::string_view value);
+
+    // Takes ownership of the given decoded block payload and indexes the key/value items
+    // it contains, in place. Previous content is discarded.
+    // Returns false if the data are not valid for the given encoding.
+    bool decode(std::vector<uint8_t>&& data, core::EMetadataEncodingType encoding_type);
+
+    // Compatible view, in the form used by BaseMetadataBlock::raw_data
+    std::vector<std::pair<std::string, std::string>> to_vector() const;
+
+    // Returns the value of the first item with the given key, if any.
+    // Uses the hashed index when built, otherwise searches linearly.
+    std::optional<std::string_view> find(std::string_view key) const;
+    // Builds a hashed index of the keys, to speed up repeated calls to find().
+    // The index is dropped by any non const method call.
+    void build_index();
+
+private:
+    struct Item
+    {
+        uint32_t key_offset;
+        uint32_t key_size;
+        uint32_t value_offset;
+        uint32_t value_size;
+    };
+
+    std::vector<uint8_t> m_buffer;
+    std::vector<Item> m_items;
+    // open addressing hash table of item ids + 1 (0 = empty slot), size is a power of 2
+    std::vector<uint32_t> m_index;
+};
+
 struct BGCODE_BINARIZE_EXPORT BaseMetadataBlock
 {
     // type of data encoding
@@ -15,28 +96,41 @@ struct BGCODE_BINARIZE_EXPORT BaseMetadataBlock
 
     // read block data in encoded format
     core::EResult read_data(FILE& file, const core::BlockHeader& block_header);
+    // read block data in encoded format into the given storage, raw_data is left untouched
+    core::EResult read_data(FILE& file, const core::BlockHeader& block_header, MetadataStorage& storage);
+    // read block data into the given storage, and block checksum
+    core::EResult read_data(FILE& file, const core::FileHeader& file_header, const core::BlockHeader& block_header, MetadataStorage& storage);
 };
 
 struct BGCODE_BINARIZE_EXPORT FileMetadataBlock : public BaseMetadataBlock
 {
+    using BaseMetadataBlock::read_data;
+
     // write block header and data
     core::EResult write(FILE& file, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
+    core::EResult write(core::OutputSink& sink, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
     // read block data
     core::EResult read_data(FILE& file, const core::FileHeader& file_header, const core::BlockHeader& block_header);
 };
 
 struct BGCODE_BINARIZE_EXPORT PrintMetadataBlock : public BaseMetadataBlock
 {
+    using BaseMetadataBlock::read_data;
+
     // write block header and data
     core::EResult write(FILE& file, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
+    core::EResult write(core::OutputSink& sink, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
     // read block data
     core::EResult read_data(FILE& file, const core::FileHeader& file_header, const core::BlockHeader& block_header);
 };
 
 struct BGCODE_BINARIZE_EXPORT PrinterMetadataBlock : public BaseMetadataBlock
 {
+    using BaseMetadataBlock::read_data;
+
     // write block header and data
     core::EResult write(FILE& file, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
+    core::EResult write(core::OutputSink& sink, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
     // read block data
     core::EResult read_data(FILE& file, const core::FileHeader& file_header, const core::BlockHeader& block_header);
 };
@@ -48,10 +142,33 @@ struct BGCODE_BINARIZE_EXPORT ThumbnailBlock
 
     // write block header and data
     core::EResult write(FILE& file, core::EChecksumType checksum_type);
+    core::EResult write(core::OutputSink& sink, core::EChecksumType checksum_type);
     // read block data
     core::EResult read_data(FILE& file, const core::FileHeader& file_header, const core::BlockHeader& block_header);
 };
 
+// Thumbnail block whose image data are not loaded, but referenced by their position in the file
+struct BGCODE_BINARIZE_EXPORT ThumbnailHandle
+{
+    core::ThumbnailParams params;
+    // position of the image data in the file
+    long data_offset{ 0 };
+    // size of the image data, in bytes
+    size_t data_size{ 0 };
+
+    // read block params and skip block data and checksum (not verified).
+    // File position must be at the start of the block parameters data, as set by read_next_block_header(),
+    // on success it is set at the start of the next block header.
+    core::EResult read(FILE& file, const core::FileHeader& file_header, const core::BlockHeader& block_header);
+    // load the image data from the file
+    core::EResult load_data(FILE& file, std::vector<std::byte>& data) const;
+    // copy the image data from the file to the given sink, in chunks
+    core::EResult copy_data(FILE& file, core::OutputSink& sink) const;
+    // returns the image data inside the given mapping of the file, without copying them,
+    // or nullptr if the mapping does not contain them
+    const std::byte* get_data(const core::MappedFile& mapped_file) const;
+};
+
 struct BGCODE_BINARIZE_EXPORT GCodeBlock
 {
     uint16_t encoding_type{ 0 };
@@ -59,14 +176,24 @@ struct BGCODE_BINARIZE_EXPORT GCodeBlock
 
     // write block header and data
     core::EResult write(FILE& file, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
+    core::EResult write(core::OutputSink& sink, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
     // read block data
     core::EResult read_data(FILE& file, const core::FileHeader& file_header, const core::BlockHeader& block_header);
+    // read block data, writing the decoded gcode to the given sink instead of raw_data.
+    // Decompression and decoding are done in small chunks, without buffering the whole block.
+    core::EResult read_data(FILE& file, const core::FileHeader& file_header, const core::BlockHeader& block_header, core::OutputSink& sink);
+    // as above, from the block payload (parameters + data, see core::block_payload_size()) already read into memory,
+    // so that blocks can be decoded away from the file, e.g. on other threads. The checksum is not part of the payload.
+    core::EResult read_data(const std::byte* payload, size_t payload_size, const core::BlockHeader& block_header, core::OutputSink& sink);
 };
 
 struct BGCODE_BINARIZE_EXPORT SlicerMetadataBlock : public BaseMetadataBlock
 {
+    using BaseMetadataBlock::read_data;
+
     // write block header and data
     core::EResult write(FILE& file, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
+    core::EResult write(core::OutputSink& sink, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
     // read block data
     core::EResult read_data(FILE& file, const core::FileHeader& file_header, const core::BlockHeader& block_header);
 };
@@ -96,9 +223,17 @@ struct BGCODE_BINARIZE_EXPORT BinaryData
     PrintMetadataBlock print_metadata;
 };
 
+// Temporary storage of the gcode and thumbnail blocks encoded before the metadata blocks
+class GCodeSpool;
+// Encoder of the gcode blocks on multiple threads
+class GCodeBlocksEncoder;
+
 class BGCODE_BINARIZE_EXPORT Binarizer
 {
 public:
+    Binarizer();
+    ~Binarizer();
+
     bool is_enabled() const;
     void set_enabled(bool enable);
 
@@ -108,19 +243,109 @@ public:
     size_t get_max_gcode_cache_size() const;
     void set_max_gcode_cache_size(size_t size);
 
+    // Count of the threads encoding and compressing the gcode blocks, 0 for the count of hardware threads.
+    // With 1 (default) the blocks are encoded by the calling thread. The blocks, cut by the calling thread,
+    // and so the output, do not depend on the count of threads.
+    size_t get_threads_count() const;
+    void set_threads_count(size_t threads_count);
+
+    // Writes the file header and all the blocks contained in the binary data.
+    // The sink must outlive the binarization (up to finalize()).
+    core::EResult initialize(core::OutputSink& sink, const BinarizerConfig& config);
     core::EResult initialize(FILE& file, const BinarizerConfig& config);
+
+    // Streaming alternative to initialize(): the blocks are written as soon as they are passed in, so that
+    // they do not need to be collected in the binary data and can be released right after the call.
+    // Besides the gcode cache, the memory used is then bounded by the size of the largest block.
+    // The calls must follow the order of the blocks in the file:
+    // begin(), write_file_metadata() (optional), write_printer_metadata(), write_thumbnail() (any number),
+    // write_print_metadata(), write_slicer_metadata(), then append_gcode() and finalize().
+    // Calls out of order return EResult::InvalidSequenceOfBlocks.
+    // The encoding type of the metadata blocks is set from the config.
+    core::EResult begin(core::OutputSink& sink, const BinarizerConfig& config);
+    core::EResult begin(FILE& file, const BinarizerConfig& config);
+    core::EResult write_file_metadata(FileMetadataBlock& block);
+    core::EResult write_printer_metadata(PrinterMetadataBlock& block);
+    core::EResult write_thumbnail(ThumbnailBlock& block);
+    core::EResult write_print_metadata(PrintMetadataBlock& block);
+    core::EResult write_slicer_metadata(SlicerMetadataBlock& block);
+
+    // Single pass alternative, for producers which get the gcode before the metadata, such as a converter reading
+    // from a pipe: after begin_gcode_spool(), append_gcode() can be called also before begin() and the following calls.
+    // The gcode blocks are encoded as soon as complete and kept in a temporary file (in memory, if the file cannot
+    // be created), then copied into the file by finalize(). begin() must be passed the same checksum, gcode compression
+    // and gcode encoding, otherwise it returns InvalidChecksumType, InvalidCompressionType or InvalidGCodeEncodingType
+    // and writes nothing.
+    core::EResult begin_gcode_spool(const BinarizerConfig& config);
+    // After begin_gcode_spool() and before begin(), encodes the given thumbnail block at once and keeps it in a temporary
+    // file, as the gcode blocks, so that its data can be released right after the call. The spooled thumbnails are written
+    // in the order they are passed in, right after the printer metadata block, by the following write_thumbnail()
+    // or write_print_metadata() call.
+    core::EResult spool_thumbnail(ThumbnailBlock& block);
+
     core::EResult append_gcode(const std::string& gcode);
+    // Writes the cached gcode and flushes the sink.
     core::EResult finalize();
 
 private:
-    FILE* m_file{ nullptr };
+    // last part of the file written
+    enum class EStage : uint8_t
+    {
+        None,
+        FileHeader,
+        FileMetadata,
+        PrinterMetadata,
+        Thumbnails,
+        PrintMetadata,
+        SlicerMetadata
+    };
+
+    core::OutputSink* m_sink{ nullptr };
+    EStage m_stage{ EStage::None };
+    // sink created by initialize(FILE&, ...)
+    std::unique_ptr<core::FileOutputSink> m_file_sink;
     bool m_enabled{ false };
     BinarizerConfig m_config;
     BinaryData m_binary_data;
     std::string m_gcode_cache;
     size_t m_gcode_cache_size{ 65536 };
+    std::unique_ptr<GCodeSpool> m_gcode_spool;
+    std::unique_ptr<GCodeSpool> m_thumbnails_spool;
+    size_t m_threads_count{ 1 };
+    std::unique_ptr<GCodeBlocksEncoder> m_gcode_encoder;
+
+    // Writes the cached gcode as a block, on the calling thread or through the encoder
+    core::EResult write_gcode_cache(core::OutputSink& sink);
+    // Writes the thumbnails kept by spool_thumbnail(), if any, after the printer metadata block
+    core::EResult write_spooled_thumbnails();
 };
 
+// Searches the metadata block of the given type for the given keys, decoding the block only
+// until all of them are found.
+// values is resized to the size of keys, each found value is stored at the position of its key,
+// keys not found are left empty. If a key appears more than once, the first value is returned.
+// The block is searched from the beginning of the file, the block checksum is not verified.
+// Returns EResult::BlockNotFound if the file does not contain a block of the given type.
+extern BGCODE_BINARIZE_EXPORT core::EResult find_metadata(FILE& file, core::EBlockType block_type, const std::vector<std::string_view>& keys,
+    std::vector<std::optional<std::string>>& values);
+
+// As above, for a single key
+extern BGCODE_BINARIZE_EXPORT core::EResult find_metadata(FILE& file, core::EBlockType block_type, std::string_view key,
+    std::optional<std::string>& value);
+
+// Selects the thumbnail which best fits the given size, reading only the parameters of the thumbnail blocks.
+// Thumbnails are ranked by format, following the order of preferred_formats (formats not listed come last,
+// all formats are equivalent if the list is empty), then by size: same size, then the smallest thumbnail
+// not smaller than the given size, then the largest one.
+// The file is searched from the beginning.
+// Returns EResult::BlockNotFound if the file does not contain thumbnails.
+extern BGCODE_BINARIZE_EXPORT core::EResult select_thumbnail(FILE& file, uint16_t target_width, uint16_t target_height,
+    const std::vector<core::EThumbnailFormat>& preferred_formats, ThumbnailHandle& thumbnail);
+
+// As above, loading the image data of the selected thumbnail only
+extern BGCODE_BINARIZE_EXPORT core::EResult select_thumbnail(FILE& file, uint16_t target_width, uint16_t target_height,
+    const std::vector<core::EThumbnailFormat>& preferred_formats, ThumbnailBlock& thumbnail);
+
 } // namespace binarize
 } // namespace bgcode
 
@@ -0,0 +1,205 @@
+#include "embedded_decoder.hpp"
+
+#include "core/core.hpp"
+
+#include <cstring>
+
+namespace bgcode {
+using namespace core;
+namespace binarize {
+
+static_assert(sizeof(EmbeddedGCodeDecoder<>) <= EmbeddedGCodeDecoder<>::MaxFootprint, "RAM footprint exceeding the documented bound");
+
+// Size of the count of the Heatshrink back references, the same for both the supported compressions
+static constexpr const uint8_t HeatshrinkLookaheadBits{ 4 };
+
+EmbeddedGCodeDecoderBase::EmbeddedGCodeDecoderBase(uint8_t window_bits, uint8_t* window, uint8_t* input, uint16_t input_buffer_size,
+    char* line_buffer, size_t line_buffer_size)
+    : m_line_buffer(line_buffer)
+    , m_line_buffer_size(line_buffer_size)
+    , m_input(input)
+    , m_input_buffer_size(input_buffer_size)
+    , m_max_window_bits(window_bits)
+    , m_window(window)
+{
+}
+
+EResult EmbeddedGCodeDecoderBase::decode_block(const BlockHeader& block_header, ReadCallback read_callback, LineCallback line_callback,
+    void* user_data)
+{
+    if ((EBlockType)block_header.type != EBlockType::GCode)
+        return EResult::InvalidBlockType;
+
+    const ECompressionType compression_type = (ECompressionType)block_header.compression;
+    uint8_t window_bits = 0;
+    switch (compression_type)
+    {
+    case ECompressionType::None:            { break; }
+    case ECompressionType::Heatshrink_11_4: { window_bits = 11; break; }
+    case ECompressionType::Heatshrink_12_4: { window_bits = 12; break; }
+    default:                                { return EResult::InvalidCompressionType; }
+    }
+    if (window_bits > m_max_window_bits)
+        return EResult::InvalidCompressionType;
+
+    m_read_callback = read_callback;
+    m_line_callback = line_callback;
+    m_user_data = user_data;
+    m_input_pos = 0;
+    m_input_size = 0;
+    m_read_error = false;
+    m_line_size = 0;
+    m_unbinarizer = MeatPack::MPByteUnbinarizer();
+    // block parameters and data
+    m_to_read = sizeof(uint16_t) + ((compression_type == ECompressionType::None) ? block_header.uncompressed_size : block_header.compressed_size);
+
+    uint8_t low, high;
+    if (!read_byte(low) || !read_byte(high))
+        return EResult::ReadError;
+    const uint16_t encoding_type = (uint16_t)(low | (high << 8));
+    if (encoding_type != (uint16_t)EGCodeEncodingType::None && encoding_type != (uint16_t)EGCodeEncodingType::MeatPack &&
+        encoding_type != (uint16_t)EGCodeEncodingType::MeatPackComments)
+        return EResult::InvalidGCodeEncodingType;
+
+    EResult res = EResult::Success;
+    if (compression_type == ECompressionType::None) {
+        uint8_t byte;
+        while (res == EResult::Success && read_byte(byte)) {
+            res = decode_byte(byte, encoding_type);
+        }
+    }
+    else
+        res = uncompress(window_bits, block_header.uncompressed_size, encoding_type);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    if (m_read_error)
+        return EResult::ReadError;
+
+    // skip the padding of the compressed data, leaving the input at the end of the block
+    uint8_t byte;
+    while (read_byte(byte)) {
+    }
+    if (m_read_error)
+        return EResult::ReadError;
+
+    if (m_line_size > 0 && !m_line_callback(m_user_data, m_line_buffer, m_line_size))
+        return EResult::WriteError;
+    m_line_size = 0;
+    return EResult::Success;
+}
+
+bool EmbeddedGCodeDecoderBase::read_byte(uint8_t& byte)
+{
+    if (m_input_pos == m_input_size) {
+        if (m_to_read == 0 || m_read_error)
+            return false;
+        const uint16_t size = (m_to_read < m_input_buffer_size) ? (uint16_t)m_to_read : m_input_buffer_size;
+        if (m_read_callback(m_user_data, m_input, size) != size) {
+            m_read_error = true;
+            return false;
+        }
+        m_to_read -= size;
+        m_input_pos = 0;
+        m_input_size = size;
+    }
+    byte = m_input[m_input_pos++];
+    return true;
+}
+
+// Heatshrink stores the bits starting from the most significant one of each byte
+bool EmbeddedGCodeDecoderBase::read_bits(uint8_t count, uint16_t& value)
+{
+    value = 0;
+    for (uint8_t i = 0; i < count; ++i) {
+        if (m_bit_mask == 0) {
+            if (!read_byte(m_bit_buffer))
+                return false;
+            m_bit_mask = 0x80;
+        }
+        value = (uint16_t)((value << 1) | (((m_bit_buffer & m_bit_mask) != 0) ? 1 : 0));
+        m_bit_mask >>= 1;
+    }
+    return true;
+}
+
+// Same decoding of heatshrink_decoder, with a statically sized window.
+// Each symbol is either a literal byte, tagged by a 1 bit, or a back reference into the window, tagged by a 0 bit,
+// made of the distance minus 1 (window_bits) and of the count minus 1 (lookahead bits).
+EResult EmbeddedGCodeDecoderBase::uncompress(uint8_t window_bits, uint32_t uncompressed_size, uint16_t encoding_type)
+{
+    // the window starts zeroed, as in heatshrink_decoder_reset()
+    const uint16_t window_mask = (uint16_t)((1 << window_bits) - 1);
+    std::memset(m_window, 0, (size_t)window_mask + 1);
+    m_window_head = 0;
+    m_bit_mask = 0;
+
+    auto output = [&](uint8_t byte) {
+        m_window[m_window_head & window_mask] = byte;
+        ++m_window_head;
+        --uncompressed_size;
+        return decode_byte(byte, encoding_type);
+    };
+
+    while (uncompressed_size > 0) {
+        uint16_t tag;
+        if (!read_bits(1, tag))
+            return m_read_error ? EResult::ReadError : EResult::DataUncompressionError;
+        if (tag != 0) {
+            uint16_t byte;
+            if (!read_bits(8, byte))
+                return m_read_error ? EResult::ReadError : EResult::DataUncompressionError;
+            const EResult res = output((uint8_t)byte);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+        }
+        else {
+            uint16_t distance;
+            uint16_t count;
+            if (!read_bits(window_bits, distance) || !read_bits(HeatshrinkLookaheadBits, count))
+                return m_read_error ? EResult::ReadError : EResult::DataUncompressionError;
+            for (uint32_t i = 0; i <= count && uncompressed_size > 0; ++i) {
+                const EResult res = output(m_window[(m_window_head - distance - 1) & window_mask]);
+                if (res != EResult::Success)
+                    // propagate error
+                    return res;
+            }
+        }
+    }
+    return EResult::Success;
+}
+
+EResult EmbeddedGCodeDecoderBase::decode_byte(uint8_t byte, uint16_t encoding_type)
+{
+    if (encoding_type == (uint16_t)EGCodeEncodingType::None)
+        return append_char((char)byte);
+
+    char decoded[MeatPack::MPByteUnbinarizer::MaxDecodedSize];
+    const size_t size = m_unbinarizer.unbinarize(byte, decoded);
+    for (size_t i = 0; i < size; ++i) {
+        const EResult res = append_char(decoded[i]);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+    }
+    return EResult::Success;
+}
+
+EResult EmbeddedGCodeDecoderBase::append_char(char c)
+{
+    if (c == '\n') {
+        if (!m_line_callback(m_user_data, m_line_buffer, m_line_size))
+            return EResult::WriteError;
+        m_line_size = 0;
+    }
+    else {
+        if (m_line_size == m_line_buffer_size)
+            return EResult::InvalidBuffer;
+        m_line_buffer[m_line_size++] = c;
+    }
+    return EResult::Success;
+}
+
+} // namespace binarize
+} // namespace bgcode
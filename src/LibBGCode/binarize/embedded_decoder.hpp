@@ -0,0 +1,118 @@
+#ifndef _BGCODE_BINARIZE_EMBEDDED_DECODER_HPP_
+#define _BGCODE_BINARIZE_EMBEDDED_DECODER_HPP_
+
+#include "binarize/export.h"
+#include "binarize/meatpack_byte_unbinarizer.hpp"
+
+#include <cstdint>
+#include <cstddef>
+
+//
+// Decoder profile for embedded consumers, such as printer firmwares.
+// Decodes a GCode block read through a callback into lines, written into a buffer provided by the caller,
+// without any dynamic allocation. Heatshrink decompression uses a window with a size fixed at compile time.
+// Supported: compression None, Heatshrink_11_4, Heatshrink_12_4; encoding None, MeatPack, MeatPackComments.
+// This header does not depend on the standard containers: the types of core.hpp are only declared.
+//
+// Compile time configuration, as template parameters of EmbeddedGCodeDecoder:
+// WindowBits      largest Heatshrink window supported, 11 or 12 (default)
+// InputBufferSize size of the buffer for the data read through the callback (default 64)
+// The buffers sized by the configuration live in EmbeddedGCodeDecoder, the library code only accesses them
+// through EmbeddedGCodeDecoderBase, whose layout is the same for any configuration.
+//
+// Worst case RAM footprint: sizeof(EmbeddedGCodeDecoder), at most MaxFootprint bytes
+// (4096 + 64 + 128 = 4288 bytes with the default configuration), plus the line buffer.
+// decode_block() does not recurse nor use variable length arrays, its stack usage is bounded and small.
+//
+
+namespace bgcode {
+namespace core {
+enum class EResult : uint16_t;
+struct BlockHeader;
+} // namespace core
+
+namespace binarize {
+
+class BGCODE_BINARIZE_EXPORT EmbeddedGCodeDecoderBase
+{
+public:
+    // Reads up to size bytes into data, returns the count of bytes read
+    using ReadCallback = size_t(*)(void* user_data, uint8_t* data, size_t size);
+    // Receives a decoded line, without the new line character, returns false to stop the decoding
+    using LineCallback = bool(*)(void* user_data, const char* line, size_t size);
+
+    EmbeddedGCodeDecoderBase(const EmbeddedGCodeDecoderBase&) = delete;
+    EmbeddedGCodeDecoderBase& operator=(const EmbeddedGCodeDecoderBase&) = delete;
+
+    // Decodes the GCode block with the given header, whose parameters and data are read through read_callback,
+    // and passes the lines to line_callback. The last line of the block is passed also if not terminated by a new line.
+    // The block checksum, if any, is left to be read by the caller.
+    // Returns InvalidBuffer if a line does not fit into the line buffer, WriteError if stopped by line_callback.
+    core::EResult decode_block(const core::BlockHeader& block_header, ReadCallback read_callback, LineCallback line_callback,
+        void* user_data);
+
+protected:
+    // The window must have room for 1 << window_bits bytes
+    EmbeddedGCodeDecoderBase(uint8_t window_bits, uint8_t* window, uint8_t* input, uint16_t input_buffer_size, char* line_buffer,
+        size_t line_buffer_size);
+    ~EmbeddedGCodeDecoderBase() = default;
+
+private:
+    char* m_line_buffer;
+    size_t m_line_buffer_size;
+    size_t m_line_size{ 0 };
+
+    ReadCallback m_read_callback{ nullptr };
+    LineCallback m_line_callback{ nullptr };
+    void* m_user_data{ nullptr };
+
+    // data read through the callback
+    uint8_t* m_input;
+    size_t m_to_read{ 0 };
+    uint16_t m_input_buffer_size;
+    uint16_t m_input_pos{ 0 };
+    uint16_t m_input_size{ 0 };
+    bool m_read_error{ false };
+
+    // Heatshrink bit reader and window
+    uint8_t m_max_window_bits;
+    uint8_t m_bit_buffer{ 0 };
+    uint8_t m_bit_mask{ 0 };
+    uint16_t m_window_head{ 0 };
+    uint8_t* m_window;
+
+    MeatPack::MPByteUnbinarizer m_unbinarizer;
+
+    bool read_byte(uint8_t& byte);
+    bool read_bits(uint8_t count, uint16_t& value);
+    core::EResult uncompress(uint8_t window_bits, uint32_t uncompressed_size, uint16_t encoding_type);
+    core::EResult decode_byte(uint8_t byte, uint16_t encoding_type);
+    core::EResult append_char(char c);
+};
+
+template<uint8_t WindowBits = 12, uint16_t InputBufferSize = 64>
+class EmbeddedGCodeDecoder : public EmbeddedGCodeDecoderBase
+{
+    static_assert(WindowBits == 11 || WindowBits == 12, "Unsupported Heatshrink window size");
+    static_assert(InputBufferSize > 0, "Invalid input buffer size");
+
+public:
+    static constexpr const size_t WindowSize{ size_t(1) << WindowBits };
+    // Bound of the size of the decoder
+    static constexpr const size_t MaxFootprint{ WindowSize + InputBufferSize + 128 };
+
+    // The line buffer must be able to contain the longest line of the blocks to decode
+    EmbeddedGCodeDecoder(char* line_buffer, size_t line_buffer_size)
+        : EmbeddedGCodeDecoderBase(WindowBits, m_window, m_input, InputBufferSize, line_buffer, line_buffer_size) {
+        static_assert(sizeof(EmbeddedGCodeDecoder) <= MaxFootprint, "RAM footprint exceeding the documented bound");
+    }
+
+private:
+    uint8_t m_window[WindowSize];
+    uint8_t m_input[InputBufferSize];
+};
+
+} // namespace binarize
+} // namespace bgcode
+
+#endif // _BGCODE_BINARIZE_EMBEDDED_DECODER_HPP_
@@ -1,8 +1,15 @@
 #include "meatpack.hpp"
 
-#include <unordered_map>
 #include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <charconv>
+
+#if defined(BGCODE_SIMD_X86)
+#include <immintrin.h>
+#elif defined(BGCODE_SIMD_NEON)
+#include <arm_neon.h>
+#endif
 
 namespace MeatPack {
 
@@ -21,27 +28,39 @@ static constexpr const char SpaceReplacedCharacter{ 'E' };
 
 static constexpr const unsigned char SecondNotPacked{ 0b11110000 };
 static constexpr const unsigned char FirstNotPacked{ 0b00001111 };
-static constexpr const unsigned char NextPackedFirst{ 0b00000001 };
-static constexpr const unsigned char NextPackedSecond{ 0b00000010 };
-
-static const std::unordered_map<char, uint8_t> ReverseLookupTbl = {
-    { '0',  0b00000000 },
-    { '1',  0b00000001 },
-    { '2',  0b00000010 },
-    { '3',  0b00000011 },
-    { '4',  0b00000100 },
-    { '5',  0b00000101 },
-    { '6',  0b00000110 },
-    { '7',  0b00000111 },
-    { '8',  0b00001000 },
-    { '9',  0b00001001 },
-    { '.',  0b00001010 },
-    { ' ',  0b00001011 },
-    { '\n', 0b00001100 },
-    { 'G',  0b00001101 },
-    { 'X',  0b00001110 },
-    { '\0', 0b00001111 } // never used, 0b1111 is used to indicate the next 8-bits is a full character
-};
+
+// nibble value of the packable characters, NotPackable for the others
+static constexpr const uint8_t NotPackable{ 0x10 };
+
+using PackTable = std::array<uint8_t, 256>;
+
+static constexpr PackTable make_pack_table(bool omit_whitespaces)
+{
+    PackTable table{};
+    for (uint8_t& value : table) {
+        value = NotPackable;
+    }
+    constexpr const char chars[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '.', ' ', '\n', 'G', 'X' };
+    for (uint8_t i = 0; i < sizeof(chars); ++i) {
+        table[static_cast<uint8_t>(chars[i])] = i;
+    }
+    // never used, 0b1111 is used to indicate the next 8-bits is a full character
+    table[0] = 0b1111;
+    if (omit_whitespaces) {
+        table[static_cast<uint8_t>(SpaceReplacedCharacter)] = table[static_cast<uint8_t>(' ')];
+        table[static_cast<uint8_t>(' ')] = NotPackable;
+    }
+    return table;
+}
+
+// Indexed by Flag_OmitWhitespaces, the only flag affecting the packing of the characters.
+// Built at compile time and never modified, so that any number of binarizers can run concurrently.
+static constexpr const std::array<PackTable, 2> PackTables = { make_pack_table(false), make_pack_table(true) };
+
+static const PackTable& pack_table(uint8_t flags)
+{
+    return PackTables[(flags & Flag_OmitWhitespaces) != 0 ? 1 : 0];
+}
 
 static std::string_view trim(const std::string_view& str)
 {
@@ -57,13 +76,15 @@ static std::string_view trim(const std::string_view& str)
         return std::string_view(&str[start], end - start + 1);
 }
 
-MPBinarizer::LookupTables MPBinarizer::s_lookup_tables = { { 0 }, { 0 }, false, 0 };
+MPBinarizer::MPBinarizer(uint8_t flags) : m_flags(flags), m_simd_level(bgcode::core::detect_simd_level()) {}
 
-MPBinarizer::MPBinarizer(uint8_t flags) : m_flags(flags) {}
+void MPBinarizer::set_simd_level(bgcode::core::ESimdLevel level)
+{
+    m_simd_level = bgcode::core::supported_simd_level(level);
+}
 
 void MPBinarizer::initialize(std::vector<uint8_t>& dst)
 {
-    initialize_lookup_tables();
     append_command(Command_EnablePacking, dst);
     if ((m_flags & Flag_OmitWhitespaces) != 0)
         append_command(Command_EnableNoSpaces, dst);
@@ -122,12 +143,12 @@ void MPBinarizer::binarize_line(const std::string& line, std::vector<uint8_t>& d
         }
         return line;
     };
-    auto is_packable = [](char c) {
-        return (s_lookup_tables.packable[static_cast<uint8_t>(c)] != 0);
+    const PackTable& codes = pack_table(m_flags);
+    auto is_packable = [&codes](char c) {
+        return codes[static_cast<uint8_t>(c)] != NotPackable;
     };
-    auto pack_chars = [](char low, char high) {
-        return (((s_lookup_tables.value[static_cast<uint8_t>(high)] & 0xF) << 4) |
-            (s_lookup_tables.value[static_cast<uint8_t>(low)] & 0xF));
+    auto pack_chars = [&codes](char low, char high) {
+        return (codes[static_cast<uint8_t>(high)] << 4) | codes[static_cast<uint8_t>(low)];
     };
 
     if (!line.empty()) {
@@ -196,241 +217,1096 @@ void MPBinarizer::binarize_line(const std::string& line, std::vector<uint8_t>& d
     }
 }
 
-void MPBinarizer::append_command(unsigned char cmd, std::vector<uint8_t>& dst) {
-    dst.emplace_back(Command_SignalByte);
-    dst.emplace_back(Command_SignalByte);
-    dst.emplace_back(cmd);
+// Packs the given pair of characters into out, returns the new end of the output
+static inline uint8_t* pack_pair(const PackTable& codes, char char_1, char char_2, uint8_t* out)
+{
+    const uint8_t value_1 = codes[static_cast<uint8_t>(char_1)];
+    const uint8_t value_2 = codes[static_cast<uint8_t>(char_2)];
+    if (value_1 != NotPackable) {
+        if (value_2 != NotPackable)
+            *out++ = static_cast<uint8_t>((value_2 << 4) | value_1);
+        else {
+            *out++ = static_cast<uint8_t>(SecondNotPacked | value_1);
+            *out++ = static_cast<uint8_t>(char_2);
+        }
+    }
+    else {
+        if (value_2 != NotPackable) {
+            *out++ = static_cast<uint8_t>((value_2 << 4) | FirstNotPacked);
+            *out++ = static_cast<uint8_t>(char_1);
+        }
+        else {
+            *out++ = BothUnpackable;
+            *out++ = static_cast<uint8_t>(char_1);
+            *out++ = static_cast<uint8_t>(char_2);
+        }
+    }
+    return out;
 }
 
-void MPBinarizer::initialize_lookup_tables() {
-    if (s_lookup_tables.initialized && m_flags == s_lookup_tables.flags)
-        return;
+// Packs the characters in [begin, end), whose count must be even, returns the new end of the output
+static uint8_t* pack_scalar(const PackTable& codes, const char* begin, const char* end, uint8_t* out)
+{
+    for (; begin != end; begin += 2) {
+        out = pack_pair(codes, begin[0], begin[1], out);
+    }
+    return out;
+}
 
-    for (const auto& [c, value] : ReverseLookupTbl) {
-        const int index = static_cast<int>(c);
-        s_lookup_tables.packable[index] = 1;
-        s_lookup_tables.value[index] = value;
+//
+// Vectorized packing of 16 (32) characters at a time.
+// The characters are classified with byte compares: digits, '.', the space (or 'E' if whitespaces are omitted),
+// '\n', 'G', 'X' and '\0' are packable into their nibble value, the others get the nibble 0b1111.
+// Merging the nibbles of each pair gives the header byte of the pair, which is followed by its unpackable
+// characters, if any. Groups of 4 pairs are then compacted into their final layout with a byte shuffle,
+// selected by the mask of the unpackable characters of the group.
+//
+
+#if defined(BGCODE_SIMD_X86) || defined(BGCODE_SIMD_NEON)
+
+// Shuffle masks compacting the packed form of 4 pairs of characters, and size of the result, indexed by the mask
+// of the unpackable characters (bit 2 * i for the first character of pair i, bit 2 * i + 1 for the second one).
+// Source lanes: the 8 characters in 0..7, the 4 header bytes in 8..11.
+struct PackShuffleTable
+{
+    std::array<std::array<uint8_t, 16>, 256> masks{};
+    std::array<uint8_t, 256> sizes{};
+};
+
+static constexpr PackShuffleTable make_pack_shuffle_table()
+{
+    PackShuffleTable table;
+    for (size_t key = 0; key < 256; ++key) {
+        uint8_t size = 0;
+        for (uint8_t i = 0; i < 4; ++i) {
+            table.masks[key][size++] = 8 + i;
+            if ((key & (size_t(1) << (2 * i))) != 0)
+                table.masks[key][size++] = 2 * i;
+            if ((key & (size_t(1) << (2 * i + 1))) != 0)
+                table.masks[key][size++] = 2 * i + 1;
+        }
+        for (uint8_t i = size; i < 16; ++i) {
+            // out of range index, zeroes the lane
+            table.masks[key][i] = 0x80;
+        }
+        table.sizes[key] = size;
     }
+    return table;
+}
+
+static constexpr const PackShuffleTable PackShuffle = make_pack_shuffle_table();
+
+// Max number of bytes written past the end of the packed data by the vectorized code
+static constexpr const size_t PackOverrun = 16;
+
+#endif // BGCODE_SIMD_X86 || BGCODE_SIMD_NEON
+
+#if defined(BGCODE_SIMD_X86)
 
-    if ((m_flags & Flag_OmitWhitespaces) != 0) {
-        s_lookup_tables.value[static_cast<uint8_t>(SpaceReplacedCharacter)] = ReverseLookupTbl.at(' ');
-        s_lookup_tables.packable[static_cast<uint8_t>(SpaceReplacedCharacter)] = 1;
-        s_lookup_tables.packable[static_cast<uint8_t>(' ')] = 0;
+// Compacts 4 pairs (chars in lanes 0..7, headers in lanes 8..11), returns the new end of the output
+BGCODE_TARGET("ssse3")
+static inline uint8_t* store_pairs_ssse3(__m128i src, unsigned int key, uint8_t* out)
+{
+    const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(PackShuffle.masks[key].data()));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(src, mask));
+    return out + PackShuffle.sizes[key];
+}
+
+// Packs 16 characters given their nibble values (0b1111 for the unpackable ones) and their unpackable mask
+BGCODE_TARGET("ssse3")
+static inline uint8_t* store_packed_ssse3(__m128i c, __m128i values, unsigned int invalid, uint8_t* out)
+{
+    // merge the pairs of nibbles: low byte | high byte << 4
+    __m128i headers = _mm_or_si128(values, _mm_srli_epi16(values, 4));
+    headers = _mm_packus_epi16(_mm_and_si128(headers, _mm_set1_epi16(0x00FF)), _mm_setzero_si128());
+    if (invalid == 0) {
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out), headers);
+        return out + 8;
     }
-    else {
-        s_lookup_tables.packable[static_cast<uint8_t>(SpaceReplacedCharacter)] = 0;
-        s_lookup_tables.packable[static_cast<uint8_t>(' ')] = 1;
+    out = store_pairs_ssse3(_mm_unpacklo_epi64(c, headers), invalid & 0xFF, out);
+    return store_pairs_ssse3(_mm_unpacklo_epi64(_mm_srli_si128(c, 8), _mm_srli_si128(headers, 4)), (invalid >> 8) & 0xFF, out);
+}
+
+BGCODE_TARGET("ssse3")
+static uint8_t* pack_ssse3(const PackTable& codes, char space_char, const char* begin, const char* end, uint8_t* out)
+{
+    const __m128i zero_char = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i not_packed = _mm_set1_epi8(0x0F);
+    const __m128i chars[6] = { _mm_set1_epi8('.'), _mm_set1_epi8(space_char), _mm_set1_epi8('\n'), _mm_set1_epi8('G'),
+        _mm_set1_epi8('X'), _mm_setzero_si128() };
+    for (; end - begin >= 16; begin += 16) {
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        const __m128i digit = _mm_sub_epi8(c, zero_char);
+        __m128i valid = _mm_cmpeq_epi8(_mm_min_epu8(digit, nine), digit);
+        __m128i values = _mm_and_si128(valid, digit);
+        for (int i = 0; i < 6; ++i) {
+            const __m128i eq = _mm_cmpeq_epi8(c, chars[i]);
+            values = _mm_or_si128(values, _mm_and_si128(eq, _mm_set1_epi8(static_cast<char>(10 + i))));
+            valid = _mm_or_si128(valid, eq);
+        }
+        values = _mm_or_si128(values, _mm_andnot_si128(valid, not_packed));
+        const unsigned int invalid = ~static_cast<unsigned int>(_mm_movemask_epi8(valid)) & 0xFFFF;
+        out = store_packed_ssse3(c, values, invalid, out);
     }
+    return pack_scalar(codes, begin, end, out);
+}
 
-    s_lookup_tables.initialized = true;
-    s_lookup_tables.flags = m_flags;
+BGCODE_TARGET("avx2")
+static uint8_t* pack_avx2(const PackTable& codes, char space_char, const char* begin, const char* end, uint8_t* out)
+{
+    const __m256i zero_char = _mm256_set1_epi8('0');
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i not_packed = _mm256_set1_epi8(0x0F);
+    const __m256i chars[6] = { _mm256_set1_epi8('.'), _mm256_set1_epi8(space_char), _mm256_set1_epi8('\n'), _mm256_set1_epi8('G'),
+        _mm256_set1_epi8('X'), _mm256_setzero_si256() };
+    for (; end - begin >= 32; begin += 32) {
+        const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        const __m256i digit = _mm256_sub_epi8(c, zero_char);
+        __m256i valid = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, nine), digit);
+        __m256i values = _mm256_and_si256(valid, digit);
+        for (int i = 0; i < 6; ++i) {
+            const __m256i eq = _mm256_cmpeq_epi8(c, chars[i]);
+            values = _mm256_or_si256(values, _mm256_and_si256(eq, _mm256_set1_epi8(static_cast<char>(10 + i))));
+            valid = _mm256_or_si256(valid, eq);
+        }
+        values = _mm256_or_si256(values, _mm256_andnot_si256(valid, not_packed));
+        const uint32_t invalid = ~static_cast<uint32_t>(_mm256_movemask_epi8(valid));
+        out = store_packed_ssse3(_mm256_castsi256_si128(c), _mm256_castsi256_si128(values), invalid & 0xFFFF, out);
+        out = store_packed_ssse3(_mm256_extracti128_si256(c, 1), _mm256_extracti128_si256(values, 1), invalid >> 16, out);
+    }
+    // avoid the penalty of mixing AVX and legacy SSE code
+    _mm256_zeroupper();
+    return pack_ssse3(codes, space_char, begin, end, out);
 }
 
-// See for reference: https://github.com/scottmudge/Prusa-Firmware-MeatPack/blob/MK3_sm_MeatPack/Firmware/meatpack.cpp
-void unbinarize(const std::vector<uint8_t>& src, std::string& dst)
+#elif defined(BGCODE_SIMD_NEON)
+
+static inline uint8_t* store_pairs_neon(uint8x16_t src, unsigned int key, uint8_t* out)
 {
-    bool unbinarizing = false;
-    bool nospace_enabled = false;
-    bool cmd_active = false;             // Is a command pending
-    uint8_t char_buf = 0;                // Buffers a character if dealing with out-of-sequence pairs
-    size_t cmd_count = 0;                // Counts how many command bytes are received (need 2)
-    size_t full_char_queue = 0;          // Counts how many full-width characters are to be received
-    std::array<uint8_t, 2> char_out_buf; // Output buffer for caching up to 2 characters
-    size_t char_out_count = 0;           // Stores number of characters to be read out
+    vst1q_u8(out, vqtbl1q_u8(src, vld1q_u8(PackShuffle.masks[key].data())));
+    return out + PackShuffle.sizes[key];
+}
 
-    auto handle_command = [&](uint8_t c) {
-        switch (c)
-        {
-        case Command_EnablePacking:   { unbinarizing = true; break; }
-        case Command_DisablePacking:  { unbinarizing = false; break; }
-        case Command_EnableNoSpaces:  { nospace_enabled = true; break; }
-        case Command_DisableNoSpaces: { nospace_enabled = false; break; }
-        case Command_ResetAll:        { unbinarizing = false; break; }
-        default:
-        case Command_QueryConfig:     { break; }
+static uint8_t* pack_neon(const PackTable& codes, char space_char, const char* begin, const char* end, uint8_t* out)
+{
+    const uint8x16_t zero_char = vdupq_n_u8('0');
+    const uint8x16_t nine = vdupq_n_u8(9);
+    const uint8x16_t not_packed = vdupq_n_u8(0x0F);
+    const uint8x16_t chars[6] = { vdupq_n_u8('.'), vdupq_n_u8(static_cast<uint8_t>(space_char)), vdupq_n_u8('\n'), vdupq_n_u8('G'),
+        vdupq_n_u8('X'), vdupq_n_u8(0) };
+    // bit of each lane, to build the mask of the unpackable characters
+    static const uint8_t lane_bits_data[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t lane_bits = vld1q_u8(lane_bits_data);
+    for (; end - begin >= 16; begin += 16) {
+        const uint8x16_t c = vld1q_u8(reinterpret_cast<const uint8_t*>(begin));
+        const uint8x16_t digit = vsubq_u8(c, zero_char);
+        uint8x16_t valid = vcleq_u8(digit, nine);
+        uint8x16_t values = vandq_u8(valid, digit);
+        for (int i = 0; i < 6; ++i) {
+            const uint8x16_t eq = vceqq_u8(c, chars[i]);
+            values = vorrq_u8(values, vandq_u8(eq, vdupq_n_u8(static_cast<uint8_t>(10 + i))));
+            valid = vorrq_u8(valid, eq);
         }
-    };
+        values = vorrq_u8(values, vbicq_u8(not_packed, valid));
+        // merge the pairs of nibbles: low byte | high byte << 4
+        const uint16x8_t words = vreinterpretq_u16_u8(values);
+        const uint8x8_t headers = vmovn_u16(vorrq_u16(words, vshrq_n_u16(words, 4)));
+        if (vminvq_u8(valid) == 0xFF) {
+            vst1_u8(out, headers);
+            out += 8;
+            continue;
+        }
+        const uint8x16_t invalid_bits = vbicq_u8(lane_bits, valid);
+        const unsigned int key_low = vaddv_u8(vget_low_u8(invalid_bits));
+        const unsigned int key_high = vaddv_u8(vget_high_u8(invalid_bits));
+        out = store_pairs_neon(vcombine_u8(vget_low_u8(c), headers), key_low, out);
+        out = store_pairs_neon(vcombine_u8(vget_high_u8(c), vext_u8(headers, headers, 4)), key_high, out);
+    }
+    return pack_scalar(codes, begin, end, out);
+}
 
-    auto handle_output_char = [&](uint8_t c) {
-        char_out_buf[char_out_count++] = c;
+#endif // BGCODE_SIMD_NEON
+
+//
+// Vectorized normalization of G lines, 16 characters at a time: the lowercase parameters are uppercased with
+// compares and the spaces are removed with a byte shuffle selected by the mask of the spaces of each half.
+// Stops at the first '*', leaving the rest of the line, and the checksum, to the scalar code.
+//
+
+#if defined(BGCODE_SIMD_X86) || defined(BGCODE_SIMD_NEON)
+
+// Shuffle masks moving the lanes of 8 not in the mask to the front, and their count, indexed by the mask
+struct CompactShuffleTable
+{
+    std::array<std::array<uint8_t, 8>, 256> masks{};
+    std::array<uint8_t, 256> sizes{};
+};
+
+static constexpr CompactShuffleTable make_compact_shuffle_table()
+{
+    CompactShuffleTable table;
+    for (size_t key = 0; key < 256; ++key) {
+        uint8_t size = 0;
+        for (uint8_t i = 0; i < 8; ++i) {
+            if ((key & (size_t(1) << i)) == 0)
+                table.masks[key][size++] = i;
+        }
+        for (uint8_t i = size; i < 8; ++i) {
+            table.masks[key][i] = 0x80;
+        }
+        table.sizes[key] = size;
+    }
+    return table;
+}
+
+static constexpr const CompactShuffleTable CompactShuffle = make_compact_shuffle_table();
+
+#endif // BGCODE_SIMD_X86 || BGCODE_SIMD_NEON
+
+#if defined(BGCODE_SIMD_X86)
+
+// Normalizes the characters of the G line in [begin, end) into out, returns the first character not processed
+BGCODE_TARGET("ssse3")
+static const char* normalize_gline_ssse3(const char* begin, const char* end, char e_char, char*& out)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i lower_x = _mm_set1_epi8('x');
+    const __m128i lower_g = _mm_set1_epi8('g');
+    const __m128i lower_e = _mm_set1_epi8(e_char);
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    for (; end - begin >= 16; begin += 16) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(c, star)) != 0)
+            break;
+        const __m128i lower = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, lower_x), _mm_cmpeq_epi8(c, lower_g)), _mm_cmpeq_epi8(c, lower_e));
+        c = _mm_sub_epi8(c, _mm_and_si128(lower, case_bit));
+        const unsigned int spaces = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(c, space)));
+        const unsigned int key_low = spaces & 0xFF;
+        const unsigned int key_high = spaces >> 8;
+        const __m128i mask_low = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(CompactShuffle.masks[key_low].data()));
+        const __m128i mask_high = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(CompactShuffle.masks[key_high].data()));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(c, mask_low));
+        out += CompactShuffle.sizes[key_low];
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(_mm_srli_si128(c, 8), mask_high));
+        out += CompactShuffle.sizes[key_high];
+    }
+    return begin;
+}
+
+#elif defined(BGCODE_SIMD_NEON)
+
+static const char* normalize_gline_neon(const char* begin, const char* end, char e_char, char*& out)
+{
+    const uint8x16_t space = vdupq_n_u8(' ');
+    const uint8x16_t star = vdupq_n_u8('*');
+    const uint8x16_t lower_x = vdupq_n_u8('x');
+    const uint8x16_t lower_g = vdupq_n_u8('g');
+    const uint8x16_t lower_e = vdupq_n_u8(static_cast<uint8_t>(e_char));
+    const uint8x16_t case_bit = vdupq_n_u8(0x20);
+    static const uint8_t lane_bits_data[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t lane_bits = vld1q_u8(lane_bits_data);
+    for (; end - begin >= 16; begin += 16) {
+        uint8x16_t c = vld1q_u8(reinterpret_cast<const uint8_t*>(begin));
+        if (vmaxvq_u8(vceqq_u8(c, star)) != 0)
+            break;
+        const uint8x16_t lower = vorrq_u8(vorrq_u8(vceqq_u8(c, lower_x), vceqq_u8(c, lower_g)), vceqq_u8(c, lower_e));
+        c = vsubq_u8(c, vandq_u8(lower, case_bit));
+        const uint8x16_t space_bits = vandq_u8(vceqq_u8(c, space), lane_bits);
+        const unsigned int key_low = vaddv_u8(vget_low_u8(space_bits));
+        const unsigned int key_high = vaddv_u8(vget_high_u8(space_bits));
+        vst1_u8(reinterpret_cast<uint8_t*>(out), vtbl1_u8(vget_low_u8(c), vld1_u8(CompactShuffle.masks[key_low].data())));
+        out += CompactShuffle.sizes[key_low];
+        vst1_u8(reinterpret_cast<uint8_t*>(out), vtbl1_u8(vget_high_u8(c), vld1_u8(CompactShuffle.masks[key_high].data())));
+        out += CompactShuffle.sizes[key_high];
+    }
+    return begin;
+}
+
+#endif // BGCODE_SIMD_NEON
+
+// Normalizes the characters of the G line in [begin, end) into out, returns the first character not processed
+static const char* normalize_gline(bgcode::core::ESimdLevel simd_level, const char* begin, const char* end, char e_char, char*& out)
+{
+    using bgcode::core::ESimdLevel;
+    switch (simd_level)
+    {
+#if defined(BGCODE_SIMD_X86)
+    case ESimdLevel::AVX2:
+    case ESimdLevel::SSSE3: { return normalize_gline_ssse3(begin, end, e_char, out); }
+#elif defined(BGCODE_SIMD_NEON)
+    case ESimdLevel::NEON:  { return normalize_gline_neon(begin, end, e_char, out); }
+#endif
+    default:                { return begin; }
+    }
+}
+
+// Packs the characters in [begin, end), whose count must be even, returns the new end of the output
+static uint8_t* pack(bgcode::core::ESimdLevel simd_level, const PackTable& codes, char space_char,
+    const char* begin, const char* end, uint8_t* out)
+{
+    using bgcode::core::ESimdLevel;
+    switch (simd_level)
+    {
+#if defined(BGCODE_SIMD_X86)
+    case ESimdLevel::AVX2:  { return pack_avx2(codes, space_char, begin, end, out); }
+    case ESimdLevel::SSSE3: { return pack_ssse3(codes, space_char, begin, end, out); }
+#elif defined(BGCODE_SIMD_NEON)
+    case ESimdLevel::NEON:  { return pack_neon(codes, space_char, begin, end, out); }
+#endif
+    default:                { return pack_scalar(codes, begin, end, out); }
+    }
+}
+
+void MPBinarizer::binarize(std::string_view src, std::vector<uint8_t>& dst)
+{
+    initialize(dst);
+
+    const PackTable& codes = pack_table(m_flags);
+
+    const bool omit_whitespaces = (m_flags & Flag_OmitWhitespaces) != 0;
+    const bool remove_comments = (m_flags & Flag_RemoveComments) != 0;
+    const char space_char = omit_whitespaces ? SpaceReplacedCharacter : ' ';
+    // lowercase character uppercased in G lines, in addition to 'x' and 'g'
+    const char e_char = omit_whitespaces ? 'e' : 'x';
+
+    // the output is written in place, dst is resized to the written size at the end
+    size_t out_pos = dst.size();
+    dst.resize(out_pos + src.size() + 64);
+    auto reserve = [&](size_t size) {
+        if (out_pos + size > dst.size())
+            dst.resize(std::max(out_pos + size, 2 * dst.size()));
+    };
+    auto write_command = [&](uint8_t cmd) {
+        reserve(3);
+        dst[out_pos++] = Command_SignalByte;
+        dst[out_pos++] = Command_SignalByte;
+        dst[out_pos++] = cmd;
     };
 
-    auto get_char = [&](uint8_t c) {
-        switch (c)
-        {
-        case 0b0000: { return '0'; }
-        case 0b0001: { return '1'; }
-        case 0b0010: { return '2'; }
-        case 0b0011: { return '3'; }
-        case 0b0100: { return '4'; }
-        case 0b0101: { return '5'; }
-        case 0b0110: { return '6'; }
-        case 0b0111: { return '7'; }
-        case 0b1000: { return '8'; }
-        case 0b1001: { return '9'; }
-        case 0b1010: { return '.'; }
-        case 0b1011: { return nospace_enabled ? 'E' : ' '; }
-        case 0b1100: { return '\n'; }
-        case 0b1101: { return 'G'; }
-        case 0b1110: { return 'X'; }
-        }
-        return '\0';
+    // The lines to be packed are normalized into the staging buffer, each one padded with a '\n' to an even size
+    // (a line starts always a new pair), and packed together when the buffer is full or a comment line is met.
+    // The buffer is on the stack, only the lines not fitting into it are staged into a temporary buffer.
+    static constexpr const size_t StagingSize = 8192;
+    std::array<char, StagingSize> stack_staging;
+    std::vector<char> long_line_staging;
+    char* staging = stack_staging.data();
+    size_t staging_size = StagingSize;
+    size_t staged = 0;
+    auto flush_staging = [&]() {
+        // at worst 3 bytes every 2 characters, plus the room for the vectorized stores
+        reserve(staged + staged / 2 + PackOverrun);
+        uint8_t* out = dst.data() + out_pos;
+        out_pos += pack(m_simd_level, codes, space_char, staging, staging + staged, out) - out;
+        staged = 0;
     };
 
-    auto unpack_chars = [&](uint8_t pk, std::array<uint8_t, 2>& chars_out) {
-        uint8_t out = 0;
+    const char* begin = src.data();
+    const char* const end = src.data() + src.size();
+    while (begin != end) {
+        const char* line_end = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+        line_end = (line_end != nullptr) ? line_end + 1 : end;
+        const size_t line_size = line_end - begin;
+        const char* line_begin = begin;
+        begin = line_end;
 
-        // If lower 4 bytes is 0b1111, the higher 4 are unused, and next char is full.
-        if ((pk & FirstNotPacked) == FirstNotPacked)
-            out |= NextPackedFirst;
-        else
-            chars_out[0] = get_char(pk & 0xF); // Assign lower char
+        if (!remove_comments && *line_begin == ';') {
+            // comments are kept as they are
+            flush_staging();
+            if (m_binarizing) {
+                write_command(Command_DisablePacking);
+                m_binarizing = false;
+            }
+            reserve(line_size);
+            std::memcpy(dst.data() + out_pos, line_begin, line_size);
+            out_pos += line_size;
+            continue;
+        }
 
-        // Check if upper 4 bytes is 0b1111... if so, we don't need the second char.
-        if ((pk & SecondNotPacked) == SecondNotPacked)
-            out |= NextPackedSecond;
-        else
-            chars_out[1] = get_char((pk >> 4) & 0xF); // Assign upper char
+        if (*line_begin == ';' || *line_begin == '\n' || *line_begin == '\r' || line_size < 2)
+            continue;
 
-        return out;
-    };
+        // strip the comment and trim
+        const char* content_end = static_cast<const char*>(std::memchr(line_begin, ';', line_size));
+        if (content_end == nullptr)
+            content_end = line_end;
+        while (line_begin != content_end && (*line_begin == ' ' || *line_begin == '\t')) { ++line_begin; }
+        while (content_end != line_begin && (content_end[-1] == ' ' || content_end[-1] == '\t')) { --content_end; }
+        if (line_begin == content_end)
+            continue;
 
-    auto handle_rx_char = [&](uint8_t c) {
-        if (unbinarizing) {
-            if (full_char_queue > 0) {
-                handle_output_char(c);
-                if (char_buf > 0) {
-                    handle_output_char(char_buf);
-                    char_buf = 0;
-                }
-                --full_char_queue;
+        if (!m_binarizing) {
+            write_command(Command_EnablePacking);
+            m_binarizing = true;
+        }
+
+        // the line plus up to 6 added characters ("*255\n\n")
+        const size_t max_normalized_size = line_size + 6;
+        if (staged + max_normalized_size > staging_size) {
+            flush_staging();
+            if (max_normalized_size > staging_size) {
+                long_line_staging.resize(max_normalized_size);
+                staging = long_line_staging.data();
+                staging_size = long_line_staging.size();
             }
-            else {
-                std::array<uint8_t, 2> buf = { 0, 0 };
-                const uint8_t res = unpack_chars(c, buf);
-
-                if ((res & NextPackedFirst) != 0) {
-                    ++full_char_queue;
-                    if ((res & NextPackedSecond) != 0)
-                        ++full_char_queue;
-                    else
-                        char_buf = buf[1];
+        }
+        char* const normalized_begin = staging + staged;
+        char* normalized = normalized_begin;
+
+        const char* g = static_cast<const char*>(std::memchr(line_begin, 'G', content_end - line_begin));
+        if (g != nullptr && g + 1 < content_end && g[1] >= '0' && g[1] <= '9') {
+            // G line: uppercase the parameters, remove spaces, recompute the checksum, if any
+            bool has_checksum = false;
+            for (const char* c = normalize_gline(m_simd_level, line_begin, content_end, e_char, normalized); c != content_end; ++c) {
+                char ch = *c;
+                if (ch == ' ')
+                    continue;
+                if (ch == '*') {
+                    has_checksum = true;
+                    continue;
                 }
-                else {
-                    handle_output_char(buf[0]);
-                    if (buf[0] != '\n') {
-                        if ((res & NextPackedSecond) != 0)
-                            ++full_char_queue;
-                        else
-                            handle_output_char(buf[1]);
-                    }
+                if (ch == 'x')
+                    ch = 'X';
+                else if (ch == 'g')
+                    ch = 'G';
+                else if (ch == e_char)
+                    ch = 'E';
+                *normalized++ = ch;
+            }
+            if (has_checksum) {
+                uint8_t checksum = 0;
+                for (const char* c = normalized_begin; c != normalized; ++c) {
+                    checksum ^= static_cast<uint8_t>(*c);
                 }
+                *normalized++ = '*';
+                normalized = std::to_chars(normalized, normalized + 3, checksum).ptr;
             }
+            *normalized++ = '\n';
         }
-        else // Packing not enabled, just copy character to output
-            handle_output_char(c);
-    };
-
-    auto get_result_char = [&](std::array<char, 2>& chars_out) {
-        if (char_out_count > 0) {
-            const size_t res = char_out_count;
-            for (uint8_t i = 0; i < char_out_count; ++i) {
-                chars_out[i] = (char)char_out_buf[i];
-            }
-            char_out_count = 0;
-            return res;
+        else {
+            const size_t content_size = content_end - line_begin;
+            std::memcpy(normalized, line_begin, content_size);
+            normalized += content_size;
+            if (content_end[-1] != '\n')
+                *normalized++ = '\n';
         }
-        return (size_t)0;
-    };
+        if ((normalized - normalized_begin) % 2 != 0)
+            *normalized++ = '\n';
+        staged += normalized - normalized_begin;
+    }
 
-    std::vector<uint8_t> unbin_buffer(2 * src.size(), 0);
-    auto it_unbin_end = unbin_buffer.begin();
+    flush_staging();
+    dst.resize(out_pos);
+    finalize(dst);
+}
 
-    bool add_space = false;
+void MPBinarizer::append_command(unsigned char cmd, std::vector<uint8_t>& dst) {
+    dst.emplace_back(Command_SignalByte);
+    dst.emplace_back(Command_SignalByte);
+    dst.emplace_back(cmd);
+}
+
+// Decoding of a packed byte, when no full width character is pending
+struct UnpackedByte
+{
+    // characters to output
+    uint8_t size{ 0 };
+    std::array<char, 2> chars{};
+    // count of the full width characters following the byte
+    uint8_t full_chars{ 0 };
+    // character to output after the first full width character
+    char buffered{ 0 };
+};
 
-    auto begin = src.begin();
-    auto end = src.end();
+using UnpackTable = std::array<UnpackedByte, 256>;
 
-    auto it_bin = begin;
-    while (it_bin != end) {
-        uint8_t c_bin = *it_bin;
-        if (c_bin == Command_SignalByte) {
-            if (cmd_count > 0) {
-                cmd_active = true;
-                cmd_count = 0;
-            }
-            else
-              ++cmd_count;
+static constexpr char unpacked_char(uint8_t value, bool no_spaces)
+{
+    constexpr const char chars[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '.', ' ', '\n', 'G', 'X' };
+    return (value == 0b1011 && no_spaces) ? SpaceReplacedCharacter : chars[value];
+}
+
+static constexpr UnpackTable make_unpack_table(bool no_spaces)
+{
+    UnpackTable table{};
+    for (size_t i = 0; i < table.size(); ++i) {
+        const uint8_t low = i & 0xF;
+        const uint8_t high = (i >> 4) & 0xF;
+        UnpackedByte& entry = table[i];
+        if (low == 0xF) {
+            // the first character is full width, the second one is output after it
+            entry.full_chars = (high == 0xF) ? 2 : 1;
+            if (high != 0xF)
+                entry.buffered = unpacked_char(high, no_spaces);
         }
         else {
-            if (cmd_active) {
-                handle_command(c_bin);
-                cmd_active = false;
+            entry.chars[entry.size++] = unpacked_char(low, no_spaces);
+            // a packed new line ends the pair
+            if (entry.chars[0] != '\n') {
+                if (high == 0xF)
+                    entry.full_chars = 1;
+                else
+                    entry.chars[entry.size++] = unpacked_char(high, no_spaces);
             }
-            else {
-                if (cmd_count > 0) {
-                    handle_rx_char(Command_SignalByte);
-                    cmd_count = 0;
-                }
+        }
+    }
+    return table;
+}
 
-                handle_rx_char(c_bin);
-            }
+// Indexed by the state of the EnableNoSpaces command
+static constexpr const std::array<UnpackTable, 2> UnpackTables = { make_unpack_table(false), make_unpack_table(true) };
+
+// Parameters of the G lines which are separated by a space in the decoded output
+static constexpr std::array<bool, 256> make_gline_parameter_table()
+{
+    std::array<bool, 256> table{};
+    // G0, G1: XYZEF, G2, G3: IJR, G4: S, G29: GPWHCA
+    for (const char c : { 'X', 'Y', 'Z', 'E', 'F', 'I', 'J', 'R', 'S', 'G', 'P', 'W', 'H', 'C', 'A' }) {
+        table[static_cast<uint8_t>(c)] = true;
+    }
+    return table;
+}
+
+static constexpr const std::array<bool, 256> IsGLineParameter = make_gline_parameter_table();
+
+// Appends the given decoded character to out, returns the new end of the output.
+// GCodeReader::parse_line_internal() is unable to parse a G line where the data are not separated by spaces
+// so they are added where needed. Consecutive new lines are merged.
+static inline char* append_unpacked(char c, char* out, const char* out_begin, bool& add_space)
+{
+    const char prev = (out != out_begin) ? out[-1] : '\0';
+    if (c == '\n') {
+        add_space = false;
+        if (prev != '\n' || out == out_begin)
+            *out++ = c;
+        return out;
+    }
+    if (c == 'G' && (out == out_begin || prev == '\n'))
+        add_space = true;
+    else if (add_space && IsGLineParameter[static_cast<uint8_t>(c)] && (out == out_begin || prev != ' '))
+        *out++ = ' ';
+    *out++ = c;
+    return out;
+}
+
+static inline char* receive_char(UnpackState& state, uint8_t c, char* out)
+{
+    if (!state.unbinarizing)
+        // Packing not enabled, just copy character to output
+        *out++ = static_cast<char>(c);
+    else if (state.full_char_queue > 0) {
+        *out++ = static_cast<char>(c);
+        if (state.char_buf != 0) {
+            *out++ = state.char_buf;
+            state.char_buf = 0;
         }
+        --state.full_char_queue;
+    }
+    else {
+        const UnpackedByte& entry = UnpackTables[state.nospace_enabled ? 1 : 0][c];
+        out[0] = entry.chars[0];
+        out[1] = entry.chars[1];
+        out += entry.size;
+        state.full_char_queue = entry.full_chars;
+        state.char_buf = entry.buffered;
+    }
+    return out;
+}
 
-        auto is_gline_parameter = [](const char c) {
-            static const std::vector<char> parameters = {
-                // G0, G1
-                'X', 'Y', 'Z', 'E', 'F',
-                // G2, G3
-                'I', 'J', 'R',
-                // G4
-                'S',
-                // G29
-                'G', 'P', 'W', 'H', 'C', 'A'
-            };
-            return std::find(parameters.begin(), parameters.end(), c) != parameters.end();
-        };
-
-        std::array<char, 2> c_unbin{ 0, 0 };
-        const size_t char_count = get_result_char(c_unbin);
-        for (size_t i = 0; i < char_count; ++i) {
-            // GCodeReader::parse_line_internal() is unable to parse a G line where the data are not separated by spaces
-            // so we add them where needed
-            const size_t curr_unbin_buffer_length = std::distance(unbin_buffer.begin(), it_unbin_end);
-            bool new_line = false;
-            if (c_unbin[i] == 'G' && (curr_unbin_buffer_length == 0 || *std::prev(it_unbin_end, 1) == '\n')) {
-                add_space = true;
-                new_line = true;
+// Decodes the given byte into out, before the spaces insertion, returns the new end of the output
+static inline char* unpack_byte(UnpackState& state, uint8_t c, char* out)
+{
+    if (c == Command_SignalByte) {
+        if (state.cmd_count > 0) {
+            state.cmd_active = true;
+            state.cmd_count = 0;
+        }
+        else
+            ++state.cmd_count;
+    }
+    else if (state.cmd_active) {
+        switch (c)
+        {
+        case Command_EnablePacking:   { state.unbinarizing = true; break; }
+        case Command_DisablePacking:  { state.unbinarizing = false; break; }
+        case Command_EnableNoSpaces:  { state.nospace_enabled = true; break; }
+        case Command_DisableNoSpaces: { state.nospace_enabled = false; break; }
+        case Command_ResetAll:        { state.unbinarizing = false; break; }
+        default:
+        case Command_QueryConfig:     { break; }
+        }
+        state.cmd_active = false;
+    }
+    else {
+        if (state.cmd_count > 0) {
+            out = receive_char(state, Command_SignalByte, out);
+            state.cmd_count = 0;
+        }
+        out = receive_char(state, c, out);
+    }
+    return out;
+}
+
+//
+// Vectorized decoding, in two passes over blocks of the input:
+// - the runs of packed pairs not containing the 0b1111 nibble (thus no full width characters nor signal bytes)
+//   are expanded 16 (32) bytes at a time by looking up the characters of the nibbles with a byte shuffle.
+//   The second character of the pairs starting with a new line is removed with the compaction shuffle.
+//   The scalar code takes over at the first byte containing the 0b1111 nibble;
+// - the spaces between the G lines parameters are inserted 16 characters at a time: the lines, and the ones
+//   starting with a G command, are found from the masks of the new lines and of the 'G', and the spaces are
+//   inserted before the parameters with an expanding shuffle.
+//
+
+#if defined(BGCODE_SIMD_X86) || defined(BGCODE_SIMD_NEON)
+
+// Shuffle masks inserting a space before the lanes of 8 in the mask, and size of the result, indexed by the mask.
+// Source lanes: the 8 characters in 0..7, spaces in 8..15.
+struct InsertShuffleTable
+{
+    std::array<std::array<uint8_t, 16>, 256> masks{};
+    std::array<uint8_t, 256> sizes{};
+};
+
+static constexpr InsertShuffleTable make_insert_shuffle_table()
+{
+    InsertShuffleTable table;
+    for (size_t key = 0; key < 256; ++key) {
+        uint8_t size = 0;
+        for (uint8_t i = 0; i < 8; ++i) {
+            if ((key & (size_t(1) << i)) != 0)
+                table.masks[key][size++] = 8;
+            table.masks[key][size++] = i;
+        }
+        for (uint8_t i = size; i < 16; ++i) {
+            table.masks[key][i] = 0x80;
+        }
+        table.sizes[key] = size;
+    }
+    return table;
+}
+
+static constexpr const InsertShuffleTable InsertShuffle = make_insert_shuffle_table();
+
+// Nibble tables of the G lines parameters, all in the range 0x40..0x5F: indexed by the low nibble,
+// bit 0 is set if 0x4? is a parameter and bit 1 if 0x5? is, indexed by the high nibble, the bit to test
+static constexpr std::array<uint8_t, 16> make_parameter_low_nibble_table()
+{
+    std::array<uint8_t, 16> table{};
+    for (uint8_t i = 0; i < 16; ++i) {
+        table[i] = (IsGLineParameter[0x40 | i] ? 1 : 0) | (IsGLineParameter[0x50 | i] ? 2 : 0);
+    }
+    return table;
+}
+
+static constexpr const std::array<uint8_t, 16> ParameterLowNibble = make_parameter_low_nibble_table();
+static constexpr const std::array<uint8_t, 16> ParameterHighNibble = { 0, 0, 0, 0, 1, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+// Count of the output bytes which the vectorized decoding may write past the end of the output
+static constexpr const size_t UnpackOverrun = 64;
+
+// Computes the mask of the lanes where a space is inserted, from the masks of the new lines, of the 'G',
+// of the spaces and of the G lines parameters of 16 characters, and from the last output character, if any.
+// Returns false if some new line must be removed, which is left to the scalar code.
+static inline bool spaces_mask(unsigned int new_lines, unsigned int gs, unsigned int spaces, unsigned int parameters,
+    const char* out, const char* out_begin, bool& add_space, unsigned int& inserted)
+{
+    const bool empty = out == out_begin;
+    const char prev = empty ? '\0' : out[-1];
+    const unsigned int line_starts = ((new_lines << 1) | ((empty || prev == '\n') ? 1 : 0)) & 0xFFFF;
+    if ((new_lines & ((new_lines << 1) | ((!empty && prev == '\n') ? 1 : 0))) != 0)
+        return false;
+    const unsigned int commands = gs & line_starts;
+    // lanes preceded by a G command in the same line
+    unsigned int in_gline = 0;
+    unsigned int events = new_lines | commands;
+    unsigned int from = 0;
+    while (events != 0) {
+        const unsigned int lane = bgcode::core::count_trailing_zeros(events);
+        if (add_space)
+            in_gline |= ((1u << lane) - 1) & ~((1u << from) - 1);
+        add_space = ((commands >> lane) & 1) != 0;
+        from = lane + 1;
+        events &= events - 1;
+    }
+    if (add_space)
+        in_gline |= 0xFFFF & ~((1u << from) - 1);
+    inserted = parameters & ~commands & in_gline & ~((spaces << 1) | ((!empty && prev == ' ') ? 1 : 0));
+    return true;
+}
+
+#endif // BGCODE_SIMD_X86 || BGCODE_SIMD_NEON
+
+#if defined(BGCODE_SIMD_X86)
+
+// Expands the packed pairs at the begin of [begin, end) into out, returns the first byte not processed.
+// scalar_end is set to the end of the bytes to be processed by the scalar code before trying again.
+BGCODE_TARGET("ssse3")
+static const uint8_t* expand_ssse3(const uint8_t* begin, const uint8_t* end, char space_char, char*& out, const uint8_t*& scalar_end)
+{
+    const __m128i chars = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '.', space_char, '\n', 'G', 'X', 0);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i new_line = _mm_set1_epi8(0x0C);
+    const __m128i zero = _mm_setzero_si128();
+    for (; end - begin >= 16; begin += 16) {
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        const __m128i low = _mm_and_si128(b, nibble);
+        const __m128i high = _mm_and_si128(_mm_srli_epi16(b, 4), nibble);
+        const unsigned int full = static_cast<unsigned int>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(low, nibble), _mm_cmpeq_epi8(high, nibble))));
+        const unsigned int count = (full == 0) ? 16 : bgcode::core::count_trailing_zeros(full);
+        // groups of 4 bytes (8 characters)
+        const unsigned int groups = count / 4;
+        if (groups == 0) {
+            scalar_end = begin + count + 1;
+            return begin;
+        }
+        const __m128i low_chars = _mm_shuffle_epi8(chars, low);
+        const __m128i high_chars = _mm_shuffle_epi8(chars, high);
+        const __m128i halves[2] = { _mm_unpacklo_epi8(low_chars, high_chars), _mm_unpackhi_epi8(low_chars, high_chars) };
+        // the second character of the pairs starting with a new line is not output
+        const __m128i ends = _mm_cmpeq_epi8(low, new_line);
+        const unsigned int removed = static_cast<unsigned int>(_mm_movemask_epi8(_mm_unpacklo_epi8(zero, ends))) |
+            (static_cast<unsigned int>(_mm_movemask_epi8(_mm_unpackhi_epi8(zero, ends))) << 16);
+        if (removed == 0 && groups == 4) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), halves[0]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), halves[1]);
+            out += 32;
+            continue;
+        }
+        for (unsigned int g = 0; g < groups; ++g) {
+            const __m128i group = (g % 2 == 0) ? halves[g / 2] : _mm_srli_si128(halves[g / 2], 8);
+            const unsigned int key = (removed >> (8 * g)) & 0xFF;
+            const __m128i mask = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(CompactShuffle.masks[key].data()));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(group, mask));
+            out += CompactShuffle.sizes[key];
+        }
+        if (groups < 4) {
+            scalar_end = begin + count + 1;
+            return begin + 4 * groups;
+        }
+    }
+    scalar_end = end;
+    return begin;
+}
+
+BGCODE_TARGET("avx2")
+static const uint8_t* expand_avx2(const uint8_t* begin, const uint8_t* end, char space_char, char*& out, const uint8_t*& scalar_end)
+{
+    const __m256i chars = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '.', space_char, '\n', 'G', 'X', 0,
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '.', space_char, '\n', 'G', 'X', 0);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i new_line = _mm256_set1_epi8(0x0C);
+    const __m256i zero = _mm256_setzero_si256();
+    for (; end - begin >= 32; begin += 32) {
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        const __m256i low = _mm256_and_si256(b, nibble);
+        const __m256i high = _mm256_and_si256(_mm256_srli_epi16(b, 4), nibble);
+        const uint32_t full = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(low, nibble), _mm256_cmpeq_epi8(high, nibble))));
+        const unsigned int count = (full == 0) ? 32 : bgcode::core::count_trailing_zeros(full);
+        const unsigned int groups = count / 4;
+        if (groups == 0) {
+            scalar_end = begin + count + 1;
+            return begin;
+        }
+        const __m256i low_chars = _mm256_shuffle_epi8(chars, low);
+        const __m256i high_chars = _mm256_shuffle_epi8(chars, high);
+        // unpack works on the 128 bits lanes, restore the order of the characters
+        const __m256i unpacked_low = _mm256_unpacklo_epi8(low_chars, high_chars);
+        const __m256i unpacked_high = _mm256_unpackhi_epi8(low_chars, high_chars);
+        const __m256i halves[2] = { _mm256_permute2x128_si256(unpacked_low, unpacked_high, 0x20),
+            _mm256_permute2x128_si256(unpacked_low, unpacked_high, 0x31) };
+        const __m256i ends = _mm256_cmpeq_epi8(low, new_line);
+        const __m256i ends_low = _mm256_unpacklo_epi8(zero, ends);
+        const __m256i ends_high = _mm256_unpackhi_epi8(zero, ends);
+        const uint64_t removed = static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_permute2x128_si256(ends_low, ends_high, 0x20)))) |
+            (static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_permute2x128_si256(ends_low, ends_high, 0x31)))) << 32);
+        if (removed == 0 && groups == 8) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), halves[0]);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 32), halves[1]);
+            out += 64;
+            continue;
+        }
+        for (unsigned int g = 0; g < groups; ++g) {
+            const __m128i quarter = (g / 2 % 2 == 0) ? _mm256_castsi256_si128(halves[g / 4]) : _mm256_extracti128_si256(halves[g / 4], 1);
+            const __m128i group = (g % 2 == 0) ? quarter : _mm_srli_si128(quarter, 8);
+            const unsigned int key = static_cast<unsigned int>(removed >> (8 * g)) & 0xFF;
+            const __m128i mask = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(CompactShuffle.masks[key].data()));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(group, mask));
+            out += CompactShuffle.sizes[key];
+        }
+        if (groups < 8) {
+            scalar_end = begin + count + 1;
+            return begin + 4 * groups;
+        }
+    }
+    // avoid the penalty of mixing AVX and legacy SSE code
+    _mm256_zeroupper();
+    return expand_ssse3(begin, end, space_char, out, scalar_end);
+}
+
+// Inserts the spaces between the G lines parameters of the characters in [begin, end), writing into out,
+// returns the first character not processed
+BGCODE_TARGET("ssse3")
+static const char* insert_spaces_ssse3(const char* begin, const char* end, char*& out, const char* out_begin, bool& add_space)
+{
+    const __m128i new_line = _mm_set1_epi8('\n');
+    const __m128i g = _mm_set1_epi8('G');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i parameter_low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ParameterLowNibble.data()));
+    const __m128i parameter_high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ParameterHighNibble.data()));
+    for (; end - begin >= 16; begin += 16) {
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        const __m128i parameter = _mm_and_si128(_mm_shuffle_epi8(parameter_low, _mm_and_si128(c, nibble)),
+            _mm_shuffle_epi8(parameter_high, _mm_and_si128(_mm_srli_epi16(c, 4), nibble)));
+        const unsigned int parameters = ~static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(parameter, _mm_setzero_si128()))) & 0xFFFF;
+        const unsigned int new_lines = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(c, new_line)));
+        const unsigned int gs = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(c, g)));
+        const unsigned int spaces = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(c, space)));
+        unsigned int inserted;
+        if (!spaces_mask(new_lines, gs, spaces, parameters, out, out_begin, add_space, inserted)) {
+            for (const char* it = begin; it != begin + 16; ++it) {
+                out = append_unpacked(*it, out, out_begin, add_space);
             }
-            else if (c_unbin[i] == '\n')
-                add_space = false;
-
-            if (!new_line && add_space && (curr_unbin_buffer_length == 0 || *std::prev(it_unbin_end, 1) != ' ') &&
-                is_gline_parameter(c_unbin[i])) {
-                *it_unbin_end = ' ';
-                ++it_unbin_end;
-                if (it_unbin_end == unbin_buffer.end()) {
-                    // the buffer is not big enough, resize it
-                    unbin_buffer.resize(2 * unbin_buffer.size(), 0);
-                    it_unbin_end = unbin_buffer.begin() + curr_unbin_buffer_length + 1;
-                }
+            continue;
+        }
+        if (inserted == 0) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), c);
+            out += 16;
+            continue;
+        }
+        const unsigned int key_low = inserted & 0xFF;
+        const unsigned int key_high = inserted >> 8;
+        const __m128i mask_low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(InsertShuffle.masks[key_low].data()));
+        const __m128i mask_high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(InsertShuffle.masks[key_high].data()));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(_mm_unpacklo_epi64(c, space), mask_low));
+        out += InsertShuffle.sizes[key_low];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(_mm_unpackhi_epi64(c, space), mask_high));
+        out += InsertShuffle.sizes[key_high];
+    }
+    return begin;
+}
+
+#elif defined(BGCODE_SIMD_NEON)
+
+static inline unsigned int movemask_neon(uint8x16_t value)
+{
+    static const uint8_t lane_bits_data[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t bits = vandq_u8(value, vld1q_u8(lane_bits_data));
+    return static_cast<unsigned int>(vaddv_u8(vget_low_u8(bits))) | (static_cast<unsigned int>(vaddv_u8(vget_high_u8(bits))) << 8);
+}
+
+static const uint8_t* expand_neon(const uint8_t* begin, const uint8_t* end, char space_char, char*& out, const uint8_t*& scalar_end)
+{
+    const uint8_t chars_data[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '.', static_cast<uint8_t>(space_char), '\n', 'G', 'X', 0 };
+    const uint8x16_t chars = vld1q_u8(chars_data);
+    const uint8x16_t nibble = vdupq_n_u8(0x0F);
+    const uint8x16_t new_line = vdupq_n_u8(0x0C);
+    const uint8x16_t zero = vdupq_n_u8(0);
+    for (; end - begin >= 16; begin += 16) {
+        const uint8x16_t b = vld1q_u8(begin);
+        const uint8x16_t low = vandq_u8(b, nibble);
+        const uint8x16_t high = vshrq_n_u8(b, 4);
+        const unsigned int full = movemask_neon(vorrq_u8(vceqq_u8(low, nibble), vceqq_u8(high, nibble)));
+        const unsigned int count = (full == 0) ? 16 : bgcode::core::count_trailing_zeros(full);
+        const unsigned int groups = count / 4;
+        if (groups == 0) {
+            scalar_end = begin + count + 1;
+            return begin;
+        }
+        const uint8x16_t low_chars = vqtbl1q_u8(chars, low);
+        const uint8x16_t high_chars = vqtbl1q_u8(chars, high);
+        const uint8x16_t halves[2] = { vzip1q_u8(low_chars, high_chars), vzip2q_u8(low_chars, high_chars) };
+        const uint8x16_t ends = vceqq_u8(low, new_line);
+        const unsigned int removed = movemask_neon(vzip1q_u8(zero, ends)) | (movemask_neon(vzip2q_u8(zero, ends)) << 16);
+        if (removed == 0 && groups == 4) {
+            vst1q_u8(reinterpret_cast<uint8_t*>(out), halves[0]);
+            vst1q_u8(reinterpret_cast<uint8_t*>(out + 16), halves[1]);
+            out += 32;
+            continue;
+        }
+        for (unsigned int g = 0; g < groups; ++g) {
+            const uint8x8_t group = (g % 2 == 0) ? vget_low_u8(halves[g / 2]) : vget_high_u8(halves[g / 2]);
+            const unsigned int key = (removed >> (8 * g)) & 0xFF;
+            vst1_u8(reinterpret_cast<uint8_t*>(out), vtbl1_u8(group, vld1_u8(CompactShuffle.masks[key].data())));
+            out += CompactShuffle.sizes[key];
+        }
+        if (groups < 4) {
+            scalar_end = begin + count + 1;
+            return begin + 4 * groups;
+        }
+    }
+    scalar_end = end;
+    return begin;
+}
+
+static const char* insert_spaces_neon(const char* begin, const char* end, char*& out, const char* out_begin, bool& add_space)
+{
+    const uint8x16_t new_line = vdupq_n_u8('\n');
+    const uint8x16_t g = vdupq_n_u8('G');
+    const uint8x16_t space = vdupq_n_u8(' ');
+    const uint8x16_t nibble = vdupq_n_u8(0x0F);
+    const uint8x16_t parameter_low = vld1q_u8(ParameterLowNibble.data());
+    const uint8x16_t parameter_high = vld1q_u8(ParameterHighNibble.data());
+    for (; end - begin >= 16; begin += 16) {
+        const uint8x16_t c = vld1q_u8(reinterpret_cast<const uint8_t*>(begin));
+        const uint8x16_t parameter = vandq_u8(vqtbl1q_u8(parameter_low, vandq_u8(c, nibble)), vqtbl1q_u8(parameter_high, vshrq_n_u8(c, 4)));
+        const unsigned int parameters = movemask_neon(vtstq_u8(parameter, parameter));
+        const unsigned int new_lines = movemask_neon(vceqq_u8(c, new_line));
+        const unsigned int gs = movemask_neon(vceqq_u8(c, g));
+        const unsigned int spaces = movemask_neon(vceqq_u8(c, space));
+        unsigned int inserted;
+        if (!spaces_mask(new_lines, gs, spaces, parameters, out, out_begin, add_space, inserted)) {
+            for (const char* it = begin; it != begin + 16; ++it) {
+                out = append_unpacked(*it, out, out_begin, add_space);
             }
+            continue;
+        }
+        if (inserted == 0) {
+            vst1q_u8(reinterpret_cast<uint8_t*>(out), c);
+            out += 16;
+            continue;
+        }
+        const unsigned int key_low = inserted & 0xFF;
+        const unsigned int key_high = inserted >> 8;
+        vst1q_u8(reinterpret_cast<uint8_t*>(out), vqtbl1q_u8(vcombine_u8(vget_low_u8(c), vget_low_u8(space)), vld1q_u8(InsertShuffle.masks[key_low].data())));
+        out += InsertShuffle.sizes[key_low];
+        vst1q_u8(reinterpret_cast<uint8_t*>(out), vqtbl1q_u8(vcombine_u8(vget_high_u8(c), vget_low_u8(space)), vld1q_u8(InsertShuffle.masks[key_high].data())));
+        out += InsertShuffle.sizes[key_high];
+    }
+    return begin;
+}
 
-            if (c_unbin[i] != '\n' || std::distance(unbin_buffer.begin(), it_unbin_end) == 0 || *std::prev(it_unbin_end, 1) != '\n') {
-                *it_unbin_end = c_unbin[i];
-                ++it_unbin_end;
-                if (it_unbin_end == unbin_buffer.end()) {
-                    // the buffer is not big enough, resize it
-                    unbin_buffer.resize(2 * unbin_buffer.size(), 0);
-                    it_unbin_end = unbin_buffer.begin() + curr_unbin_buffer_length + 1;
-                }
+#endif // BGCODE_SIMD_NEON
+
+// Decodes [begin, end) into out, before the spaces insertion, returns the new end of the output
+static char* unpack_bytes(bgcode::core::ESimdLevel simd_level, UnpackState& state, const uint8_t* begin, const uint8_t* end, char* out)
+{
+    using bgcode::core::ESimdLevel;
+    // the vectorized code is tried again only after the byte which stopped it
+    const uint8_t* scalar_end = (simd_level == ESimdLevel::None) ? end : begin;
+    while (begin != end) {
+        if (begin >= scalar_end && state.packing()) {
+            const char space_char = state.nospace_enabled ? SpaceReplacedCharacter : ' ';
+            switch (simd_level)
+            {
+#if defined(BGCODE_SIMD_X86)
+            case ESimdLevel::AVX2:  { begin = expand_avx2(begin, end, space_char, out, scalar_end); break; }
+            case ESimdLevel::SSSE3: { begin = expand_ssse3(begin, end, space_char, out, scalar_end); break; }
+#elif defined(BGCODE_SIMD_NEON)
+            case ESimdLevel::NEON:  { begin = expand_neon(begin, end, space_char, out, scalar_end); break; }
+#endif
+            default:                { scalar_end = end; break; }
             }
+            continue;
         }
+        out = unpack_byte(state, *begin++, out);
+    }
+    return out;
+}
 
-        ++it_bin;
+// Inserts the spaces between the G lines parameters of the characters in [begin, end), writing into out,
+// returns the new end of the output
+static char* insert_spaces(bgcode::core::ESimdLevel simd_level, const char* begin, const char* end, char* out, const char* out_begin,
+    bool& add_space)
+{
+    using bgcode::core::ESimdLevel;
+    switch (simd_level)
+    {
+#if defined(BGCODE_SIMD_X86)
+    case ESimdLevel::AVX2:
+    case ESimdLevel::SSSE3: { begin = insert_spaces_ssse3(begin, end, out, out_begin, add_space); break; }
+#elif defined(BGCODE_SIMD_NEON)
+    case ESimdLevel::NEON:  { begin = insert_spaces_neon(begin, end, out, out_begin, add_space); break; }
+#endif
+    default:                { break; }
+    }
+    for (; begin != end; ++begin) {
+        out = append_unpacked(*begin, out, out_begin, add_space);
     }
+    return out;
+}
+
+void unbinarize(const std::vector<uint8_t>& src, std::string& dst)
+{
+    unbinarize(src, dst, bgcode::core::detect_simd_level());
+}
+
+// See for reference: https://github.com/scottmudge/Prusa-Firmware-MeatPack/blob/MK3_sm_MeatPack/Firmware/meatpack.cpp
+void unbinarize(const std::vector<uint8_t>& src, std::string& dst, bgcode::core::ESimdLevel simd_level)
+{
+    simd_level = bgcode::core::supported_simd_level(simd_level);
+
+    // every byte decodes into 2 characters at most, each one preceded by a space at most
+    const size_t out_start = dst.size();
+    dst.resize(out_start + 4 * src.size() + UnpackOverrun);
+    const char* const out_begin = dst.data() + out_start;
+    char* out = dst.data() + out_start;
 
-    dst.insert(dst.end(), unbin_buffer.begin(), it_unbin_end);
+    // the input is decoded in blocks, so that the decoded characters are still in cache for the spaces insertion
+    // the decoded characters waiting for the spaces insertion are kept on the stack
+    static constexpr const size_t BlockSize = 4096;
+    std::array<char, 2 * BlockSize + UnpackOverrun> unpacked;
+
+    UnpackState state;
+    bool add_space = false;
+    for (size_t begin = 0; begin < src.size(); begin += BlockSize) {
+        const size_t end = std::min(begin + BlockSize, src.size());
+        const char* unpacked_end = unpack_bytes(simd_level, state, src.data() + begin, src.data() + end, unpacked.data());
+        out = insert_spaces(simd_level, unpacked.data(), unpacked_end, out, out_begin, add_space);
+    }
+
+    dst.resize(out - dst.data());
+}
+
+MPUnbinarizer::MPUnbinarizer(bgcode::core::ESimdLevel simd_level)
+    : m_simd_level(bgcode::core::supported_simd_level(simd_level))
+    // the output starts with the last character written, followed by the decoded characters
+    , m_unpacked(2 * PieceSize + UnpackOverrun)
+    , m_output(1 + 4 * PieceSize + UnpackOverrun)
+{
+}
+
+bool MPUnbinarizer::unbinarize(const uint8_t* data, size_t size, bgcode::core::OutputSink& sink)
+{
+    for (size_t begin = 0; begin < size; begin += PieceSize) {
+        const size_t end = std::min(begin + PieceSize, size);
+        const char* unpacked_end = unpack_bytes(m_simd_level, m_state, data + begin, data + end, m_unpacked.data());
+        // the spaces insertion looks at the last character written, if any
+        m_output[0] = m_last_char;
+        char* const out_begin = m_output.data() + 1;
+        char* out = insert_spaces(m_simd_level, m_unpacked.data(), unpacked_end, out_begin,
+            m_written ? m_output.data() : out_begin, m_add_space);
+        if (out != out_begin) {
+            if (!sink.write(out_begin, out - out_begin))
+                return false;
+            m_last_char = out[-1];
+            m_written = true;
+        }
+    }
+    return true;
+}
+
+size_t MPByteUnbinarizer::unbinarize(uint8_t c, char* out)
+{
+    // the spaces insertion looks at the last character written, if any
+    std::array<char, 1 + MaxDecodedSize> buffer;
+    buffer[0] = m_last_char;
+    std::array<char, MaxDecodedSize / 2> unpacked;
+    const char* unpacked_end = unpack_byte(m_state, c, unpacked.data());
+    char* const out_begin = buffer.data() + 1;
+    char* buffer_end = out_begin;
+    for (const char* it = unpacked.data(); it != unpacked_end; ++it) {
+        buffer_end = append_unpacked(*it, buffer_end, m_written ? buffer.data() : out_begin, m_add_space);
+    }
+    const size_t size = buffer_end - out_begin;
+    if (size > 0) {
+        std::memcpy(out, out_begin, size);
+        m_last_char = buffer_end[-1];
+        m_written = true;
+    }
+    return size;
 }
 
 } //  namespace MeatPack
@@ -1,9 +1,15 @@
 #ifndef _BGCODE_BINARIZE_MEATPACK_HPP_
 #define _BGCODE_BINARIZE_MEATPACK_HPP_
 
+#include "binarize/export.h"
+#include "binarize/meatpack_byte_unbinarizer.hpp"
+#include "core/cpu_features.hpp"
+#include "core/core.hpp"
+
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <array>
 
 //
@@ -19,7 +25,7 @@ namespace MeatPack {
 static constexpr const uint8_t Flag_OmitWhitespaces{ 0x01 };
 static constexpr const uint8_t Flag_RemoveComments{ 0x02 };
 
-class MPBinarizer
+class BGCODE_BINARIZE_EXPORT MPBinarizer
 {
 public:
     explicit MPBinarizer(uint8_t flags = 0);
@@ -29,25 +35,55 @@ public:
 
     void binarize_line(const std::string& line, std::vector<uint8_t>& dst);
 
+    // Encodes a whole block of gcode lines and appends the result to dst.
+    // Same output of initialize(), binarize_line() for each line and finalize(), obtained in a single pass
+    // over the block, without temporary allocations but for the lines longer than 8 KiB.
+    void binarize(std::string_view src, std::vector<uint8_t>& dst);
+
+    // Vectorized code path used by binarize(), by default the best one supported by the CPU.
+    // Levels not supported by the CPU are lowered to a supported one.
+    void set_simd_level(bgcode::core::ESimdLevel level);
+
 private:
     unsigned char m_flags{ 0 };
     bool m_binarizing{ false };
+    bgcode::core::ESimdLevel m_simd_level{ bgcode::core::ESimdLevel::None };
+
+    void append_command(unsigned char cmd, std::vector<uint8_t>& dst);
+};
 
-    struct LookupTables
-    {
-        std::array<uint8_t, 256> packable;
-        std::array<uint8_t, 256> value;
-        bool initialized;
-        unsigned char flags;
-    };
+// Decoder of data received in chunks, as produced by the decompression of a block, writing the decoded text
+// to a sink. The working memory is bounded by PieceSize, independently of the size of the data.
+// The output is the same of unbinarize() applied to the whole data.
+class BGCODE_BINARIZE_EXPORT MPUnbinarizer
+{
+public:
+    // Count of the encoded bytes decoded at once
+    static constexpr const size_t PieceSize{ 1024 };
 
-    static LookupTables s_lookup_tables;
+    explicit MPUnbinarizer(bgcode::core::ESimdLevel simd_level = bgcode::core::detect_simd_level());
 
-    void append_command(unsigned char cmd, std::vector<uint8_t>& dst);
-    void initialize_lookup_tables();
+    MPUnbinarizer(const MPUnbinarizer&) = delete;
+    MPUnbinarizer& operator=(const MPUnbinarizer&) = delete;
+
+    // Decodes the given chunk, continuing from the previous ones, and writes the decoded text to sink.
+    // Returns false if the sink fails.
+    bool unbinarize(const uint8_t* data, size_t size, bgcode::core::OutputSink& sink);
+
+private:
+    UnpackState m_state;
+    bgcode::core::ESimdLevel m_simd_level{ bgcode::core::ESimdLevel::None };
+    bool m_add_space{ false };
+    bool m_written{ false };
+    // last character written to the sink
+    char m_last_char{ 0 };
+    std::vector<char> m_unpacked;
+    std::vector<char> m_output;
 };
 
-extern void unbinarize(const std::vector<uint8_t>& src, std::string& dst);
+extern BGCODE_BINARIZE_EXPORT void unbinarize(const std::vector<uint8_t>& src, std::string& dst);
+// Decodes using the given vectorized code path, lowered to one supported by the CPU
+extern BGCODE_BINARIZE_EXPORT void unbinarize(const std::vector<uint8_t>& src, std::string& dst, bgcode::core::ESimdLevel simd_level);
 
 } // namespace MeatPack
 
@@ -0,0 +1,52 @@
+#ifndef _BGCODE_BINARIZE_MEATPACK_BYTE_UNBINARIZER_HPP_
+#define _BGCODE_BINARIZE_MEATPACK_BYTE_UNBINARIZER_HPP_
+
+#include "binarize/export.h"
+
+#include <cstdint>
+#include <cstddef>
+
+//
+// MeatPack decoding of a byte at a time, for the embedded decoder profile.
+// This header must not depend on the standard containers, nor on the other headers of the library.
+//
+
+namespace MeatPack {
+
+// State of the decoder between two bytes
+struct UnpackState
+{
+    bool unbinarizing{ false };
+    bool nospace_enabled{ false };
+    bool cmd_active{ false };             // Is a command pending
+    char char_buf{ 0 };                   // Buffers a character if dealing with out-of-sequence pairs
+    uint8_t cmd_count{ 0 };               // Counts how many command bytes are received (need 2)
+    uint8_t full_char_queue{ 0 };         // Counts how many full-width characters are to be received
+
+    // Whether the next byte, if not a signal byte, is a packed pair
+    bool packing() const { return unbinarizing && !cmd_active && cmd_count == 0 && full_char_queue == 0; }
+};
+
+// Decoder of a byte at a time, without dynamic allocations, used by the embedded decoder profile.
+// The output is the same of unbinarize() applied to the whole data.
+class BGCODE_BINARIZE_EXPORT MPByteUnbinarizer
+{
+public:
+    // Maximum count of characters decoded from a byte
+    static constexpr const size_t MaxDecodedSize{ 8 };
+
+    // Decodes the given byte, continuing from the previous ones, writes the decoded characters into out,
+    // which must have room for MaxDecodedSize characters, and returns their count
+    size_t unbinarize(uint8_t c, char* out);
+
+private:
+    UnpackState m_state;
+    bool m_add_space{ false };
+    bool m_written{ false };
+    // last character decoded
+    char m_last_char{ 0 };
+};
+
+} // namespace MeatPack
+
+#endif // _BGCODE_BINARIZE_MEATPACK_BYTE_UNBINARIZER_HPP_
@@ -0,0 +1,424 @@
+#include "tokenpack.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace TokenPack {
+
+//
+// The encoded data start with the size of the decoded data, as unsigned LEB128 varint, followed by a sequence
+// of 4 bits symbols, the first one in the low nibble of each byte. The meaning of a symbol depends on the context:
+// - at the start of a line, a symbol from LineStartSymbols or Escape, meaning that the line starts with a
+//   symbol of the body context;
+// - in the body of a line, a symbol from BodySymbols or Escape followed by a symbol from SecondarySymbols,
+//   RawByte followed by a byte in 2 nibbles, or RawRun followed by the count of bytes minus 1 in 2 nibbles
+//   and the bytes, 2 nibbles each.
+// The new line of BodySymbols switches to the line start context.
+// The decoding ends when the size of the decoded data is reached, so it needs neither the whole data at once
+// nor an end marker: the only nibble allowed after it is the zero padding of the last byte.
+//
+
+static constexpr const uint8_t Escape{ 0xF };
+static constexpr const uint8_t RawRun{ 14 };
+static constexpr const uint8_t RawByte{ 15 };
+static constexpr const uint8_t NewLine{ 11 };
+static constexpr const size_t MaxRawRun{ 256 };
+
+// Most frequent line prefixes in PrusaSlicer output
+static constexpr const std::array<std::string_view, 15> LineStartSymbols = {
+    "G1 X", "G1 E", "G1 F", "G1 Z", "G1 Y", ";", "M204 P", "M73 P", "M73 Q", "G92 E", "G0 X", "G2 X", "G3 X", "M106 S", "M107"
+};
+
+// Numbers and the parameters of the extrusion moves
+static constexpr const std::array<std::string_view, 15> BodySymbols = {
+    "0", "1", "2", "3", "4", "5", "6", "7", "8", "9", ".", "\n", " X", " Y", " E"
+};
+
+static constexpr const std::array<std::string_view, 14> SecondarySymbols = {
+    " ", "-", " F", " Z", " P", " S", " R", " Q", " I", " J", " W", ";", "G", "M"
+};
+
+static constexpr const uint8_t NoSymbol{ 0xFF };
+// Bit set in the code of the secondary symbols
+static constexpr const uint8_t Secondary{ 0x10 };
+
+using CodeTable = std::array<uint8_t, 256>;
+
+// Codes of the symbols made of a single character
+static constexpr CodeTable make_char_codes()
+{
+    CodeTable table{};
+    for (uint8_t& code : table) {
+        code = NoSymbol;
+    }
+    for (uint8_t i = 0; i < BodySymbols.size(); ++i) {
+        if (BodySymbols[i].size() == 1)
+            table[static_cast<uint8_t>(BodySymbols[i][0])] = i;
+    }
+    for (uint8_t i = 0; i < SecondarySymbols.size(); ++i) {
+        if (SecondarySymbols[i].size() == 1)
+            table[static_cast<uint8_t>(SecondarySymbols[i][0])] = Secondary | i;
+    }
+    return table;
+}
+
+// Codes of the symbols made of a space followed by the character
+static constexpr CodeTable make_space_codes()
+{
+    CodeTable table{};
+    for (uint8_t& code : table) {
+        code = NoSymbol;
+    }
+    for (uint8_t i = 0; i < BodySymbols.size(); ++i) {
+        if (BodySymbols[i].size() == 2 && BodySymbols[i][0] == ' ')
+            table[static_cast<uint8_t>(BodySymbols[i][1])] = i;
+    }
+    for (uint8_t i = 0; i < SecondarySymbols.size(); ++i) {
+        if (SecondarySymbols[i].size() == 2 && SecondarySymbols[i][0] == ' ')
+            table[static_cast<uint8_t>(SecondarySymbols[i][1])] = Secondary | i;
+    }
+    return table;
+}
+
+static constexpr const CodeTable CharCodes = make_char_codes();
+static constexpr const CodeTable SpaceCodes = make_space_codes();
+
+// Unsigned LEB128
+static void append_varint(std::vector<uint8_t>& dst, uint32_t value)
+{
+    while (value >= 0x80) {
+        dst.emplace_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    dst.emplace_back((uint8_t)value);
+}
+
+static bool read_varint(const uint8_t*& begin, const uint8_t* end, uint32_t& value)
+{
+    value = 0;
+    for (uint32_t shift = 0; shift < 35; shift += 7) {
+        if (begin == end)
+            return false;
+        const uint8_t byte = *begin++;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+class NibbleWriter
+{
+public:
+    explicit NibbleWriter(std::vector<uint8_t>& dst) : m_dst(dst) {}
+
+    void put(uint8_t nibble) {
+        if (m_high)
+            m_dst.back() |= static_cast<uint8_t>(nibble << 4);
+        else
+            m_dst.emplace_back(nibble);
+        m_high = !m_high;
+    }
+
+    void put_byte(uint8_t byte) {
+        put(byte & 0xF);
+        put(byte >> 4);
+    }
+
+private:
+    std::vector<uint8_t>& m_dst;
+    bool m_high{ false };
+};
+
+// Returns the index of the line start symbol which src starts with, Escape if none
+static uint8_t match_line_start(const char* begin, const char* end)
+{
+    for (uint8_t i = 0; i < LineStartSymbols.size(); ++i) {
+        const std::string_view symbol = LineStartSymbols[i];
+        if (static_cast<size_t>(end - begin) >= symbol.size() && std::memcmp(begin, symbol.data(), symbol.size()) == 0)
+            return i;
+    }
+    return Escape;
+}
+
+void encode(std::string_view src, std::vector<uint8_t>& dst)
+{
+    append_varint(dst, static_cast<uint32_t>(src.size()));
+    // 4 bits for most of the characters
+    dst.reserve(dst.size() + src.size() / 2 + 1);
+    NibbleWriter writer(dst);
+
+    auto put_code = [&writer](uint8_t code) {
+        if ((code & Secondary) != 0) {
+            writer.put(Escape);
+            writer.put(code & 0xF);
+        }
+        else
+            writer.put(code);
+    };
+    // characters which are not the start of a symbol of the body context, or which are not worth a symbol
+    auto raw = [end = src.data() + src.size()](const char* c) {
+        const uint8_t code = CharCodes[static_cast<uint8_t>(*c)];
+        if (code != NoSymbol && (code & Secondary) == 0)
+            return false;
+        return *c != ' ' || c + 1 == end || SpaceCodes[static_cast<uint8_t>(c[1])] == NoSymbol;
+    };
+
+    const char* it = src.data();
+    const char* const end = src.data() + src.size();
+    bool line_start = true;
+    while (it != end) {
+        if (line_start) {
+            line_start = false;
+            const uint8_t symbol = match_line_start(it, end);
+            writer.put(symbol);
+            if (symbol != Escape) {
+                it += LineStartSymbols[symbol].size();
+                continue;
+            }
+        }
+
+        if (*it == ' ' && it + 1 != end) {
+            const uint8_t code = SpaceCodes[static_cast<uint8_t>(it[1])];
+            if (code != NoSymbol) {
+                put_code(code);
+                it += 2;
+                continue;
+            }
+        }
+
+        const uint8_t code = CharCodes[static_cast<uint8_t>(*it)];
+        if (code != NoSymbol) {
+            put_code(code);
+            line_start = (code == NewLine);
+            ++it;
+            continue;
+        }
+
+        // run of characters without a symbol, possibly continuing with characters with a secondary symbol
+        const char* run_end = it + 1;
+        while (run_end != end && static_cast<size_t>(run_end - it) < MaxRawRun && raw(run_end)) {
+            ++run_end;
+        }
+        writer.put(Escape);
+        if (run_end - it == 1)
+            writer.put(RawByte);
+        else {
+            writer.put(RawRun);
+            writer.put_byte(static_cast<uint8_t>(run_end - it - 1));
+        }
+        for (; it != run_end; ++it) {
+            writer.put_byte(static_cast<uint8_t>(*it));
+        }
+    }
+}
+
+// Decoding of a byte made of two symbols of the body context, the first one not being a new line
+struct SymbolPair
+{
+    bool valid{ false };
+    bool new_line{ false };
+    uint8_t size{ 0 };
+    std::array<char, 4> chars{};
+};
+
+static constexpr std::array<SymbolPair, 256> make_symbol_pairs()
+{
+    std::array<SymbolPair, 256> table{};
+    for (size_t i = 0; i < table.size(); ++i) {
+        const uint8_t low = i & 0xF;
+        const uint8_t high = (i >> 4) & 0xF;
+        if (low == Escape || high == Escape || low == NewLine)
+            continue;
+        SymbolPair& pair = table[i];
+        pair.valid = true;
+        pair.new_line = high == NewLine;
+        for (const std::string_view symbol : { BodySymbols[low], BodySymbols[high] }) {
+            for (const char c : symbol) {
+                pair.chars[pair.size++] = c;
+            }
+        }
+    }
+    return table;
+}
+
+static constexpr const std::array<SymbolPair, 256> SymbolPairs = make_symbol_pairs();
+
+// Room after the decoded data for the fixed size copies of the symbol pairs
+static constexpr const size_t Overrun = sizeof(SymbolPair::chars);
+// A byte decodes to 8 characters at most, a line start symbol followed by a symbol of the body context
+static constexpr const size_t MaxDecodedPerByte = 8;
+
+bool Decoder::write(const char* data, size_t size, char*& out)
+{
+    if (size > m_remaining)
+        return false;
+    std::memcpy(out, data, size);
+    out += size;
+    m_remaining -= static_cast<uint32_t>(size);
+    if (m_remaining == 0)
+        m_state = EState::End;
+    return true;
+}
+
+bool Decoder::decode_nibble(uint8_t nibble, bool high, char*& out)
+{
+    switch (m_state)
+    {
+    case EState::LineStart:
+    {
+        m_state = EState::Body;
+        if (nibble == Escape)
+            return true;
+        return write(LineStartSymbols[nibble].data(), LineStartSymbols[nibble].size(), out);
+    }
+    case EState::Body:
+    {
+        if (nibble == Escape) {
+            m_state = EState::Secondary;
+            return true;
+        }
+        m_state = (nibble == NewLine) ? EState::LineStart : EState::Body;
+        return write(BodySymbols[nibble].data(), BodySymbols[nibble].size(), out);
+    }
+    case EState::Secondary:
+    {
+        if (nibble < SecondarySymbols.size()) {
+            m_state = EState::Body;
+            return write(SecondarySymbols[nibble].data(), SecondarySymbols[nibble].size(), out);
+        }
+        m_raw_count = 1;
+        m_state = (nibble == RawRun) ? EState::RunCount : EState::Raw;
+        return true;
+    }
+    case EState::RunCount:
+    case EState::Raw:
+    {
+        if (!m_has_low) {
+            m_low = nibble;
+            m_has_low = true;
+            return true;
+        }
+        m_has_low = false;
+        const uint8_t byte = static_cast<uint8_t>(m_low | (nibble << 4));
+        if (m_state == EState::RunCount) {
+            m_raw_count = static_cast<uint16_t>(byte) + 1;
+            m_state = EState::Raw;
+            return true;
+        }
+        if (--m_raw_count == 0)
+            m_state = EState::Body;
+        return write(reinterpret_cast<const char*>(&byte), 1, out);
+    }
+    case EState::End:
+    {
+        // zero padding of the last byte
+        return high && nibble == 0;
+    }
+    default:
+    {
+        return false;
+    }
+    }
+}
+
+bool Decoder::decode_piece(const uint8_t* begin, const uint8_t* end, char*& out)
+{
+    const uint8_t* it = begin;
+    while (it != end) {
+        if (m_state == EState::Body) {
+            // two symbols at once
+            const SymbolPair& pair = SymbolPairs[*it];
+            if (pair.valid && pair.size < m_remaining) {
+                std::memcpy(out, pair.chars.data(), pair.chars.size());
+                out += pair.size;
+                m_remaining -= pair.size;
+                if (pair.new_line)
+                    m_state = EState::LineStart;
+                ++it;
+                continue;
+            }
+        }
+        else if (m_state == EState::Raw) {
+            // bytes of a raw run, but the last one and the one ending the decoded data, which change the state
+            const size_t count = std::min<size_t>({ static_cast<size_t>(m_raw_count) - 1, static_cast<size_t>(end - it),
+                static_cast<size_t>(m_remaining) - 1 });
+            if (count > 0) {
+                if (m_has_low) {
+                    // straddling two encoded bytes
+                    for (size_t i = 0; i < count; ++i) {
+                        out[i] = static_cast<char>(m_low | (it[i] << 4));
+                        m_low = it[i] >> 4;
+                    }
+                }
+                else
+                    std::memcpy(out, it, count);
+                out += count;
+                it += count;
+                m_raw_count -= static_cast<uint16_t>(count);
+                m_remaining -= static_cast<uint32_t>(count);
+                continue;
+            }
+        }
+        if (!decode_nibble(*it & 0xF, false, out) || !decode_nibble(*it >> 4, true, out))
+            return false;
+        ++it;
+    }
+    return true;
+}
+
+bool Decoder::decode(const uint8_t* data, size_t size, std::string& dst)
+{
+    const uint8_t* const end = data + size;
+    // size of the decoded data, which ends the decoding
+    while (m_state == EState::Size && data != end) {
+        const uint8_t byte = *data++;
+        m_remaining |= (uint32_t)(byte & 0x7F) << m_size_shift;
+        if ((byte & 0x80) == 0)
+            m_state = (m_remaining == 0) ? EState::End : EState::LineStart;
+        else {
+            m_size_shift += 7;
+            if (m_size_shift == 35)
+                return false;
+        }
+    }
+
+    while (data != end) {
+        const size_t piece_size = std::min<size_t>(end - data, PieceSize);
+        const size_t out_start = dst.size();
+        dst.resize(out_start + std::min<size_t>(MaxDecodedPerByte * piece_size, m_remaining) + Overrun);
+        char* out = dst.data() + out_start;
+        const bool ret = decode_piece(data, data + piece_size, out);
+        dst.resize(out - dst.data());
+        if (!ret)
+            return false;
+        data += piece_size;
+    }
+    return true;
+}
+
+bool Decoder::finish() const
+{
+    return m_state == EState::End;
+}
+
+bool decode(const std::vector<uint8_t>& src, std::string& dst)
+{
+    const size_t out_start = dst.size();
+    // the size stored at the beginning is trusted as far as the data can hold it
+    const uint8_t* begin = src.data();
+    const uint8_t* const end = src.data() + src.size();
+    uint32_t size;
+    if (read_varint(begin, end, size))
+        dst.reserve(out_start + std::min<size_t>(size, MaxDecodedPerByte * static_cast<size_t>(end - begin)) + Overrun);
+
+    Decoder decoder;
+    if (!decoder.decode(src.data(), src.size(), dst) || !decoder.finish()) {
+        dst.resize(out_start);
+        return false;
+    }
+    return true;
+}
+
+} // namespace TokenPack
@@ -0,0 +1,67 @@
+#ifndef _BGCODE_BINARIZE_TOKENPACK_HPP_
+#define _BGCODE_BINARIZE_TOKENPACK_HPP_
+
+#include "binarize/export.h"
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <string_view>
+
+//
+// Lossless nibble based encoding of G-code, in the spirit of MeatPack, with symbol tables built from the
+// frequencies of the characters and of the line prefixes in slicer output. A symbol stands for one or more
+// characters, depending on the context (start of a line or not). See doc/specifications.md for the format.
+//
+
+namespace TokenPack {
+
+// Encodes src and appends the result to dst
+extern BGCODE_BINARIZE_EXPORT void encode(std::string_view src, std::vector<uint8_t>& dst);
+
+// Decodes src and appends the result to dst. Returns false, leaving dst unchanged, if src is not a valid encoding.
+extern BGCODE_BINARIZE_EXPORT bool decode(const std::vector<uint8_t>& src, std::string& dst);
+
+// Decoder of the encoded data split into chunks of any size, which does not need the whole data at once
+class BGCODE_BINARIZE_EXPORT Decoder
+{
+public:
+    // Count of the encoded bytes decoded at once
+    static constexpr const size_t PieceSize{ 4096 };
+
+    // Decodes the given chunk, continuing from the previous ones, and appends the result to dst.
+    // Returns false if the data are not a valid encoding.
+    bool decode(const uint8_t* data, size_t size, std::string& dst);
+    // Returns false if the data decoded so far are not the whole encoded data
+    bool finish() const;
+
+private:
+    enum class EState : uint8_t
+    {
+        Size,
+        LineStart,
+        Body,
+        Secondary,
+        RunCount,
+        Raw,
+        End
+    };
+
+    EState m_state{ EState::Size };
+    uint8_t m_size_shift{ 0 };
+    // count of characters still to decode
+    uint32_t m_remaining{ 0 };
+    // count of bytes of the raw run still to decode
+    uint16_t m_raw_count{ 0 };
+    // low nibble of a byte of a raw run
+    bool m_has_low{ false };
+    uint8_t m_low{ 0 };
+
+    bool decode_piece(const uint8_t* begin, const uint8_t* end, char*& out);
+    bool decode_nibble(uint8_t nibble, bool high, char*& out);
+    bool write(const char* data, size_t size, char*& out);
+};
+
+} // namespace TokenPack
+
+#endif // _BGCODE_BINARIZE_TOKENPACK_HPP_
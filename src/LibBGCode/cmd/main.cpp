@@ -30,8 +30,8 @@ static const std::vector<Parameter> parameters = {
     { "printer_metadata_compression"sv, { "None"sv, "Deflate"sv, "Heatshrink_11_4"sv, "Heatshrink_12_4"sv }, (size_t)DefaultBinarizerConfig.compression.printer_metadata },
     { "slicer_metadata_compression"sv, { "None"sv, "Deflate"sv, "Heatshrink_11_4"sv, "Heatshrink_12_4"sv }, (size_t)DefaultBinarizerConfig.compression.slicer_metadata },
     { "gcode_compression"sv, { "None"sv, "Deflate"sv, "Heatshrink_11_4"sv, "Heatshrink_12_4"sv }, (size_t)DefaultBinarizerConfig.compression.gcode },
-    { "gcode_encoding"sv, { "None"sv, "MeatPack"sv, "MeatPackComments"sv }, (size_t)DefaultBinarizerConfig.gcode_encoding },
-    { "metadata_encoding"sv, { "INI"sv }, (size_t) DefaultBinarizerConfig.metadata_encoding }
+    { "gcode_encoding"sv, { "None"sv, "MeatPack"sv, "MeatPackComments"sv, "TokenPack"sv }, (size_t)DefaultBinarizerConfig.gcode_encoding },
+    { "metadata_encoding"sv, { "INI"sv, "Binary"sv }, (size_t) DefaultBinarizerConfig.metadata_encoding }
 };
 
 class ScopedFile
@@ -195,7 +195,13 @@ int main(int argc, const char* argv[])
     ScopedFile scoped_dst_file(dst_file);
 
     // Perform conversion
-    const EResult res = src_is_binary ? from_binary_to_ascii(*src_file, *dst_file, true) : from_ascii_to_binary(*src_file, *dst_file, config);
+#ifndef __EMSCRIPTEN__
+    // gcode blocks encoded or decoded on all the hardware threads
+    const size_t threads_count = 0;
+#else
+    const size_t threads_count = 1;
+#endif // __EMSCRIPTEN__
+    const EResult res = src_is_binary ? from_binary_to_ascii(*src_file, *dst_file, true, threads_count) : from_ascii_to_binary(*src_file, *dst_file, config, threads_count);
     if (res == EResult::Success) {
         if (!src_is_binary) {
             std::cout << "Binarization parameters\n";
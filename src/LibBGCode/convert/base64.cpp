@@ -0,0 +1,374 @@
+#include "base64.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(BGCODE_SIMD_X86)
+#include <immintrin.h>
+#elif defined(BGCODE_SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace bgcode {
+using namespace core;
+namespace convert {
+
+static constexpr const char Base64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Values of the base64 characters, 0xFF for the others, padding included
+static constexpr const std::array<uint8_t, 256> Base64Values = []() {
+    std::array<uint8_t, 256> values{};
+    for (uint8_t& value : values) {
+        value = 0xFF;
+    }
+    for (uint8_t i = 0; i < 64; ++i) {
+        values[static_cast<uint8_t>(Base64Alphabet[i])] = i;
+    }
+    return values;
+}();
+
+// Portable version, a group of 3 bytes at a time, then the trailing bytes with padding
+static size_t encode_scalar(const std::byte* src, size_t size, char* dst)
+{
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+    size_t written = 0;
+    size_t read = 0;
+    for (; read + 3 <= size; read += 3) {
+        const uint32_t bits = (uint32_t(in[read]) << 16) | (uint32_t(in[read + 1]) << 8) | uint32_t(in[read + 2]);
+        dst[written++] = Base64Alphabet[bits >> 18];
+        dst[written++] = Base64Alphabet[(bits >> 12) & 0x3F];
+        dst[written++] = Base64Alphabet[(bits >> 6) & 0x3F];
+        dst[written++] = Base64Alphabet[bits & 0x3F];
+    }
+    if (read < size) {
+        const uint32_t bits = (uint32_t(in[read]) << 16) | ((read + 1 < size) ? uint32_t(in[read + 1]) << 8 : 0);
+        dst[written++] = Base64Alphabet[bits >> 18];
+        dst[written++] = Base64Alphabet[(bits >> 12) & 0x3F];
+        dst[written++] = (read + 1 < size) ? Base64Alphabet[(bits >> 6) & 0x3F] : '=';
+        dst[written++] = '=';
+    }
+    return written;
+}
+
+// Portable version, a group of 4 characters at a time, then the trailing characters one by one
+static std::pair<size_t, size_t> decode_scalar(const char* src, size_t size, std::byte* dst)
+{
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+    size_t read = 0;
+    size_t written = 0;
+    for (; read + 4 <= size; read += 4) {
+        const uint32_t a = Base64Values[in[read]];
+        const uint32_t b = Base64Values[in[read + 1]];
+        const uint32_t c = Base64Values[in[read + 2]];
+        const uint32_t d = Base64Values[in[read + 3]];
+        if (((a | b | c | d) & 0x80) != 0)
+            break;
+        const uint32_t bits = (a << 18) | (b << 12) | (c << 6) | d;
+        dst[written++] = static_cast<std::byte>(bits >> 16);
+        dst[written++] = static_cast<std::byte>(bits >> 8);
+        dst[written++] = static_cast<std::byte>(bits);
+    }
+
+    // less than 4 characters are left before the end or the first invalid character
+    uint32_t bits = 0;
+    size_t count = 0;
+    for (; read < size; ++read, ++count) {
+        const uint32_t value = Base64Values[in[read]];
+        if (value == 0xFF)
+            break;
+        bits = (bits << 6) | value;
+    }
+    // the whole bytes of the 6 * count bits
+    bits <<= 6 * (4 - count);
+    for (size_t i = 1; i < count; ++i) {
+        dst[written++] = static_cast<std::byte>(bits >> (24 - 8 * i));
+    }
+    return { written, read };
+}
+
+#if defined(BGCODE_SIMD_X86)
+
+// Splits the first 12 bytes into the 6 bits indices of 16 characters (Mula, Lemire, "Faster Base64 Encoding and Decoding
+// using AVX2 Instructions"), each group of 3 bytes being spread over a 32 bits element
+BGCODE_TARGET("ssse3")
+static inline __m128i split_groups_ssse3(__m128i bytes)
+{
+    const __m128i in = _mm_shuffle_epi8(bytes, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+    const __m128i high = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+    const __m128i low = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(high, low);
+}
+
+// Translates the indices into the characters of the alphabet, adding the offset of the range of each index
+BGCODE_TARGET("ssse3")
+static inline __m128i to_chars_ssse3(__m128i indices)
+{
+    // 0 for [26, 51], 1 to 12 for [52, 63], 13 for [0, 25]
+    __m128i ranges = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    ranges = _mm_or_si128(ranges, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, ranges));
+}
+
+BGCODE_TARGET("ssse3")
+static size_t encode_blocks_ssse3(const std::byte* src, size_t size, char* dst)
+{
+    size_t read = 0;
+    // 12 bytes, loaded as 16, into 16 characters
+    for (; read + 16 <= size; read += 12) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + read));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + read / 3 * 4), to_chars_ssse3(split_groups_ssse3(bytes)));
+    }
+    return read;
+}
+
+BGCODE_TARGET("avx2")
+static size_t encode_blocks_avx2(const std::byte* src, size_t size, char* dst)
+{
+    const __m256i order = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                           1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t read = 0;
+    // 24 bytes, loaded as 12 into each lane, into 32 characters
+    for (; read + 28 <= size; read += 24) {
+        const __m128i low_bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + read));
+        const __m128i high_bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + read + 12));
+        const __m256i in = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(low_bytes), high_bytes, 1), order);
+        const __m256i high = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040));
+        const __m256i low = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(high, low);
+        __m256i ranges = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        ranges = _mm256_or_si256(ranges, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+        const __m256i chars = _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, ranges));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + read / 3 * 4), chars);
+    }
+    _mm256_zeroupper();
+    return read;
+}
+
+// Lookup tables indexed by the nibbles of the characters (Mula, Lemire, "Faster Base64 Encoding and Decoding using AVX2 Instructions"):
+// a character is invalid if the bits of its low and high nibble entries intersect, the offset which translates it
+// into its value is selected by its high nibble, '/' apart
+static constexpr const char LowNibbleBits[16] = { 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A };
+static constexpr const char HighNibbleBits[16] = { 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 };
+static constexpr const char ValueOffsets[16] = { 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+// Translates 16 characters into their values, returns false if any of them is invalid
+BGCODE_TARGET("ssse3")
+static inline bool translate_ssse3(__m128i& c)
+{
+    const __m128i low_nibbles = _mm_and_si128(c, _mm_set1_epi8(0x0F));
+    const __m128i high_nibbles = _mm_and_si128(_mm_srli_epi32(c, 4), _mm_set1_epi8(0x0F));
+    const __m128i low_bits = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(LowNibbleBits)), low_nibbles);
+    const __m128i high_bits = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(HighNibbleBits)), high_nibbles);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(low_bits, high_bits), _mm_setzero_si128())) != 0xFFFF)
+        return false;
+    const __m128i slashes = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+    const __m128i offsets = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ValueOffsets)), _mm_add_epi8(slashes, high_nibbles));
+    c = _mm_add_epi8(c, offsets);
+    return true;
+}
+
+// Packs the 6 bits values of each group of 4 bytes into 3 bytes, at the start of each 32 bits element
+BGCODE_TARGET("ssse3")
+static inline __m128i pack_groups_ssse3(__m128i values)
+{
+    const __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    return _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+}
+
+BGCODE_TARGET("ssse3")
+static size_t decode_blocks_ssse3(const char* src, size_t size, std::byte* dst)
+{
+    size_t read = 0;
+    // 16 characters into 12 bytes, stored as 16: the characters left after the block leave room for the others
+    for (; read + 24 <= size; read += 16) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + read));
+        if (!translate_ssse3(c))
+            break;
+        const __m128i bytes = _mm_shuffle_epi8(pack_groups_ssse3(c), _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + read / 4 * 3), bytes);
+    }
+    return read;
+}
+
+BGCODE_TARGET("avx2")
+static size_t decode_blocks_avx2(const char* src, size_t size, std::byte* dst)
+{
+    const __m256i low_lut = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(LowNibbleBits)));
+    const __m256i high_lut = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(HighNibbleBits)));
+    const __m256i offsets_lut = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ValueOffsets)));
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+    const __m256i bytes_order = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    size_t read = 0;
+    // 32 characters into 24 bytes, stored as 32: the characters left after the block leave room for the others
+    for (; read + 48 <= size; read += 32) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + read));
+        const __m256i high_nibbles = _mm256_and_si256(_mm256_srli_epi32(c, 4), nibble_mask);
+        const __m256i low_bits = _mm256_shuffle_epi8(low_lut, _mm256_and_si256(c, nibble_mask));
+        const __m256i high_bits = _mm256_shuffle_epi8(high_lut, high_nibbles);
+        if (!_mm256_testz_si256(low_bits, high_bits))
+            break;
+        const __m256i slashes = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'));
+        c = _mm256_add_epi8(c, _mm256_shuffle_epi8(offsets_lut, _mm256_add_epi8(slashes, high_nibbles)));
+        const __m256i pairs = _mm256_maddubs_epi16(c, _mm256_set1_epi32(0x01400140));
+        const __m256i groups = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+        // 12 bytes in each lane, moved next to each other
+        const __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(groups, bytes_order), _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + read / 4 * 3), bytes);
+    }
+    _mm256_zeroupper();
+    return read;
+}
+
+#elif defined(BGCODE_SIMD_NEON)
+
+static size_t encode_blocks_neon(const std::byte* src, size_t size, char* dst)
+{
+    uint8x16x4_t alphabet;
+    for (int i = 0; i < 4; ++i) {
+        alphabet.val[i] = vld1q_u8(reinterpret_cast<const uint8_t*>(Base64Alphabet) + 16 * i);
+    }
+    const uint8x16_t index_mask = vdupq_n_u8(0x3F);
+    size_t read = 0;
+    // 48 bytes, deinterleaved by position in the group, into 64 characters
+    for (; read + 48 <= size; read += 48) {
+        const uint8x16x3_t in = vld3q_u8(reinterpret_cast<const uint8_t*>(src + read));
+        uint8x16x4_t chars;
+        chars.val[0] = vqtbl4q_u8(alphabet, vshrq_n_u8(in.val[0], 2));
+        chars.val[1] = vqtbl4q_u8(alphabet, vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), index_mask));
+        chars.val[2] = vqtbl4q_u8(alphabet, vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), index_mask));
+        chars.val[3] = vqtbl4q_u8(alphabet, vandq_u8(in.val[2], index_mask));
+        vst4q_u8(reinterpret_cast<uint8_t*>(dst + read / 3 * 4), chars);
+    }
+    return read;
+}
+
+// Same lookup tables of the x86 version
+static constexpr const uint8_t LowNibbleBits[16] = { 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A };
+static constexpr const uint8_t HighNibbleBits[16] = { 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 };
+static constexpr const uint8_t ValueOffsets[16] = { 0, 16, 19, 4, 191, 191, 185, 185, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+// Translates 16 characters into their values, sets invalid to non zero if any of them is invalid
+static inline uint8x16_t translate_neon(uint8x16_t c, uint8x16_t& invalid)
+{
+    const uint8x16_t high_nibbles = vshrq_n_u8(c, 4);
+    const uint8x16_t low_bits = vqtbl1q_u8(vld1q_u8(LowNibbleBits), vandq_u8(c, vdupq_n_u8(0x0F)));
+    const uint8x16_t high_bits = vqtbl1q_u8(vld1q_u8(HighNibbleBits), high_nibbles);
+    invalid = vorrq_u8(invalid, vandq_u8(low_bits, high_bits));
+    const uint8x16_t slashes = vceqq_u8(c, vdupq_n_u8('/'));
+    return vaddq_u8(c, vqtbl1q_u8(vld1q_u8(ValueOffsets), vaddq_u8(slashes, high_nibbles)));
+}
+
+static size_t decode_blocks_neon(const char* src, size_t size, std::byte* dst)
+{
+    size_t read = 0;
+    // 64 characters, deinterleaved by position in the group, into 48 bytes
+    for (; read + 64 <= size; read += 64) {
+        const uint8x16x4_t c = vld4q_u8(reinterpret_cast<const uint8_t*>(src + read));
+        uint8x16_t invalid = vdupq_n_u8(0);
+        const uint8x16_t a = translate_neon(c.val[0], invalid);
+        const uint8x16_t b = translate_neon(c.val[1], invalid);
+        const uint8x16_t d = translate_neon(c.val[2], invalid);
+        const uint8x16_t e = translate_neon(c.val[3], invalid);
+        if (vmaxvq_u8(invalid) != 0)
+            break;
+        uint8x16x3_t bytes;
+        bytes.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+        bytes.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(d, 2));
+        bytes.val[2] = vorrq_u8(vshlq_n_u8(d, 6), e);
+        vst3q_u8(reinterpret_cast<uint8_t*>(dst + read / 4 * 3), bytes);
+    }
+    return read;
+}
+
+#endif // BGCODE_SIMD_NEON
+
+size_t base64_encode(const std::byte* src, size_t size, char* dst, ESimdLevel level)
+{
+    // blocks of whole groups, then the rest
+    size_t read = 0;
+    switch (level)
+    {
+#if defined(BGCODE_SIMD_X86)
+    case ESimdLevel::AVX2:  { read = encode_blocks_avx2(src, size, dst); break; }
+    case ESimdLevel::SSSE3: { read = encode_blocks_ssse3(src, size, dst); break; }
+#elif defined(BGCODE_SIMD_NEON)
+    case ESimdLevel::NEON:  { read = encode_blocks_neon(src, size, dst); break; }
+#endif
+    default: { break; }
+    }
+    const size_t written = read / 3 * 4;
+    return written + encode_scalar(src + read, size - read, dst + written);
+}
+
+size_t base64_encode_rows(const std::byte* src, size_t size, std::string_view prefix, size_t row_length, char* dst, ESimdLevel level)
+{
+    const size_t encoded_size = base64_encoded_size(size);
+    // characters of the group with the given index
+    auto encode_group = [&](size_t group, char* chars) {
+        encode_scalar(src + 3 * group, std::min<size_t>(3, size - 3 * group), chars);
+    };
+
+    char* out = dst;
+    // position into the encoded text
+    size_t pos = 0;
+    while (pos < encoded_size) {
+        const size_t row_end = std::min(pos + row_length, encoded_size);
+        std::memcpy(out, prefix.data(), prefix.size());
+        out += prefix.size();
+        // the whole groups of the row are encoded in place, the groups split between two rows apart
+        if (pos % 4 != 0) {
+            char chars[4];
+            encode_group(pos / 4, chars);
+            const size_t count = std::min(4 - pos % 4, row_end - pos);
+            std::memcpy(out, chars + pos % 4, count);
+            out += count;
+            pos += count;
+        }
+        const size_t groups_end = row_end - row_end % 4;
+        if (groups_end > pos) {
+            const size_t bytes_begin = pos / 4 * 3;
+            out += base64_encode(src + bytes_begin, std::min(size, groups_end / 4 * 3) - bytes_begin, out, level);
+            pos = groups_end;
+        }
+        if (pos < row_end) {
+            char chars[4];
+            encode_group(pos / 4, chars);
+            std::memcpy(out, chars, row_end - pos);
+            out += row_end - pos;
+            pos = row_end;
+        }
+        *out++ = '\n';
+    }
+    return out - dst;
+}
+
+std::pair<size_t, size_t> base64_decode(const char* src, size_t size, std::byte* dst, ESimdLevel level)
+{
+    // blocks of valid characters, then the rest
+    size_t read = 0;
+    switch (level)
+    {
+#if defined(BGCODE_SIMD_X86)
+    case ESimdLevel::AVX2:  { read = decode_blocks_avx2(src, size, dst); break; }
+    case ESimdLevel::SSSE3: { read = decode_blocks_ssse3(src, size, dst); break; }
+#elif defined(BGCODE_SIMD_NEON)
+    case ESimdLevel::NEON:  { read = decode_blocks_neon(src, size, dst); break; }
+#endif
+    default: { break; }
+    }
+    const size_t written = read / 4 * 3;
+    const auto [tail_written, tail_read] = decode_scalar(src + read, size - read, dst + written);
+    return { written + tail_written, read + tail_read };
+}
+
+} // namespace convert
+} // namespace bgcode
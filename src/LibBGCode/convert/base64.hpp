@@ -0,0 +1,52 @@
+#ifndef _BGCODE_CONVERT_BASE64_HPP_
+#define _BGCODE_CONVERT_BASE64_HPP_
+
+#include "convert/export.h"
+#include "core/cpu_features.hpp"
+
+#include <cstddef>
+#include <string_view>
+#include <utility>
+
+//
+// Vectorized base64 coding of the thumbnails, with the standard alphabet and padding.
+// Encoding spreads each group of 3 bytes over 4 lanes and translates the 6 bits indices by range.
+// Decoding translates blocks of characters with nibble indexed table lookups and validates them at the same time:
+// a block containing a padding or an invalid character is left to the scalar code.
+//
+
+namespace bgcode { namespace convert {
+
+// Size of the base64 encoding, with padding, of the given count of bytes
+constexpr size_t base64_encoded_size(size_t size) { return (size + 2) / 3 * 4; }
+
+// Size of the base64 encoding of the given count of bytes split into rows of row_length characters, the last one
+// possibly shorter, each one preceded by a prefix of prefix_size characters and followed by a new line
+constexpr size_t base64_rows_size(size_t size, size_t row_length, size_t prefix_size) {
+    const size_t encoded_size = base64_encoded_size(size);
+    return encoded_size + (encoded_size + row_length - 1) / row_length * (prefix_size + 1);
+}
+
+// Encodes the size bytes at src into dst, which must have room for base64_encoded_size(size) characters,
+// with the given instruction set extension, which must be supported by the running CPU (see core::supported_simd_level()).
+// Returns the count of characters written.
+extern BGCODE_CONVERT_EXPORT size_t base64_encode(const std::byte* src, size_t size, char* dst, core::ESimdLevel level);
+
+// As base64_encode(), writing the characters into rows as described by base64_rows_size(), which gives the room needed into dst
+extern BGCODE_CONVERT_EXPORT size_t base64_encode_rows(const std::byte* src, size_t size, std::string_view prefix, size_t row_length,
+    char* dst, core::ESimdLevel level);
+
+// Size of the buffer needed to decode the given count of base64 characters
+constexpr size_t base64_decoded_size(size_t size) { return (size + 3) / 4 * 3; }
+
+// Decodes the size base64 characters at src into dst, which must have room for base64_decoded_size(size) bytes,
+// with the given instruction set extension, which must be supported by the running CPU (see core::supported_simd_level()).
+// Decoding stops at the first padding or invalid character, the bits of a trailing incomplete group are decoded
+// into the whole bytes they contain (as boost::beast::detail::base64::decode()).
+// Returns the count of bytes written and the count of characters read.
+extern BGCODE_CONVERT_EXPORT std::pair<size_t, size_t> base64_decode(const char* src, size_t size, std::byte* dst,
+    core::ESimdLevel level);
+
+}} // bgcode::convert
+
+#endif // _BGCODE_CONVERT_BASE64_HPP_
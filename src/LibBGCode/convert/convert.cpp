@@ -1,12 +1,18 @@
 #include "convert.hpp"
+#include "base64.hpp"
+#include "line_scanner.hpp"
 #include "binarize/binarize.hpp"
-
-#include <boost/beast/core/detail/base64.hpp>
+#include "core/core_impl.hpp"
+#include "core/thread_pool.hpp"
 
 #include <optional>
-#include <functional>
+#include <algorithm>
+#include <array>
 #include <charconv>
 #include <memory>
+#include <cstring>
+#include <deque>
+#include <future>
 
 namespace bgcode {
 using namespace core;
@@ -18,139 +24,109 @@ class GCodeReader
 public:
     struct GCodeLine
     {
-        std::string raw;
-        void reset() { raw.clear(); }
+        // line without the end of line characters, truncated at the first null character, if any
+        std::string_view raw;
+        // raw without the blanks at both ends and, for comments, without the comment mark (see line_content())
+        std::string_view content;
     };
 
-    GCodeReader(FILE& file) : m_file(file) {}
-
-    typedef std::function<void(GCodeReader&, const GCodeLine&)> ParseLineCallback;
-    typedef std::function<void(const char*, const char*)> InternalParseLineCallback;
+    // head: data already read from the file, parsed before the rest of it
+    explicit GCodeReader(FILE& file, std::string_view head = std::string_view()) : m_file(&file), m_head(head) {}
+    // Reads the given data, such as a mapped file, which must outlive the parsing
+    explicit GCodeReader(std::string_view data) : m_data(data) {}
 
+    // Calls callback(GCodeReader&, const GCodeLine&) for each line of the file.
+    // The line points into the read buffer, valid only during the call: lines are copied only if split between two reads.
+    // Lines of data in memory are never copied.
     // Returns false if reading the file failed.
-    bool parse(ParseLineCallback callback) {
-        GCodeLine gline;
+    template<typename Callback>
+    bool parse(Callback&& callback) {
         m_parsing = true;
-        return parse_internal([this, &gline, callback](const char* begin, const char* end) {
-              gline.reset();
-              parse_line(begin, end, gline, callback);
-        });
-    }
-
-    void quit_parsing() { m_parsing = false; }
-
-private:
-    FILE& m_file;
-    bool m_parsing{ false };
+        if (m_file == nullptr) {
+            const char* const end = m_data.data() + m_data.size();
+            const char* it = scan_lines(m_data.data(), end, m_simd_level, [this, &callback](std::string_view raw, std::string_view content) {
+                callback(*this, GCodeLine{ raw, content });
+                return m_parsing;
+            });
+            if (m_parsing && it != end) {
+                // the last line is not terminated
+                std::string_view raw(it, end - it);
+                raw = raw.substr(0, raw.find('\0'));
+                callback(*this, GCodeLine{ raw, line_content(raw) });
+            }
+            m_parsing = false;
+            return true;
+        }
 
-    bool parse_internal(InternalParseLineCallback parse_line_callback) {
-        // Read the input stream 64kB at a time, extract lines and process them.
-        std::vector<char> buffer(65536 * 10, 0);
-        // Line buffer.
-        std::string gcode_line;
-        size_t file_pos = 0;
+        // Read the input stream 640kB at a time, extract lines and process them.
+        std::vector<char> buffer(65536 * 10);
+        // Start of the line not terminated at the end of the previous read.
+        std::string partial_line;
+        // The previous read ended with a '\r', which may be followed by a '\n' of the same end of line.
+        bool pending_cr = false;
+        auto parse_partial_line = [&]() {
+            const std::string_view raw(partial_line.c_str());
+            callback(*this, GCodeLine{ raw, line_content(raw) });
+            partial_line.clear();
+        };
         for (;;) {
-            size_t cnt_read = ::fread(buffer.data(), 1, buffer.size(), &m_file);
-            if (::ferror(&m_file)) {
+            const size_t head_size = std::min(m_head.size(), buffer.size());
+            std::memcpy(buffer.data(), m_head.data(), head_size);
+            m_head.erase(0, head_size);
+            const size_t cnt_read = head_size + ::fread(buffer.data() + head_size, 1, buffer.size() - head_size, m_file);
+            if (::ferror(m_file)) {
                 m_parsing = false;
                 return false;
             }
-            bool eof = cnt_read == 0;
-            auto it = buffer.begin();
-            auto it_bufend = buffer.begin() + cnt_read;
-            while (it != it_bufend || (eof && !gcode_line.empty())) {
-                // Find end of line.
-                bool eol = false;
-                auto it_end = it;
-                for (; it_end != it_bufend && !(eol = *it_end == '\r' || *it_end == '\n'); ++it_end)
-                    ; // silence -Wempty-body
-                // End of line is indicated also if end of file was reached.
-                eol |= eof && it_end == it_bufend;
-                if (eol) {
-                    if (gcode_line.empty())
-                        parse_line_callback(&(*it), &(*it_end));
-                    else {
-                        gcode_line.insert(gcode_line.end(), it, it_end);
-                        parse_line_callback(gcode_line.c_str(), gcode_line.c_str() + gcode_line.size());
-                        gcode_line.clear();
-                    }
-                    if (!m_parsing)
-                        // The callback wishes to exit.
-                        return true;
-                }
-                else
-                    gcode_line.insert(gcode_line.end(), it, it_end);
+            if (cnt_read == 0) {
+                // End of file, the last line may be not terminated.
+                if (!partial_line.empty())
+                    parse_partial_line();
+                break;
+            }
+
+            const char* it = buffer.data();
+            const char* const it_bufend = it + cnt_read;
+            if (pending_cr && *it == '\n')
+                ++it;
+            pending_cr = false;
+            if (!partial_line.empty()) {
+                const char* const it_end = std::find_if(it, it_bufend, [](char c) { return c == '\r' || c == '\n'; });
+                partial_line.append(it, it_end);
+                if (it_end == it_bufend)
+                    continue;
+                parse_partial_line();
+                if (!m_parsing)
+                    // The callback wishes to exit.
+                    return true;
                 // Skip EOL.
-                it = it_end;
-                if (it != it_bufend && *it == '\r')
-                    ++it;
-                if (it != it_bufend && *it == '\n')
+                it = it_end + 1;
+                if (*it_end == '\r' && it != it_bufend && *it == '\n')
                     ++it;
             }
-            if (eof)
-                break;
-            file_pos += cnt_read;
+            it = scan_lines(it, it_bufend, m_simd_level, [this, &callback](std::string_view raw, std::string_view content) {
+                callback(*this, GCodeLine{ raw, content });
+                return m_parsing;
+            });
+            if (!m_parsing)
+                // The callback wishes to exit.
+                return true;
+            // a '\r' ending the data is always the end of a line
+            pending_cr = it == it_bufend && it_bufend[-1] == '\r';
+            partial_line.assign(it, it_bufend);
         }
         m_parsing = false;
         return true;
     }
 
-    const char* parse_line(const char* ptr, const char* end, GCodeLine& gline, ParseLineCallback callback) {
-        std::pair<const char*, const char*> cmd;
-        const char* line_end = parse_line_internal(ptr, end, gline, cmd);
-        callback(*this, gline);
-        return line_end;
-    }
-
-    const char* parse_line_internal(const char* ptr, const char* end, GCodeLine& gline, std::pair<const char*, const char*>& command) {
-        // command and args
-        const char* c = ptr;
-        {
-            // Skip the whitespaces.
-            command.first = skip_whitespaces(c);
-            // Skip the command.
-            c = command.second = skip_word(command.first);
-            // Up to the end of line or comment.
-            while (!is_end_of_gcode_line(*c)) {
-                // Skip whitespaces.
-                c = skip_whitespaces(c);
-                if (is_end_of_gcode_line(*c))
-                    break;
-                // Skip the rest of the word.
-                c = skip_word(c);
-            }
-        }
-
-        // Skip the rest of the line.
-        for (; !is_end_of_line(*c); ++c);
-
-        // Copy the raw string including the comment, without the trailing newlines.
-        if (c > ptr)
-            gline.raw.assign(ptr, c);
-
-        // Skip the trailing newlines.
-        if (*c == '\r')
-            ++c;
-        if (*c == '\n')
-            ++c;
-
-        return c;
-    }
+    void quit_parsing() { m_parsing = false; }
 
-    static bool        is_whitespace(char c) { return c == ' ' || c == '\t'; }
-    static bool        is_end_of_line(char c) { return c == '\r' || c == '\n' || c == 0; }
-    static bool        is_end_of_gcode_line(char c) { return c == ';' || is_end_of_line(c); }
-    static bool        is_end_of_word(char c) { return is_whitespace(c) || is_end_of_gcode_line(c); }
-    static const char* skip_whitespaces(const char* c) {
-        for (; is_whitespace(*c); ++c)
-            ; // silence -Wempty-body
-        return c;
-    }
-    static const char* skip_word(const char* c) {
-        for (; !is_end_of_word(*c); ++c)
-            ; // silence -Wempty-body
-        return c;
-    }
+private:
+    FILE* m_file{ nullptr };
+    std::string m_head;
+    std::string_view m_data;
+    bool m_parsing{ false };
+    ESimdLevel m_simd_level{ detect_simd_level() };
 };
 
 static std::string_view trim(const std::string_view& str)
@@ -172,6 +148,174 @@ static std::string_view uncomment(const std::string_view& str)
     return (!str.empty() && str[0] == ';') ? trim(str.substr(1)) : str;
 }
 
+// Lines made only of whitespaces, possibly commented out, are removed from the ascii output
+static bool is_empty_line(std::string_view line)
+{
+    return uncomment(trim(line)).empty();
+}
+
+// Sink forwarding to another sink the lines which are not empty, used for the decoded gcode blocks.
+// Consecutive lines are forwarded with a single write, lines split between writes are the only ones copied.
+// The empty lines are found on the masks of the characters computed by classify_chars().
+class NonEmptyLinesSink : public OutputSink
+{
+public:
+    explicit NonEmptyLinesSink(OutputSink& sink) : m_sink(sink) {}
+
+    bool write(const void* data, size_t data_size) override {
+        const char* begin = static_cast<const char*>(data);
+        const char* const end = begin + data_size;
+        if (!m_partial_line.empty()) {
+            const char* line_end = static_cast<const char*>(memchr(begin, '\n', end - begin));
+            if (line_end == nullptr) {
+                // incomplete line, wait for more data
+                m_partial_line.append(begin, end);
+                return true;
+            }
+            m_partial_line.append(begin, line_end + 1);
+            if (!is_empty_line(std::string_view(m_partial_line.data(), m_partial_line.size() - 1)) &&
+                !m_sink.write(m_partial_line.data(), m_partial_line.size()))
+                return false;
+            m_partial_line.clear();
+            begin = line_end + 1;
+        }
+
+        m_run_begin = begin;
+        m_line_begin = begin;
+        m_non_blanks_count = 0;
+        CharMasks batch[ScanBatchSize];
+        for (const char* batch_begin = begin; batch_begin < end; batch_begin += ScanBatchSize * ScanWindowSize) {
+            const size_t windows_count = std::min<size_t>(ScanBatchSize, (end - batch_begin) / ScanWindowSize);
+            classify_chars(batch_begin, windows_count, batch, m_simd_level);
+            for (size_t w = 0; w < windows_count; ++w) {
+                if (!scan_window(batch_begin + w * ScanWindowSize, batch[w], ~uint64_t(0)))
+                    return false;
+            }
+            const char* tail = batch_begin + windows_count * ScanWindowSize;
+            if (windows_count < ScanBatchSize && tail < end &&
+                !scan_window(tail, classify_tail(tail, end, m_simd_level), (uint64_t(1) << (end - tail)) - 1))
+                return false;
+        }
+        // incomplete line, wait for more data
+        m_partial_line.assign(m_line_begin, end);
+        return forward(m_run_begin, m_line_begin);
+    }
+
+    long tell() const override { return m_sink.tell(); }
+
+    // Forwards the last line of a block, if not empty and not terminated by a new line, adding the new line
+    bool end_block() {
+        bool ret = true;
+        if (!is_empty_line(m_partial_line)) {
+            m_partial_line.push_back('\n');
+            ret = m_sink.write(m_partial_line.data(), m_partial_line.size());
+        }
+        m_partial_line.clear();
+        return ret;
+    }
+
+private:
+    OutputSink& m_sink;
+    std::string m_partial_line;
+    ESimdLevel m_simd_level{ detect_simd_level() };
+    // start of the lines not yet forwarded, and of the current line, in the data passed to write()
+    const char* m_run_begin{ nullptr };
+    const char* m_line_begin{ nullptr };
+    // count of the non blank characters of the current line, 2 meaning 2 or more, and whether the first one
+    // is the comment mark: the line is empty if it has none, or only the comment mark
+    unsigned int m_non_blanks_count{ 0 };
+    bool m_comment{ false };
+
+    bool forward(const char* begin, const char* end) {
+        return begin == end || m_sink.write(begin, end - begin);
+    }
+
+    // Forwards the lines ended in the given window, but the empty ones, valid are the bits of the characters in the data
+    bool scan_window(const char* window, const CharMasks& masks, uint64_t valid) {
+        uint64_t new_lines = masks.new_lines & valid;
+        const uint64_t non_blanks = ~(masks.blanks | masks.new_lines) & valid;
+        // characters of the previous lines in this window
+        uint64_t segment_begin = 0;
+        for (;;) {
+            const uint64_t new_line_bit = new_lines & (~new_lines + 1);
+            const uint64_t line_non_blanks = non_blanks & (new_line_bit - 1) & ~segment_begin;
+            if (line_non_blanks != 0 && m_non_blanks_count < 2) {
+                if (m_non_blanks_count == 0)
+                    m_comment = (masks.comments & line_non_blanks & (~line_non_blanks + 1)) != 0;
+                m_non_blanks_count += ((line_non_blanks & (line_non_blanks - 1)) != 0) ? 2 : 1;
+            }
+            if (new_lines == 0)
+                return true;
+
+            const char* line_end = window + count_trailing_zeros(new_lines) + 1;
+            if (m_non_blanks_count == 0 || (m_non_blanks_count == 1 && m_comment)) {
+                if (!forward(m_run_begin, m_line_begin))
+                    return false;
+                m_run_begin = line_end;
+            }
+            m_line_begin = line_end;
+            m_non_blanks_count = 0;
+            new_lines &= new_lines - 1;
+            segment_begin = (new_line_bit << 1) - 1;
+        }
+    }
+};
+
+// Sink collecting the ascii output into a reusable buffer, forwarded to another sink when full, so that the many small
+// pieces of the output (metadata lines, runs of non empty lines) cost a copy into the buffer and not a write each.
+// Data bigger than the buffer are forwarded directly.
+class AsciiWriter : public OutputSink
+{
+public:
+    static constexpr const size_t DefaultBufferSize{ 256 * 1024 };
+
+    explicit AsciiWriter(OutputSink& sink, size_t buffer_size = DefaultBufferSize) : m_sink(sink), m_buffer(buffer_size) {}
+
+    bool write(const void* data, size_t data_size) override {
+        if (m_buffer_used + data_size > m_buffer.size()) {
+            if (!forward())
+                return false;
+            if (data_size >= m_buffer.size())
+                return m_sink.write(data, data_size);
+        }
+        std::memcpy(m_buffer.data() + m_buffer_used, data, data_size);
+        m_buffer_used += data_size;
+        return true;
+    }
+
+    // Appends the given pieces of text
+    template<typename... Pieces>
+    bool append(const Pieces&... pieces) {
+        return (write_piece(std::string_view(pieces)) && ...);
+    }
+
+    // Writes at most max_size characters in place, through fill(char* dst), which returns the count of characters written.
+    // max_size must not be larger than the buffer.
+    template<typename Fill>
+    bool write_in_place(size_t max_size, Fill&& fill) {
+        if (m_buffer_used + max_size > m_buffer.size() && !forward())
+            return false;
+        m_buffer_used += fill(m_buffer.data() + m_buffer_used);
+        return true;
+    }
+
+    bool flush() override { return forward() && m_sink.flush(); }
+    long tell() const override { return m_sink.tell() + static_cast<long>(m_buffer_used); }
+
+private:
+    OutputSink& m_sink;
+    std::vector<char> m_buffer;
+    size_t m_buffer_used{ 0 };
+
+    bool write_piece(std::string_view piece) { return write(piece.data(), piece.size()); }
+
+    bool forward() {
+        const bool ret = m_buffer_used == 0 || m_sink.write(m_buffer.data(), m_buffer_used);
+        m_buffer_used = 0;
+        return ret;
+    }
+};
+
 template<typename Integer>
 static void to_int(const std::string_view& str, Integer& out) {
     const std::from_chars_result result = std::from_chars(str.data(), str.data() + str.size(), out);
@@ -179,7 +323,113 @@ static void to_int(const std::string_view& str, Integer& out) {
         out = 0;
 }
 
+// Set of keys, built at compile time, finding which one of them starts a string with a single walk of the string
+// characters, and no allocation. No key must be a prefix of another one.
+template<size_t NodesCount>
+class KeysTrie
+{
+public:
+    static constexpr const size_t NoKey{ 0xFF };
+
+    template<size_t KeysCount>
+    constexpr explicit KeysTrie(const std::array<std::string_view, KeysCount>& keys) {
+        static_assert(KeysCount < NoKey, "Too many keys");
+        for (size_t k = 0; k < KeysCount; ++k) {
+            uint16_t node = 0;
+            for (const char c : keys[k]) {
+                if (m_nodes[node].key != NoKey)
+                    m_valid = false;
+                uint16_t child = find_child(node, c);
+                if (child == 0) {
+                    child = m_nodes_count++;
+                    m_nodes[child].c = c;
+                    if (node == 0)
+                        m_root_children[static_cast<uint8_t>(c)] = child;
+                    else {
+                        m_nodes[child].next_sibling = m_nodes[node].first_child;
+                        m_nodes[node].first_child = child;
+                    }
+                }
+                node = child;
+            }
+            if (node == 0 || m_nodes[node].key != NoKey || m_nodes[node].first_child != 0)
+                m_valid = false;
+            m_nodes[node].key = static_cast<uint8_t>(k);
+        }
+    }
+
+    // Index of the key the given string starts with, NoKey if none
+    constexpr size_t find(std::string_view str) const {
+        uint16_t node = 0;
+        for (const char c : str) {
+            node = find_child(node, c);
+            if (node == 0)
+                return NoKey;
+            if (m_nodes[node].key != NoKey)
+                return m_nodes[node].key;
+        }
+        return NoKey;
+    }
+
+    // Whether the keys are not empty, distinct, and none of them is a prefix of another one
+    constexpr bool is_valid() const { return m_valid; }
+
+private:
+    struct Node
+    {
+        char c{ 0 };
+        uint8_t key{ NoKey };
+        // 0 for none, the root is never a child
+        uint16_t first_child{ 0 };
+        uint16_t next_sibling{ 0 };
+    };
+    static_assert(NodesCount <= 0xFFFF, "Too many nodes");
+
+    // the children of the root, the most searched, are indexed by character
+    std::array<uint16_t, 256> m_root_children{};
+    std::array<Node, NodesCount> m_nodes{};
+    uint16_t m_nodes_count{ 1 };
+    bool m_valid{ true };
+
+    constexpr uint16_t find_child(uint16_t node, char c) const {
+        if (node == 0)
+            return m_root_children[static_cast<uint8_t>(c)];
+        uint16_t child = m_nodes[node].first_child;
+        while (child != 0 && m_nodes[child].c != c) {
+            child = m_nodes[child].next_sibling;
+        }
+        return child;
+    }
+};
+
+// Count of the nodes of the trie of the given keys, at most
+template<size_t KeysCount>
+static constexpr size_t trie_nodes_count(const std::array<std::string_view, KeysCount>& keys)
+{
+    size_t count = 1;
+    for (const std::string_view& key : keys) {
+        count += key.size();
+    }
+    return count;
+}
+
 BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, FILE& dst_file, const BinarizerConfig& config)
+{
+    return from_ascii_to_binary(src_file, dst_file, config, 1);
+}
+
+BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, OutputSink& dst_sink, const BinarizerConfig& config)
+{
+    return from_ascii_to_binary(src_file, dst_sink, config, 1);
+}
+
+BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, FILE& dst_file, const BinarizerConfig& config, size_t threads_count)
+{
+    FileOutputSink dst_sink(dst_file);
+    return from_ascii_to_binary(src_file, dst_sink, config, threads_count);
+}
+
+BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, OutputSink& dst_sink, const BinarizerConfig& config, size_t threads_count)
 {
     using namespace std::literals;
     static constexpr const std::string_view GeneratedByPrusaSlicer = "generated by PrusaSlicer"sv;
@@ -222,14 +472,69 @@ BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, FILE& dst_fil
 
     static constexpr const std::string_view PrusaSlicerConfig = "prusaslicer_config"sv;
 
-    auto search_metadata_value = [&](const std::string_view& str, const std::string_view& key) {
-        std::string ret;
-        if (str.find(key) == 0) {
-            const size_t pos = str.find("=");
-            if (pos != std::string_view::npos)
-                ret = trim(str.substr(pos + 1));
+    // metadata collected from the comments, those shared in config are collected also from the config lines,
+    // which are then kept into the slicer metadata too
+    struct CollectedMetadata
+    {
+        std::string_view key;
+        bool shared_in_config;
+    };
+    static constexpr const std::array<CollectedMetadata, 27> CollectedMetadataKeys = { {
+        { PrinterModel,                        true },
+        { FilamentType,                        true },
+        { FilamentAbrasive,                    true },
+        { NozzleDiameter,                      true },
+        { NozzleHighFlow,                      true },
+        { BedTemperature,                      true },
+        { BrimWidth,                           true },
+        { FillDensity,                         true },
+        { LayerHeight,                         true },
+        { Temperature,                         true },
+        { Ironing,                             true },
+        { SupportMaterial,                     true },
+        { MaxLayerZ,                           false },
+        { ExtruderColour,                      true },
+        { FilamentUsedMm,                      false },
+        { FilamentUsedG,                       false },
+        { EstimatedPrintingTimeNormal,         false },
+        { FilamentUsedCm3,                     false },
+        { FilamentCost,                        false },
+        { TotalFilamentUsedG,                  false },
+        { TotalFilamentCost,                   false },
+        { TotalFilamentUsedWipeTower,          false },
+        { EstimatedPrintingTimeSilent,         false },
+        { Estimated1stLayerPrintingTimeNormal, false },
+        { Estimated1stLayerPrintingTimeSilent, false },
+        { ObjectsInfo,                         false },
+        { TotalToolChanges,                    false }
+    } };
+    // keys searched at the start of the lines: the collected metadata, with the same indices, followed by the section markers
+    static constexpr const std::array<std::string_view, CollectedMetadataKeys.size() + 7> LineKeys = []() {
+        std::array<std::string_view, CollectedMetadataKeys.size() + 7> keys{};
+        for (size_t i = 0; i < CollectedMetadataKeys.size(); ++i) {
+            keys[i] = CollectedMetadataKeys[i].key;
         }
-        return ret;
+        size_t i = CollectedMetadataKeys.size();
+        for (const std::string_view& key : { PrusaSlicerConfig, ThumbnailPNGBegin, ThumbnailPNGEnd, ThumbnailJPGBegin,
+            ThumbnailJPGEnd, ThumbnailQOIBegin, ThumbnailQOIEnd }) {
+            keys[i++] = key;
+        }
+        return keys;
+    }();
+    static constexpr const KeysTrie<trie_nodes_count(LineKeys)> LineKeysTrie(LineKeys);
+    static_assert(LineKeysTrie.is_valid(), "Ambiguous line keys");
+    static constexpr const size_t PrusaSlicerConfigId = LineKeysTrie.find(PrusaSlicerConfig);
+    static constexpr const size_t ThumbnailPNGBeginId = LineKeysTrie.find(ThumbnailPNGBegin);
+    static constexpr const size_t ThumbnailPNGEndId   = LineKeysTrie.find(ThumbnailPNGEnd);
+    static constexpr const size_t ThumbnailJPGBeginId = LineKeysTrie.find(ThumbnailJPGBegin);
+    static constexpr const size_t ThumbnailJPGEndId   = LineKeysTrie.find(ThumbnailJPGEnd);
+    static constexpr const size_t ThumbnailQOIBeginId = LineKeysTrie.find(ThumbnailQOIBegin);
+    static constexpr const size_t ThumbnailQOIEndId   = LineKeysTrie.find(ThumbnailQOIEnd);
+
+    // value of a "key = value" line
+    auto metadata_value = [](const std::string_view& str) {
+        const size_t pos = str.find('=');
+        return (pos != std::string_view::npos) ? trim(str.substr(pos + 1)) : std::string_view();
     };
     auto extract_thumbnail_rect = [](const std::string_view& str) {
         std::pair<uint16_t, uint16_t> ret = { 0, 0 };
@@ -241,63 +546,74 @@ BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, FILE& dst_fil
       return ret;
     };
 
-    EResult res = is_valid_binary_gcode(src_file);
-    if (res == EResult::Success)
+    // the file is read only once, from the current position, so that also non seekable files (pipes) are accepted:
+    // seekable files are checked as by the other conversions, the magic number of non seekable files is checked
+    // on the first bytes, which are then parsed with the rest of the file
+    const long start_position = ftell(&src_file);
+    if (start_position >= 0 && is_valid_binary_gcode(src_file) == EResult::Success)
+        return EResult::AlreadyBinarized;
+    std::array<char, 4> head;
+    const size_t head_size = fread(head.data(), 1, head.size(), &src_file);
+    if (ferror(&src_file))
+        return EResult::ReadError;
+    if (head_size == head.size() && head == MAGIC)
         return EResult::AlreadyBinarized;
 
+    // regular files are mapped and parsed in place
+    MappedFile mapped_file;
+    const bool mapped = start_position >= 0 && mapped_file.map(src_file) && static_cast<size_t>(start_position) <= mapped_file.size();
+
     Binarizer binarizer;
     binarizer.set_enabled(true);
+    // the blocks are cut by this thread, while parsing, and encoded and compressed by the others
+    binarizer.set_threads_count(threads_count);
     BinaryData& binary_data = binarizer.get_binary_data();
+    // the gcode blocks are encoded while parsing, and written after the metadata blocks, known only at the end
+    EResult res = binarizer.begin_gcode_spool(config);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
 
-    std::string printer_model;
-    std::string filament_type;
-    std::string filament_abrasive;
-    std::string nozzle_diameter;
-    std::string nozzle_high_flow;
-    std::string bed_temperature;
-    std::string brim_width;
-    std::string fill_density;
-    std::string layer_height;
-    std::string temperature;
-    std::string ironing;
-    std::string support_material;
-    std::string max_layer_z;
-    std::string extruder_colour;
-    std::string filament_used_mm;
-    std::string filament_used_g;
-    std::string estimated_printing_time_normal;
-    std::string filament_used_cm3;
-    std::string filament_cost;
-    std::string total_filament_used_g;
-    std::string total_filament_cost;
-    std::string total_filament_used_wipe_tower;
-    std::string estimated_printing_time_silent;
-    std::string estimated_1st_layer_printing_time_normal;
-    std::string estimated_1st_layer_printing_time_silent;
-    std::string objects_info;
-    std::string total_tool_changes;
+    std::array<std::string, CollectedMetadataKeys.size()> collected_metadata;
 
+    // thumbnails are decoded while parsing and spooled by the binarizer as soon as complete, one at a time
+    ThumbnailBlock thumbnail;
     std::optional<EThumbnailFormat> reading_thumbnail;
     size_t curr_thumbnail_data_size = 0;
     size_t curr_thumbnail_data_loaded = 0;
+    // base64 characters of the rows not yet decoded, less than a group of 4
+    std::string encoded;
+    bool decoding_stopped = false;
+    const ESimdLevel simd_level = detect_simd_level();
+    auto decode = [&](const char* data, size_t size) {
+        if (decoding_stopped || size == 0)
+            return;
+        std::vector<std::byte>& decoded = thumbnail.data;
+        const size_t decoded_pos = decoded.size();
+        decoded.resize(decoded_pos + base64_decoded_size(size));
+        const auto [written, read] = base64_decode(data, size, decoded.data() + decoded_pos, simd_level);
+        decoded.resize(decoded_pos + written);
+        // decoding stops at the first padding or invalid character
+        decoding_stopped = read < size;
+    };
 
     bool producer_found = false;
     bool reading_config = false;
 
-    std::vector<size_t> processed_lines;
-
     EResult parse_res = EResult::Success;
-    GCodeReader parser(src_file);
+    GCodeReader parser = mapped ?
+        GCodeReader(std::string_view(reinterpret_cast<const char*>(mapped_file.data()) + start_position, mapped_file.size() - start_position)) :
+        GCodeReader(src_file, std::string_view(head.data(), head_size));
     size_t lines_counter = 0;
+    std::string gcode_line;
     if (!parser.parse([&](GCodeReader& r, const GCodeReader::GCodeLine& line) {
         if (parse_res != EResult::Success)
             r.quit_parsing();
 
-        const std::string_view sv_line = uncomment(trim(line.raw));
-        if (sv_line.empty()) {
-            processed_lines.emplace_back(lines_counter++);
+        const size_t line_id = lines_counter++;
+        const std::string_view sv_line = line.content;
+        if (sv_line.empty())
             return;
-        }
 
         // update file metadata
         size_t pos = sv_line.find(GeneratedByPrusaSlicer);
@@ -315,78 +631,40 @@ BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, FILE& dst_fil
             if (!time.empty())
               binary_data.file_metadata.raw_data.emplace_back("Produced on", time);
             producer_found = true;
-            processed_lines.emplace_back(lines_counter++);
             return;
         }
 
-        pos = sv_line.find(PreparedBy);
-        if (lines_counter < 5 && pos != std::string_view::npos) {
+        pos = (line_id < 5) ? sv_line.find(PreparedBy) : std::string_view::npos;
+        if (pos != std::string_view::npos) {
             std::string_view prep = trim(sv_line.substr(pos + PreparedBy.size()));
             if (! prep.empty())
                 binary_data.file_metadata.raw_data.emplace_back("Prepared by", prep);
-            processed_lines.emplace_back(lines_counter++);
             return;
         }
 
         // collect print + printer metadata
         // to keep the proper order they will be set into binary_data later
-        auto collect_metadata = [&](const std::string_view& key, std::string& value, bool shared_in_config = false) {
-            const std::string str = search_metadata_value(sv_line, key);
-            if (!str.empty()) {
-                if (value.empty())
-                    value = str;
-                if (!shared_in_config) {
-                    processed_lines.emplace_back(lines_counter++);
-                    return true;
-                }
-                if (shared_in_config && !reading_config) {
-                    processed_lines.emplace_back(lines_counter++);
-                    return true;
-                }
+        const size_t key_id = LineKeysTrie.find(sv_line);
+        if (key_id < CollectedMetadataKeys.size()) {
+            const std::string_view value = metadata_value(sv_line);
+            if (!value.empty()) {
+                if (collected_metadata[key_id].empty())
+                    collected_metadata[key_id] = value;
+                if (!CollectedMetadataKeys[key_id].shared_in_config || !reading_config)
+                    return;
             }
-            return false;
-        };
-
-        if (collect_metadata(PrinterModel,                        printer_model, true)) return;
-        if (collect_metadata(FilamentType,                        filament_type, true)) return;
-        if (collect_metadata(FilamentAbrasive,                    filament_abrasive, true)) return;
-        if (collect_metadata(NozzleDiameter,                      nozzle_diameter, true)) return;
-        if (collect_metadata(NozzleHighFlow,                      nozzle_high_flow, true)) return;
-        if (collect_metadata(BedTemperature,                      bed_temperature, true)) return;
-        if (collect_metadata(BrimWidth,                           brim_width, true)) return;
-        if (collect_metadata(FillDensity,                         fill_density, true)) return;
-        if (collect_metadata(LayerHeight,                         layer_height, true)) return;
-        if (collect_metadata(Temperature,                         temperature, true)) return;
-        if (collect_metadata(Ironing,                             ironing, true)) return;
-        if (collect_metadata(SupportMaterial,                     support_material, true)) return;
-        if (collect_metadata(MaxLayerZ,                           max_layer_z)) return;
-        if (collect_metadata(ExtruderColour,                      extruder_colour, true)) return;
-        if (collect_metadata(FilamentUsedMm,                      filament_used_mm)) return;
-        if (collect_metadata(FilamentUsedG,                       filament_used_g)) return;
-        if (collect_metadata(EstimatedPrintingTimeNormal,         estimated_printing_time_normal)) return;
-        if (collect_metadata(FilamentUsedCm3,                     filament_used_cm3)) return;
-        if (collect_metadata(FilamentCost,                        filament_cost)) return;
-        if (collect_metadata(TotalFilamentUsedG,                  total_filament_used_g)) return;
-        if (collect_metadata(TotalFilamentCost,                   total_filament_cost)) return;
-        if (collect_metadata(TotalFilamentUsedWipeTower,          total_filament_used_wipe_tower)) return;
-        if (collect_metadata(EstimatedPrintingTimeSilent,         estimated_printing_time_silent)) return;
-        if (collect_metadata(Estimated1stLayerPrintingTimeNormal, estimated_1st_layer_printing_time_normal)) return;
-        if (collect_metadata(Estimated1stLayerPrintingTimeSilent, estimated_1st_layer_printing_time_silent)) return;
-        if (collect_metadata(ObjectsInfo,                         objects_info)) return;
-        if (collect_metadata(TotalToolChanges,                    total_tool_changes)) return;
+        }
 
         // update slicer metadata
         if (!reading_config) {
-            if (search_metadata_value(sv_line, PrusaSlicerConfig) == "begin") {
+            if (key_id == PrusaSlicerConfigId && metadata_value(sv_line) == "begin") {
                 reading_config = true;
-                processed_lines.emplace_back(lines_counter++);
                 return;
             }
         }
         else {
-            if (search_metadata_value(sv_line, PrusaSlicerConfig) == "end") {
+            if (key_id == PrusaSlicerConfigId && metadata_value(sv_line) == "end") {
                 reading_config = false;
-                processed_lines.emplace_back(lines_counter++);
                 return;
             }
             else {
@@ -402,7 +680,6 @@ BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, FILE& dst_fil
                     return;
                 }
                 binary_data.slicer_metadata.raw_data.emplace_back(std::string(key), std::string(value));
-                processed_lines.emplace_back(lines_counter++);
                 return;
             }
         }
@@ -410,20 +687,20 @@ BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, FILE& dst_fil
         // update thumbnails
         if (!reading_thumbnail.has_value()) {
             std::string_view sv_thumbnail_str;
-            if (sv_line.find(ThumbnailPNGBegin) == 0) {
+            if (key_id == ThumbnailPNGBeginId) {
                 reading_thumbnail = EThumbnailFormat::PNG;
                 sv_thumbnail_str = trim(sv_line.substr(ThumbnailPNGBegin.size()));
             }
-            else if (sv_line.find(ThumbnailJPGBegin) == 0) {
+            else if (key_id == ThumbnailJPGBeginId) {
                 reading_thumbnail = EThumbnailFormat::JPG;
                 sv_thumbnail_str = trim(sv_line.substr(ThumbnailJPGBegin.size()));
             }
-            else if (sv_line.find(ThumbnailQOIBegin) == 0) {
+            else if (key_id == ThumbnailQOIBeginId) {
                 reading_thumbnail = EThumbnailFormat::QOI;
                 sv_thumbnail_str = trim(sv_line.substr(ThumbnailQOIBegin.size()));
             }
             if (reading_thumbnail.has_value()) {
-                ThumbnailBlock& thumbnail = binary_data.thumbnails.emplace_back(ThumbnailBlock());
+                thumbnail.data.clear();
                 thumbnail.params.format = (uint16_t)*reading_thumbnail;
                 pos = sv_thumbnail_str.find(" ");
                 if (pos == std::string_view::npos) {
@@ -447,28 +724,29 @@ BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, FILE& dst_fil
                 }
                 curr_thumbnail_data_size = data_size;
                 curr_thumbnail_data_loaded = 0;
-                thumbnail.data.resize(data_size);
-                processed_lines.emplace_back(lines_counter++);
+                thumbnail.data.reserve(base64_decoded_size(data_size));
+                encoded.clear();
+                decoding_stopped = false;
                 return;
             }
         }
         else {
             bool thumbnail_end = false;
-            if (sv_line.find(ThumbnailPNGEnd) == 0) {
+            if (key_id == ThumbnailPNGEndId) {
                 if (*reading_thumbnail != EThumbnailFormat::PNG) {
                     parse_res = EResult::InvalidAsciiGCodeFile;
                     return;
                 }
                 thumbnail_end = true;
             }
-            else if (sv_line.find(ThumbnailJPGEnd) == 0) {
+            else if (key_id == ThumbnailJPGEndId) {
                 if (*reading_thumbnail != EThumbnailFormat::JPG) {
                     parse_res = EResult::InvalidAsciiGCodeFile;
                     return;
                 }
                 thumbnail_end = true;
             }
-            else if (sv_line.find(ThumbnailQOIEnd) == 0) {
+            else if (key_id == ThumbnailQOIEndId) {
                 if (*reading_thumbnail != EThumbnailFormat::QOI) {
                     parse_res = EResult::InvalidAsciiGCodeFile;
                     return;
@@ -482,15 +760,10 @@ BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, FILE& dst_fil
                     parse_res = EResult::InvalidAsciiGCodeFile;
                     return;
                 }
-                ThumbnailBlock& thumbnail = binary_data.thumbnails.back();
-                if (thumbnail.data.size() > curr_thumbnail_data_loaded)
-                    thumbnail.data.resize(curr_thumbnail_data_loaded);
-                std::vector<std::byte> decoded(boost::beast::detail::base64::decoded_size(thumbnail.data.size()));
-                auto thumbnail_buf = reinterpret_cast<const char *>(thumbnail.data.data());
-                decoded.resize(boost::beast::detail::base64::decode(decoded.data(), thumbnail_buf, thumbnail.data.size()).first);
-                thumbnail.data.clear();
-                std::copy(decoded.begin(), decoded.end(), std::back_inserter(thumbnail.data));
-                processed_lines.emplace_back(lines_counter++);
+                decode(encoded.data(), encoded.size());
+                const EResult thumbnail_res = binarizer.spool_thumbnail(thumbnail);
+                if (thumbnail_res != EResult::Success)
+                    parse_res = thumbnail_res;
                 return;
             }
             else {
@@ -498,16 +771,30 @@ BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, FILE& dst_fil
                     parse_res = EResult::InvalidAsciiGCodeFile;
                     return;
                 }
-                ThumbnailBlock& thumbnail = binary_data.thumbnails.back();
-                auto sv_line_bytes = reinterpret_cast<const std::byte*>(sv_line.data());
-                thumbnail.data.insert(thumbnail.data.begin() + curr_thumbnail_data_loaded, sv_line_bytes, sv_line_bytes + sv_line.size());
                 curr_thumbnail_data_loaded += sv_line.size();
-                processed_lines.emplace_back(lines_counter++);
+                // the groups are decoded from the row, only a group split between rows is copied
+                std::string_view row = sv_line;
+                if (!encoded.empty()) {
+                    const size_t missing = std::min(4 - encoded.size(), row.size());
+                    encoded.append(row.substr(0, missing));
+                    row.remove_prefix(missing);
+                    if (encoded.size() < 4)
+                        return;
+                    decode(encoded.data(), encoded.size());
+                    encoded.clear();
+                }
+                const size_t groups_size = row.size() - row.size() % 4;
+                decode(row.data(), groups_size);
+                encoded.assign(row.substr(groups_size));
                 return;
             }
         }
 
-        ++lines_counter;
+        gcode_line.assign(line.raw);
+        gcode_line.push_back('\n');
+        const EResult gcode_res = binarizer.append_gcode(gcode_line);
+        if (gcode_res != EResult::Success)
+            parse_res = gcode_res;
     }))
         return EResult::ReadError;
 
@@ -524,100 +811,195 @@ BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, FILE& dst_fil
     if (!producer_found)
         return EResult::InvalidAsciiGCodeFile;
 
-    auto append_metadata = [](std::vector<std::pair<std::string, std::string>>& dst, const std::string& key, const std::string& value) {
-        if (!value.empty()) dst.emplace_back(key, value);
+    auto append_metadata = [&](std::vector<std::pair<std::string, std::string>>& dst, const std::string_view& key) {
+        const std::string& value = collected_metadata[LineKeysTrie.find(key)];
+        if (!value.empty()) dst.emplace_back(std::string(key), value);
     };
 
     // update printer metadata
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(PrinterModel),                printer_model);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(FilamentType),                filament_type);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(FilamentAbrasive),            filament_abrasive);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(NozzleDiameter),              nozzle_diameter);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(NozzleHighFlow),              nozzle_high_flow);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(BedTemperature),              bed_temperature);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(BrimWidth),                   brim_width);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(FillDensity),                 fill_density);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(LayerHeight),                 layer_height);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(Temperature),                 temperature);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(Ironing),                     ironing);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(SupportMaterial),             support_material);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(MaxLayerZ),                   max_layer_z);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(ExtruderColour),              extruder_colour);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(FilamentUsedMm),              filament_used_mm);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(FilamentUsedCm3),             filament_used_cm3);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(FilamentUsedG),               filament_used_g);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(FilamentCost),                filament_cost);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(EstimatedPrintingTimeNormal), estimated_printing_time_normal);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(EstimatedPrintingTimeSilent), estimated_printing_time_silent);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(TotalFilamentUsedWipeTower),  total_filament_used_wipe_tower);
-    append_metadata(binary_data.printer_metadata.raw_data, std::string(ObjectsInfo),                 objects_info);
+    append_metadata(binary_data.printer_metadata.raw_data, PrinterModel);
+    append_metadata(binary_data.printer_metadata.raw_data, FilamentType);
+    append_metadata(binary_data.printer_metadata.raw_data, FilamentAbrasive);
+    append_metadata(binary_data.printer_metadata.raw_data, NozzleDiameter);
+    append_metadata(binary_data.printer_metadata.raw_data, NozzleHighFlow);
+    append_metadata(binary_data.printer_metadata.raw_data, BedTemperature);
+    append_metadata(binary_data.printer_metadata.raw_data, BrimWidth);
+    append_metadata(binary_data.printer_metadata.raw_data, FillDensity);
+    append_metadata(binary_data.printer_metadata.raw_data, LayerHeight);
+    append_metadata(binary_data.printer_metadata.raw_data, Temperature);
+    append_metadata(binary_data.printer_metadata.raw_data, Ironing);
+    append_metadata(binary_data.printer_metadata.raw_data, SupportMaterial);
+    append_metadata(binary_data.printer_metadata.raw_data, MaxLayerZ);
+    append_metadata(binary_data.printer_metadata.raw_data, ExtruderColour);
+    append_metadata(binary_data.printer_metadata.raw_data, FilamentUsedMm);
+    append_metadata(binary_data.printer_metadata.raw_data, FilamentUsedCm3);
+    append_metadata(binary_data.printer_metadata.raw_data, FilamentUsedG);
+    append_metadata(binary_data.printer_metadata.raw_data, FilamentCost);
+    append_metadata(binary_data.printer_metadata.raw_data, EstimatedPrintingTimeNormal);
+    append_metadata(binary_data.printer_metadata.raw_data, EstimatedPrintingTimeSilent);
+    append_metadata(binary_data.printer_metadata.raw_data, TotalFilamentUsedWipeTower);
+    append_metadata(binary_data.printer_metadata.raw_data, ObjectsInfo);
 
     // update print metadata
-    append_metadata(binary_data.print_metadata.raw_data, std::string(TotalToolChanges),                    total_tool_changes);
-    append_metadata(binary_data.print_metadata.raw_data, std::string(FilamentUsedMm),                      filament_used_mm);
-    append_metadata(binary_data.print_metadata.raw_data, std::string(FilamentUsedCm3),                     filament_used_cm3);
-    append_metadata(binary_data.print_metadata.raw_data, std::string(FilamentUsedG),                       filament_used_g);
-    append_metadata(binary_data.print_metadata.raw_data, std::string(FilamentCost),                        filament_cost);
-    append_metadata(binary_data.print_metadata.raw_data, std::string(TotalFilamentUsedG),                  total_filament_used_g);
-    append_metadata(binary_data.print_metadata.raw_data, std::string(TotalFilamentCost),                   total_filament_cost);
-    append_metadata(binary_data.print_metadata.raw_data, std::string(TotalFilamentUsedWipeTower),          total_filament_used_wipe_tower);
-    append_metadata(binary_data.print_metadata.raw_data, std::string(EstimatedPrintingTimeNormal),         estimated_printing_time_normal);
-    append_metadata(binary_data.print_metadata.raw_data, std::string(EstimatedPrintingTimeSilent),         estimated_printing_time_silent);
-    append_metadata(binary_data.print_metadata.raw_data, std::string(Estimated1stLayerPrintingTimeNormal), estimated_1st_layer_printing_time_normal);
-    append_metadata(binary_data.print_metadata.raw_data, std::string(Estimated1stLayerPrintingTimeSilent), estimated_1st_layer_printing_time_silent);
-
-    res = binarizer.initialize(dst_file, config);
+    append_metadata(binary_data.print_metadata.raw_data, TotalToolChanges);
+    append_metadata(binary_data.print_metadata.raw_data, FilamentUsedMm);
+    append_metadata(binary_data.print_metadata.raw_data, FilamentUsedCm3);
+    append_metadata(binary_data.print_metadata.raw_data, FilamentUsedG);
+    append_metadata(binary_data.print_metadata.raw_data, FilamentCost);
+    append_metadata(binary_data.print_metadata.raw_data, TotalFilamentUsedG);
+    append_metadata(binary_data.print_metadata.raw_data, TotalFilamentCost);
+    append_metadata(binary_data.print_metadata.raw_data, TotalFilamentUsedWipeTower);
+    append_metadata(binary_data.print_metadata.raw_data, EstimatedPrintingTimeNormal);
+    append_metadata(binary_data.print_metadata.raw_data, EstimatedPrintingTimeSilent);
+    append_metadata(binary_data.print_metadata.raw_data, Estimated1stLayerPrintingTimeNormal);
+    append_metadata(binary_data.print_metadata.raw_data, Estimated1stLayerPrintingTimeSilent);
+
+    // write the blocks in the order required by the specifications, followed by the spooled gcode blocks
+    res = binarizer.begin(dst_sink, config);
     if (res != EResult::Success)
         // propagate error
         return res;
-
-    // reparse the file to extract the gcode
-    rewind(&src_file);
-    parse_res = EResult::Success;
-    lines_counter = 0;
-    if (!parser.parse([&](GCodeReader& r, const GCodeReader::GCodeLine& line) {
-        if (parse_res != EResult::Success)
-            r.quit_parsing();
-
-        if (!std::binary_search(processed_lines.begin(), processed_lines.end(), lines_counter))
-            binarizer.append_gcode(line.raw + "\n");
-
-        ++lines_counter;
-    }))
-        return EResult::ReadError;
-
-    if (parse_res != EResult::Success)
+    if (!binary_data.file_metadata.raw_data.empty()) {
+        res = binarizer.write_file_metadata(binary_data.file_metadata);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+    }
+    res = binarizer.write_printer_metadata(binary_data.printer_metadata);
+    if (res != EResult::Success)
         // propagate error
-        return parse_res;
-
-    res = binarizer.finalize();
+        return res;
+    // the spooled thumbnails are written first
+    res = binarizer.write_print_metadata(binary_data.print_metadata);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    res = binarizer.write_slicer_metadata(binary_data.slicer_metadata);
     if (res != EResult::Success)
         // propagate error
         return res;
 
-    return EResult::Success;
+    return binarizer.finalize();
+}
+
+// Converts the gcode blocks, starting from the one with the given header, decoding them on a pool of threads:
+// the calling thread reads the blocks and writes the decoded ones into the given sink, in the order of the file.
+// Each block is read once, its checksum is verified, if requested, by the thread decoding it.
+// At most 2 blocks per thread are read and not yet written, to bound the memory used.
+// The output is the same of the serial conversion, also when failing.
+static EResult convert_gcode_blocks_parallel(FILE& src_file, const FileHeader& file_header, BlockHeader& block_header, long file_size,
+    bool verify_checksum, OutputSink& sink, size_t threads_count)
+{
+    using DecodedBlock = std::pair<EResult, std::vector<std::byte>>;
+    const size_t window_size = 2 * threads_count;
+    std::deque<std::future<DecodedBlock>> window;
+    ThreadPool pool(threads_count);
+
+    auto write_oldest = [&]() {
+        DecodedBlock decoded = window.front().get();
+        window.pop_front();
+        if (decoded.first != EResult::Success)
+            // propagate error
+            return decoded.first;
+        return sink.write(decoded.second.data(), decoded.second.size()) ? EResult::Success : EResult::WriteError;
+    };
+    // writes the blocks left in the window and returns the first error of them, otherwise the given result:
+    // the blocks preceding a failure are written, as done by the serial conversion
+    auto finish = [&](EResult result) {
+        while (!window.empty()) {
+            const EResult res = write_oldest();
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+        }
+        return result;
+    };
+
+    using ChecksumData = std::array<std::byte, MAX_CHECKSUM_SIZE>;
+    const EChecksumType checksum_type = verify_checksum ? (EChecksumType)file_header.checksum_type : EChecksumType::None;
+    const size_t block_checksum_size = checksum_size((EChecksumType)file_header.checksum_type);
+    if (block_checksum_size > MAX_CHECKSUM_SIZE)
+        return EResult::InvalidChecksumType;
+    while ((EBlockType)block_header.type == EBlockType::GCode) {
+        std::vector<std::byte> payload(block_payload_size(block_header));
+        ChecksumData checksum;
+        if (fread(payload.data(), 1, payload.size(), &src_file) != payload.size() ||
+            fread(checksum.data(), 1, block_checksum_size, &src_file) != block_checksum_size)
+            return finish(EResult::ReadError);
+
+        auto task = std::make_shared<std::packaged_task<DecodedBlock()>>([payload = std::move(payload), checksum, checksum_type,
+            header = block_header]() {
+            if (checksum_type != EChecksumType::None) {
+                Checksum cs(checksum_type);
+                update_checksum(cs, header);
+                cs.append(payload.data(), payload.size());
+                if (std::memcmp(cs.get_data(), checksum.data(), cs.get_size()) != 0)
+                    return DecodedBlock(EResult::InvalidChecksum, {});
+            }
+            MemoryOutputSink decoded;
+            NonEmptyLinesSink gcode_sink(decoded);
+            GCodeBlock block;
+            EResult res = block.read_data(payload.data(), payload.size(), header, gcode_sink);
+            if (res == EResult::Success && !gcode_sink.end_block())
+                res = EResult::WriteError;
+            return DecodedBlock(res, decoded.release());
+        });
+        window.push_back(task->get_future());
+        pool.push([task]() { (*task)(); });
+        if (window.size() == window_size) {
+            const EResult res = write_oldest();
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+        }
+
+        if (ftell(&src_file) == file_size)
+            break;
+        const EResult res = read_next_block_header(src_file, file_header, block_header);
+        if (res != EResult::Success)
+            return finish(res);
+    }
+    return finish(EResult::Success);
 }
 
 BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_file, bool verify_checksum)
 {
+    return from_binary_to_ascii(src_file, dst_file, verify_checksum, 1);
+}
+
+BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, OutputSink& dst_sink, bool verify_checksum)
+{
+    return from_binary_to_ascii(src_file, dst_sink, verify_checksum, 1);
+}
+
+BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_file, bool verify_checksum, size_t threads_count)
+{
+    FileOutputSink dst_sink(dst_file);
+    return from_binary_to_ascii(src_file, dst_sink, verify_checksum, threads_count);
+}
+
+BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, OutputSink& dst_sink, bool verify_checksum, size_t threads_count)
+{
+    threads_count = resolve_threads_count(threads_count);
+
     // initialize buffer for checksum calculation, if verify_checksum is true
     std::vector<std::byte> checksum_buffer;
     if (verify_checksum)
         checksum_buffer.resize(65535);
 
-    auto write_line = [&](const std::string& line) {
-        const size_t wsize = fwrite(line.data(), 1, line.length(), &dst_file);
-        return !ferror(&dst_file) && wsize == line.length();
-    };
-
-    auto write_metadata = [&](const std::vector<std::pair<std::string, std::string>>& data) {
+    // the output is assembled into the buffer of the writer, from pieces appended with no temporary strings
+    AsciiWriter writer(dst_sink);
+    auto write_metadata = [&](const MetadataStorage& data) {
         for (const auto& [key, value] : data) {
-            if (!write_line("; " + key + " = " + value + "\n"))
+            if (!writer.append("; ", key, " = ", value, "\n"))
                 return false;
         }
-        return !ferror(&dst_file);
+        return true;
     };
 
+    // metadata blocks are read without allocating per item
+    MetadataStorage metadata;
+
     EResult res = is_valid_binary_gcode(src_file, true);
     if (res != EResult::Success)
         // propagate error
@@ -649,25 +1031,19 @@ BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_fil
         return EResult::InvalidSequenceOfBlocks;
     if ((EBlockType)block_header.type == EBlockType::FileMetadata) {
         FileMetadataBlock file_metadata_block;
-        res = file_metadata_block.read_data(src_file, file_header, block_header);
+        res = file_metadata_block.read_data(src_file, file_header, block_header, metadata);
         if (res != EResult::Success)
             // propagate error
             return res;
 
-        auto producer_it = std::find_if(file_metadata_block.raw_data.begin(), file_metadata_block.raw_data.end(),
-            [](const std::pair<std::string, std::string>& item) { return item.first == "Producer"; });
-        auto prepared_it = std::find_if(file_metadata_block.raw_data.begin(), file_metadata_block.raw_data.end(),
-            [](const std::pair<std::string, std::string>& item) { return item.first == "Prepared by"; });
-        auto produced_on_it = std::find_if(file_metadata_block.raw_data.begin(), file_metadata_block.raw_data.end(),
-            [](const auto& item) { return item.first == "Produced on"; });
-
-        std::string producer_str = (producer_it != file_metadata_block.raw_data.end()) ? producer_it->second : "Unknown";
-        if (produced_on_it != file_metadata_block.raw_data.end())
-          producer_str += " on " + produced_on_it->second;
-        if (prepared_it != file_metadata_block.raw_data.end())
-          producer_str += "\n; prepared by " + prepared_it->second;
+        const std::optional<std::string_view> producer = metadata.find("Producer");
+        const std::optional<std::string_view> prepared = metadata.find("Prepared by");
+        const std::optional<std::string_view> produced_on = metadata.find("Produced on");
 
-        if (!write_line("; generated by " + producer_str + "\n\n\n"))
+        if (!writer.append("; generated by ", producer.value_or("Unknown")) ||
+            (produced_on.has_value() && !writer.append(" on ", *produced_on)) ||
+            (prepared.has_value() && !writer.append("\n; prepared by ", *prepared)) ||
+            !writer.append("\n\n\n"))
             return EResult::WriteError;
 
         res = read_next_block_header(src_file, file_header, block_header, checksum_buffer.data(), checksum_buffer.size());
@@ -682,11 +1058,11 @@ BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_fil
     // convert printer metadata block
     //
     PrinterMetadataBlock printer_metadata_block;
-    res = printer_metadata_block.read_data(src_file, file_header, block_header);
+    res = printer_metadata_block.read_data(src_file, file_header, block_header, metadata);
     if (res != EResult::Success)
         // propagate error
         return res;
-    if (!write_metadata(printer_metadata_block.raw_data))
+    if (!write_metadata(metadata))
         return EResult::WriteError;
 
     //
@@ -697,6 +1073,7 @@ BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_fil
     if (res != EResult::Success)
         // propagate error
         return res;
+    const ESimdLevel simd_level = detect_simd_level();
     while ((EBlockType)block_header.type == EBlockType::Thumbnail) {
         ThumbnailBlock thumbnail_block;
         res = thumbnail_block.read_data(src_file, file_header, block_header);
@@ -704,10 +1081,13 @@ BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_fil
             // propagate error
             return res;
         static constexpr const size_t max_row_length = 78;
-        std::string encoded;
-        encoded.resize(boost::beast::detail::base64::encoded_size(thumbnail_block.data.size()));
-        encoded.resize(boost::beast::detail::base64::encode((void*)encoded.data(), (const void*)thumbnail_block.data.data(), thumbnail_block.data.size()));
-        std::string format;
+        static constexpr const std::string_view row_prefix = "; ";
+        // the rows are encoded into the output a chunk at a time, each one ending at the end of a base64 group
+        static constexpr const size_t chunk_rows = 1024;
+        static constexpr const size_t chunk_size = chunk_rows * max_row_length / 4 * 3;
+        static_assert(chunk_rows * max_row_length % 4 == 0, "Chunk not ending at the end of a group");
+        static_assert(base64_rows_size(chunk_size, max_row_length, row_prefix.size()) <= AsciiWriter::DefaultBufferSize, "Chunk larger than the output buffer");
+        std::string_view format;
         switch ((EThumbnailFormat)thumbnail_block.params.format)
         {
         default:
@@ -715,19 +1095,17 @@ BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_fil
         case EThumbnailFormat::JPG: { format = "thumbnail_JPG"; break; }
         case EThumbnailFormat::QOI: { format = "thumbnail_QOI"; break; }
         }
-        if (!write_line("\n;\n; " + format + " begin " + std::to_string(thumbnail_block.params.width) + "x" + std::to_string(thumbnail_block.params.height) +
-            " " + std::to_string(encoded.length()) + "\n"))
+        if (!writer.append("\n;\n; ", format, " begin ", std::to_string(thumbnail_block.params.width), "x",
+            std::to_string(thumbnail_block.params.height), " ", std::to_string(base64_encoded_size(thumbnail_block.data.size())), "\n"))
             return EResult::WriteError;
-        while (encoded.size() > max_row_length) {
-            if (!write_line("; " + encoded.substr(0, max_row_length) + "\n"))
+        for (size_t pos = 0; pos < thumbnail_block.data.size(); pos += chunk_size) {
+            const size_t size = std::min(chunk_size, thumbnail_block.data.size() - pos);
+            if (!writer.write_in_place(base64_rows_size(size, max_row_length, row_prefix.size()), [&](char* dst) {
+                return base64_encode_rows(thumbnail_block.data.data() + pos, size, row_prefix, max_row_length, dst, simd_level);
+            }))
                 return EResult::WriteError;
-            encoded = encoded.substr(max_row_length);
         }
-        if (encoded.size() > 0) {
-            if (!write_line("; " + encoded + "\n"))
-                return EResult::WriteError;
-        }
-        if (!write_line("; " + format + " end\n;\n"))
+        if (!writer.append("; ", format, " end\n;\n"))
             return EResult::WriteError;
 
         restore_position = ftell(&src_file);
@@ -740,54 +1118,43 @@ BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_fil
     //
     // convert gcode blocks
     //
-    auto remove_empty_lines = [](const std::string& data) {
-        std::string ret;
-        auto begin_it = data.begin();
-        auto end_it = data.begin();
-        while (end_it != data.end()) {
-            while (end_it != data.end() && *end_it != '\n') {
-                ++end_it;
-            }
-
-          const size_t pos = std::distance(data.begin(), begin_it);
-          const size_t line_length = std::distance(begin_it, end_it);
-          const std::string_view original_line(&data[pos], line_length);
-          const std::string_view reduced_line = uncomment(trim(original_line));
-          if (!reduced_line.empty())
-              ret += std::string(original_line) + "\n";
-          begin_it = ++end_it;
-        }
-
-        return ret;
-    };
-
-    if (!write_line("\n"))
+    if (!writer.append("\n"))
         return EResult::WriteError;
     res = skip_block(src_file, file_header, block_header);
     if (res != EResult::Success)
         // propagate error
         return res;
-    res = read_next_block_header(src_file, file_header, block_header, EBlockType::GCode, checksum_buffer.data(), checksum_buffer.size());
+    // the parallel conversion verifies the checksums of the gcode blocks while decoding them
+    const bool parallel = threads_count > 1;
+    res = read_next_block_header(src_file, file_header, block_header, EBlockType::GCode, parallel ? nullptr : checksum_buffer.data(),
+        parallel ? 0 : checksum_buffer.size());
     if (res != EResult::Success)
         // propagate error
         return res;
-    while ((EBlockType)block_header.type == EBlockType::GCode) {
-        GCodeBlock block;
-        res = block.read_data(src_file, file_header, block_header);
+    if (parallel) {
+        res = convert_gcode_blocks_parallel(src_file, file_header, block_header, file_size, verify_checksum, writer, threads_count);
         if (res != EResult::Success)
             // propagate error
             return res;
-        const std::string out_str = remove_empty_lines(block.raw_data);
-        if (!out_str.empty()) {
-            if (!write_line(out_str))
+    }
+    else {
+        // the blocks are decompressed and decoded in chunks, straight into the output
+        NonEmptyLinesSink gcode_sink(writer);
+        while ((EBlockType)block_header.type == EBlockType::GCode) {
+            GCodeBlock block;
+            res = block.read_data(src_file, file_header, block_header, gcode_sink);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+            if (!gcode_sink.end_block())
                 return EResult::WriteError;
+            if (ftell(&src_file) == file_size)
+                break;
+            res = read_next_block_header(src_file, file_header, block_header, checksum_buffer.data(), checksum_buffer.size());
+            if (res != EResult::Success)
+                // propagate error
+                return res;
         }
-        if (ftell(&src_file) == file_size)
-            break;
-        res = read_next_block_header(src_file, file_header, block_header, checksum_buffer.data(), checksum_buffer.size());
-        if (res != EResult::Success)
-            // propagate error
-            return res;
     }
 
     //
@@ -801,13 +1168,13 @@ BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_fil
     if ((EBlockType)block_header.type != EBlockType::PrintMetadata)
         return EResult::InvalidSequenceOfBlocks;
     PrintMetadataBlock print_metadata_block;
-    res = print_metadata_block.read_data(src_file, file_header, block_header);
+    res = print_metadata_block.read_data(src_file, file_header, block_header, metadata);
     if (res != EResult::Success)
         // propagate error
         return res;
-    if (!write_line("\n"))
+    if (!writer.append("\n"))
         return EResult::WriteError;
-    if (!write_metadata(print_metadata_block.raw_data))
+    if (!write_metadata(metadata))
         return EResult::WriteError;
 
     //
@@ -820,15 +1187,18 @@ BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_fil
     if ((EBlockType)block_header.type != EBlockType::SlicerMetadata)
         return EResult::InvalidSequenceOfBlocks;
     SlicerMetadataBlock slicer_metadata_block;
-    res = slicer_metadata_block.read_data(src_file, file_header, block_header);
+    res = slicer_metadata_block.read_data(src_file, file_header, block_header, metadata);
     if (res != EResult::Success)
         // propagate error
         return res;
-    if (!write_line("\n; prusaslicer_config = begin\n"))
+    if (!writer.append("\n; prusaslicer_config = begin\n"))
+        return EResult::WriteError;
+    if (!write_metadata(metadata))
         return EResult::WriteError;
-    if (!write_metadata(slicer_metadata_block.raw_data))
+    if (!writer.append("; prusaslicer_config = end\n\n"))
         return EResult::WriteError;
-    if (!write_line("; prusaslicer_config = end\n\n"))
+
+    if (!writer.flush())
         return EResult::WriteError;
 
     return EResult::Success;
@@ -9,9 +9,23 @@ namespace bgcode { namespace convert {
 // Converts the gcode file contained into src_file from ascii (using the parameters specified with the given config) to binary format
 // and save the results into dst_file,
 extern BGCODE_CONVERT_EXPORT core::EResult from_ascii_to_binary(FILE& src_file, FILE& dst_file, const binarize::BinarizerConfig& config);
+// As above, the results are sent to the given sink
+extern BGCODE_CONVERT_EXPORT core::EResult from_ascii_to_binary(FILE& src_file, core::OutputSink& dst_sink, const binarize::BinarizerConfig& config);
+// As above, encoding and compressing the gcode blocks on the given count of threads, 0 for the count of hardware threads.
+// The output is the same of the conversion on a single thread.
+extern BGCODE_CONVERT_EXPORT core::EResult from_ascii_to_binary(FILE& src_file, FILE& dst_file, const binarize::BinarizerConfig& config,
+    size_t threads_count);
+extern BGCODE_CONVERT_EXPORT core::EResult from_ascii_to_binary(FILE& src_file, core::OutputSink& dst_sink, const binarize::BinarizerConfig& config,
+    size_t threads_count);
 
 // Converts the gcode file contained into src_file from binary to ascii format and save the results into dst_file
 extern BGCODE_CONVERT_EXPORT core::EResult from_binary_to_ascii(FILE& src_file, FILE& dst_file, bool verify_checksum);
+// As above, the results are sent to the given sink
+extern BGCODE_CONVERT_EXPORT core::EResult from_binary_to_ascii(FILE& src_file, core::OutputSink& dst_sink, bool verify_checksum);
+// As above, decoding the gcode blocks on the given count of threads, 0 for the count of hardware threads.
+// The output is the same of the conversion on a single thread.
+extern BGCODE_CONVERT_EXPORT core::EResult from_binary_to_ascii(FILE& src_file, FILE& dst_file, bool verify_checksum, size_t threads_count);
+extern BGCODE_CONVERT_EXPORT core::EResult from_binary_to_ascii(FILE& src_file, core::OutputSink& dst_sink, bool verify_checksum, size_t threads_count);
 
 }} // bgcode::core
 
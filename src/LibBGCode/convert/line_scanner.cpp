@@ -0,0 +1,159 @@
+#include "line_scanner.hpp"
+
+#if defined(BGCODE_SIMD_X86)
+#include <immintrin.h>
+#elif defined(BGCODE_SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace bgcode {
+using namespace core;
+namespace convert {
+
+// Portable version, 8 characters at a time in a 64 bits word
+
+static constexpr const uint64_t LowBits{ 0x7F7F7F7F7F7F7F7F };
+
+// Characters of the word equal to the given one, as the high bit of each byte, computed without carries between bytes
+static inline uint64_t equal_bytes(uint64_t word, char value)
+{
+    const uint64_t x = word ^ (0x0101010101010101 * static_cast<uint8_t>(value));
+    return ~(((x & LowBits) + LowBits) | x | LowBits);
+}
+
+// Gathers the high bits of the bytes into the lowest 8 bits
+static inline uint64_t gather_bytes(uint64_t high_bits)
+{
+    return ((high_bits >> 7) * 0x0102040810204080) >> 56;
+}
+
+static CharMasks classify_chars_scalar(const char* data)
+{
+    CharMasks masks;
+    for (size_t i = 0; i < ScanWindowSize; i += 8) {
+        uint64_t word = 0;
+        for (size_t j = 0; j < 8; ++j) {
+            word |= static_cast<uint64_t>(static_cast<uint8_t>(data[i + j])) << (8 * j);
+        }
+        masks.new_lines |= gather_bytes(equal_bytes(word, '\n')) << i;
+        masks.returns |= gather_bytes(equal_bytes(word, '\r')) << i;
+        masks.nulls |= gather_bytes(equal_bytes(word, '\0')) << i;
+        masks.comments |= gather_bytes(equal_bytes(word, ';')) << i;
+        masks.blanks |= gather_bytes(equal_bytes(word, ' ') | equal_bytes(word, '\t')) << i;
+    }
+    return masks;
+}
+
+#if defined(BGCODE_SIMD_X86)
+
+// Mask of the characters equal to the given value
+BGCODE_TARGET("sse2")
+static inline uint64_t equal_mask_sse2(const __m128i& c, char value)
+{
+    return static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(value)))));
+}
+
+BGCODE_TARGET("sse2")
+static void classify_windows_sse2(const char* data, size_t windows_count, CharMasks* masks)
+{
+    for (size_t w = 0; w < windows_count; ++w, data += ScanWindowSize) {
+        // accumulated into locals, the stores into masks could alias the data
+        uint64_t new_lines = 0, returns = 0, nulls = 0, comments = 0, blanks = 0;
+        for (size_t i = 0; i < ScanWindowSize; i += 16) {
+            const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            new_lines |= equal_mask_sse2(c, '\n') << i;
+            returns |= equal_mask_sse2(c, '\r') << i;
+            nulls |= equal_mask_sse2(c, '\0') << i;
+            comments |= equal_mask_sse2(c, ';') << i;
+            blanks |= (equal_mask_sse2(c, ' ') | equal_mask_sse2(c, '\t')) << i;
+        }
+        masks[w] = { new_lines, returns, nulls, comments, blanks };
+    }
+}
+
+BGCODE_TARGET("avx2")
+static inline uint64_t equal_mask_avx2(const __m256i& c, char value)
+{
+    return static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(value)))));
+}
+
+BGCODE_TARGET("avx2")
+static void classify_windows_avx2(const char* data, size_t windows_count, CharMasks* masks)
+{
+    for (size_t w = 0; w < windows_count; ++w, data += ScanWindowSize) {
+        // accumulated into locals, the stores into masks could alias the data
+        uint64_t new_lines = 0, returns = 0, nulls = 0, comments = 0, blanks = 0;
+        for (size_t i = 0; i < ScanWindowSize; i += 32) {
+            const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            new_lines |= equal_mask_avx2(c, '\n') << i;
+            returns |= equal_mask_avx2(c, '\r') << i;
+            nulls |= equal_mask_avx2(c, '\0') << i;
+            comments |= equal_mask_avx2(c, ';') << i;
+            blanks |= (equal_mask_avx2(c, ' ') | equal_mask_avx2(c, '\t')) << i;
+        }
+        masks[w] = { new_lines, returns, nulls, comments, blanks };
+    }
+    _mm256_zeroupper();
+}
+
+#elif defined(BGCODE_SIMD_NEON)
+
+// Mask of the lanes of 4 vectors of compare results, as done by simdjson
+static inline uint64_t movemask_neon(uint8x16_t v0, uint8x16_t v1, uint8x16_t v2, uint8x16_t v3)
+{
+    static const uint8_t lane_bits_data[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t lane_bits = vld1q_u8(lane_bits_data);
+    uint8x16_t sum0 = vpaddq_u8(vandq_u8(v0, lane_bits), vandq_u8(v1, lane_bits));
+    const uint8x16_t sum1 = vpaddq_u8(vandq_u8(v2, lane_bits), vandq_u8(v3, lane_bits));
+    sum0 = vpaddq_u8(sum0, sum1);
+    sum0 = vpaddq_u8(sum0, sum0);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(sum0), 0);
+}
+
+static CharMasks classify_window_neon(const char* data)
+{
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    const uint8x16_t c[4] = { vld1q_u8(bytes), vld1q_u8(bytes + 16), vld1q_u8(bytes + 32), vld1q_u8(bytes + 48) };
+    auto mask = [&c](uint8_t value) {
+        const uint8x16_t v = vdupq_n_u8(value);
+        return movemask_neon(vceqq_u8(c[0], v), vceqq_u8(c[1], v), vceqq_u8(c[2], v), vceqq_u8(c[3], v));
+    };
+    CharMasks masks;
+    masks.new_lines = mask('\n');
+    masks.returns = mask('\r');
+    masks.nulls = mask('\0');
+    masks.comments = mask(';');
+    masks.blanks = mask(' ') | mask('\t');
+    return masks;
+}
+
+static void classify_windows_neon(const char* data, size_t windows_count, CharMasks* masks)
+{
+    for (size_t w = 0; w < windows_count; ++w) {
+        masks[w] = classify_window_neon(data + w * ScanWindowSize);
+    }
+}
+
+#endif // BGCODE_SIMD_NEON
+
+void classify_chars(const char* data, size_t windows_count, CharMasks* masks, ESimdLevel level)
+{
+    switch (level)
+    {
+#if defined(BGCODE_SIMD_X86)
+    case ESimdLevel::AVX2:  { classify_windows_avx2(data, windows_count, masks); break; }
+    case ESimdLevel::SSSE3: { classify_windows_sse2(data, windows_count, masks); break; }
+#elif defined(BGCODE_SIMD_NEON)
+    case ESimdLevel::NEON:  { classify_windows_neon(data, windows_count, masks); break; }
+#endif
+    default: {
+        for (size_t i = 0; i < windows_count; ++i) {
+            masks[i] = classify_chars_scalar(data + i * ScanWindowSize);
+        }
+        break;
+    }
+    }
+}
+
+} // namespace convert
+} // namespace bgcode
@@ -0,0 +1,123 @@
+#ifndef _BGCODE_CONVERT_LINE_SCANNER_HPP_
+#define _BGCODE_CONVERT_LINE_SCANNER_HPP_
+
+#include "convert/export.h"
+#include "core/cpu_features.hpp"
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <algorithm>
+
+//
+// Vectorized scanning of ascii gcode, 64 characters at a time: the characters of interest of a window are
+// classified into bitmasks with a few vector compares, then the lines are found with bit operations on
+// the masks, with no per character branch.
+//
+
+namespace bgcode { namespace convert {
+
+static constexpr const size_t ScanWindowSize{ 64 };
+
+// Classification of a window of characters, bit i of each mask standing for the character i of the window
+struct CharMasks
+{
+    uint64_t new_lines{ 0 }; // '\n'
+    uint64_t returns{ 0 };   // '\r'
+    uint64_t nulls{ 0 };     // '\0'
+    uint64_t comments{ 0 };  // ';'
+    uint64_t blanks{ 0 };    // ' ' and '\t'
+};
+
+// Classifies the windows_count * ScanWindowSize characters starting at data into windows_count masks,
+// with the given instruction set extension, which must be supported by the running CPU (see core::supported_simd_level())
+extern BGCODE_CONVERT_EXPORT void classify_chars(const char* data, size_t windows_count, CharMasks* masks, core::ESimdLevel level);
+
+// Classifies the characters in [begin, end), at most ScanWindowSize, as a single window, leaving the bits
+// past end set to zero
+inline CharMasks classify_tail(const char* begin, const char* end, core::ESimdLevel level)
+{
+    char window[ScanWindowSize] = {};
+    std::memcpy(window, begin, end - begin);
+    CharMasks masks;
+    classify_chars(window, 1, &masks, level);
+    const uint64_t valid = (end - begin < static_cast<ptrdiff_t>(ScanWindowSize)) ? (uint64_t(1) << (end - begin)) - 1 : ~uint64_t(0);
+    masks.nulls &= valid;
+    return masks;
+}
+
+// Windows classified at a time, to amortize the dispatch
+static constexpr const size_t ScanBatchSize{ 32 };
+
+// Returns the given line without the leading and trailing blanks and then, if the line is a comment,
+// without the comment mark and the blanks following it
+inline std::string_view line_content(std::string_view line)
+{
+    auto is_blank = [](char c) { return c == ' ' || c == '\t'; };
+    size_t begin = 0;
+    size_t end = line.size();
+    while (begin < end && is_blank(line[begin])) { ++begin; }
+    while (end > begin && is_blank(line[end - 1])) { --end; }
+    if (begin < end && line[begin] == ';') {
+        ++begin;
+        while (begin < end && is_blank(line[begin])) { ++begin; }
+    }
+    return line.substr(begin, end - begin);
+}
+
+// Splits [begin, end) into lines terminated by '\r', '\n' or "\r\n" and calls callback(raw, content) for each of them:
+// raw is the line without the end of line characters, truncated at the first null character, if any,
+// content is line_content(raw).
+// The callback returns false to stop the scanning.
+// Returns the end of the last line passed to the callback, that is the start of the data not yet scanned:
+// the unterminated last line, if not stopped before.
+template<typename Callback>
+const char* scan_lines(const char* begin, const char* end, core::ESimdLevel level, Callback&& callback)
+{
+    const char* line_begin = begin;
+    // last null character found, the lines which may contain it are searched for the first one
+    const char* last_null = nullptr;
+    CharMasks batch[ScanBatchSize];
+    for (const char* batch_begin = begin; batch_begin < end; batch_begin += ScanBatchSize * ScanWindowSize) {
+        const size_t windows_count = std::min<size_t>(ScanBatchSize, (end - batch_begin) / ScanWindowSize);
+        classify_chars(batch_begin, windows_count, batch, level);
+        const size_t batch_size = (windows_count < ScanBatchSize) ? windows_count + 1 : windows_count;
+        for (size_t w = 0; w < batch_size; ++w) {
+            const char* window = batch_begin + w * ScanWindowSize;
+            if (window >= end)
+                break;
+            const CharMasks masks = (w < windows_count) ? batch[w] : classify_tail(window, end, level);
+            const uint64_t valid = (end - window < static_cast<ptrdiff_t>(ScanWindowSize)) ? (uint64_t(1) << (end - window)) - 1 : ~uint64_t(0);
+            uint64_t line_ends = (masks.new_lines | masks.returns) & valid;
+            if (line_begin > window)
+                // the '\n' of a "\r\n" split between two windows
+                line_ends &= ~((uint64_t(1) << (line_begin - window)) - 1);
+            if ((masks.nulls & valid) != 0)
+                last_null = window + 63 - core::count_leading_zeros(masks.nulls & valid);
+            while (line_ends != 0) {
+                const char* line_end = window + core::count_trailing_zeros(line_ends);
+                line_ends &= line_ends - 1;
+                std::string_view raw(line_begin, line_end - line_begin);
+                if (last_null != nullptr && last_null >= line_begin) {
+                    const void* null_char = std::memchr(raw.data(), 0, raw.size());
+                    if (null_char != nullptr)
+                        raw = raw.substr(0, static_cast<const char*>(null_char) - raw.data());
+                }
+                const char* next = line_end + 1;
+                if (*line_end == '\r' && next < end && *next == '\n') {
+                    ++next;
+                    line_ends &= line_ends - 1;
+                }
+                if (!callback(raw, line_content(raw)))
+                    return next;
+                line_begin = next;
+            }
+        }
+    }
+    return line_begin;
+}
+
+}} // bgcode::convert
+
+#endif // _BGCODE_CONVERT_LINE_SCANNER_HPP_
@@ -1,13 +1,29 @@
 #include "core_impl.hpp"
 #include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 namespace bgcode { namespace core {
 
 template<class T>
-static bool write_to_file(FILE& file, const T* data, size_t data_size)
+static bool write_to_sink(OutputSink& sink, const T* data, size_t data_size)
 {
-    const size_t wsize = fwrite(static_cast<const void*>(data), 1, data_size, &file);
-    return !ferror(&file) && wsize == data_size;
+    return sink.write(static_cast<const void*>(data), data_size);
 }
 
 template<class T>
@@ -78,9 +94,15 @@ bool Checksum::matches(Checksum& other)
 }
 
 EResult Checksum::write(FILE& file)
+{
+    FileOutputSink sink(file);
+    return write(sink);
+}
+
+EResult Checksum::write(OutputSink& sink)
 {
     if (m_type != EChecksumType::None) {
-        if (!write_to_file(file, m_checksum.data(), m_size))
+        if (!write_to_sink(sink, m_checksum.data(), m_size))
             return EResult::WriteError;
     }
     return EResult::Success;
@@ -95,6 +117,173 @@ EResult Checksum::read(FILE& file)
     return EResult::Success;
 }
 
+bool FileOutputSink::write(const void* data, size_t data_size)
+{
+    const size_t wsize = fwrite(data, 1, data_size, &m_file);
+    return !ferror(&m_file) && wsize == data_size;
+}
+
+bool FileOutputSink::flush()
+{
+    return fflush(&m_file) == 0;
+}
+
+long FileOutputSink::tell() const
+{
+    return ftell(&m_file);
+}
+
+bool MemoryOutputSink::write(const void* data, size_t data_size)
+{
+    const std::byte* begin = static_cast<const std::byte*>(data);
+    m_data.insert(m_data.end(), begin, begin + data_size);
+    return true;
+}
+
+long MemoryOutputSink::tell() const
+{
+    return static_cast<long>(m_data.size());
+}
+
+std::vector<std::byte> MemoryOutputSink::release()
+{
+    std::vector<std::byte> ret;
+    ret.swap(m_data);
+    return ret;
+}
+
+FdOutputSink::FdOutputSink(int fd, size_t buffer_size)
+    : m_fd(fd), m_buffer(buffer_size)
+{}
+
+FdOutputSink::~FdOutputSink()
+{
+    flush();
+}
+
+bool FdOutputSink::write(const void* data, size_t data_size)
+{
+    const std::byte* src = static_cast<const std::byte*>(data);
+    if (m_buffer_used + data_size > m_buffer.size()) {
+        if (!flush())
+            return false;
+        // data bigger than the buffer are sent directly
+        if (data_size >= m_buffer.size()) {
+            if (!write_to_fd(src, data_size))
+                return false;
+            m_position += static_cast<long>(data_size);
+            return true;
+        }
+    }
+    memcpy(m_buffer.data() + m_buffer_used, src, data_size);
+    m_buffer_used += data_size;
+    m_position += static_cast<long>(data_size);
+    return true;
+}
+
+bool FdOutputSink::flush()
+{
+    if (m_buffer_used == 0)
+        return true;
+    const bool ret = write_to_fd(m_buffer.data(), m_buffer_used);
+    m_buffer_used = 0;
+    return ret;
+}
+
+long FdOutputSink::tell() const
+{
+    return m_position;
+}
+
+bool FdOutputSink::write_to_fd(const std::byte* data, size_t data_size)
+{
+    while (data_size > 0) {
+#ifdef _WIN32
+        const unsigned int chunk = static_cast<unsigned int>(std::min<size_t>(data_size, INT_MAX));
+        const int wsize = ::_write(m_fd, data, chunk);
+#else
+        const ssize_t wsize = ::write(m_fd, data, data_size);
+#endif
+        if (wsize < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += wsize;
+        data_size -= static_cast<size_t>(wsize);
+    }
+    return true;
+}
+
+bool CallbackOutputSink::write(const void* data, size_t data_size)
+{
+    if (!m_callback || !m_callback(data, data_size))
+        return false;
+    m_position += static_cast<long>(data_size);
+    return true;
+}
+
+long CallbackOutputSink::tell() const
+{
+    return m_position;
+}
+
+MappedFile::~MappedFile()
+{
+    unmap();
+}
+
+bool MappedFile::map(FILE& file)
+{
+    unmap();
+    // make sure that buffered data, if any, are in the file
+    fflush(&file);
+#ifdef _WIN32
+    HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(&file)));
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart == 0 || (uint64_t)file_size.QuadPart > SIZE_MAX)
+        return false;
+    HANDLE mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+        return false;
+    const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        CloseHandle(mapping);
+        return false;
+    }
+    m_mapping = mapping;
+    m_size = (size_t)file_size.QuadPart;
+#else
+    const int fd = fileno(&file);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0 || (uint64_t)file_stat.st_size > SIZE_MAX)
+        return false;
+    const void* data = mmap(nullptr, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return false;
+    m_size = (size_t)file_stat.st_size;
+#endif
+    m_data = static_cast<const std::byte*>(data);
+    return true;
+}
+
+void MappedFile::unmap()
+{
+    if (m_data == nullptr)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(m_data);
+    CloseHandle(static_cast<HANDLE>(m_mapping));
+    m_mapping = nullptr;
+#else
+    munmap(const_cast<std::byte*>(m_data), m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
+
 FileHeader::FileHeader()
     : magic{MAGICi32}
     , version{VERSION}
@@ -106,17 +295,23 @@ FileHeader::FileHeader(uint32_t mg, uint32_t ver, uint16_t chk_type)
 {}
 
 EResult FileHeader::write(FILE& file) const
+{
+    FileOutputSink sink(file);
+    return write(sink);
+}
+
+EResult FileHeader::write(OutputSink& sink) const
 {
     if (magic != MAGICi32)
         return EResult::InvalidMagicNumber;
     if (checksum_type >= checksum_types_count())
         return EResult::InvalidChecksumType;
 
-    if (!write_to_file(file, &magic, sizeof(magic)))
+    if (!write_to_sink(sink, &magic, sizeof(magic)))
        return EResult::WriteError;
-    if (!write_to_file(file, &version, sizeof(version)))
+    if (!write_to_sink(sink, &version, sizeof(version)))
         return EResult::WriteError;
-    if (!write_to_file(file, &checksum_type, sizeof(checksum_type)))
+    if (!write_to_sink(sink, &checksum_type, sizeof(checksum_type)))
         return EResult::WriteError;
 
     return EResult::Success;
@@ -156,17 +351,21 @@ long BlockHeader::get_position() const
 
 EResult BlockHeader::write(FILE& file)
 {
-    m_position = ftell(&file);
-    if (!write_to_file(file, &type, sizeof(type)))
-        return EResult::WriteError;
-    if (!write_to_file(file, &compression, sizeof(compression)))
-        return EResult::WriteError;
-    if (!write_to_file(file, &uncompressed_size, sizeof(uncompressed_size)))
+    FileOutputSink sink(file);
+    return write(sink);
+}
+
+EResult BlockHeader::write(OutputSink& sink)
+{
+    m_position = sink.tell();
+    // serialize the header to send it with a single write
+    std::array<uint8_t, sizeof(type) + sizeof(compression) + sizeof(uncompressed_size) + sizeof(compressed_size)> buffer;
+    store_integer_le(type, buffer.begin());
+    store_integer_le(compression, buffer.begin() + 2);
+    store_integer_le(uncompressed_size, buffer.begin() + 4);
+    store_integer_le(compressed_size, buffer.begin() + 8);
+    if (!write_to_sink(sink, buffer.data(), get_size()))
         return EResult::WriteError;
-    if (compression != (uint16_t)ECompressionType::None) {
-        if (!write_to_file(file, &compressed_size, sizeof(compressed_size)))
-            return EResult::WriteError;
-    }
     return EResult::Success;
 }
 
@@ -199,11 +398,16 @@ size_t BlockHeader::get_size() const {
 }
 
 EResult ThumbnailParams::write(FILE& file) const {
-    if (!write_to_file(file, &format, sizeof(format)))
+    FileOutputSink sink(file);
+    return write(sink);
+}
+
+EResult ThumbnailParams::write(OutputSink& sink) const {
+    if (!write_to_sink(sink, &format, sizeof(format)))
         return EResult::WriteError;
-    if (!write_to_file(file, &width, sizeof(width)))
+    if (!write_to_sink(sink, &width, sizeof(width)))
         return EResult::WriteError;
-    if (!write_to_file(file, &height, sizeof(height)))
+    if (!write_to_sink(sink, &height, sizeof(height)))
         return EResult::WriteError;
     return EResult::Success;
 }
@@ -11,6 +11,7 @@
 #include <vector>
 #include <string>
 #include <string_view>
+#include <functional>
 
 namespace bgcode { namespace core {
 
@@ -74,14 +75,16 @@ enum class ECompressionType : uint16_t
 
 enum class EMetadataEncodingType : uint16_t
 {
-    INI
+    INI,
+    Binary
 };
 
 enum class EGCodeEncodingType : uint16_t
 {
     None,
     MeatPack,
-    MeatPackComments
+    MeatPackComments,
+    TokenPack
 };
 
 enum class EThumbnailFormat : uint16_t
@@ -91,6 +94,119 @@ enum class EThumbnailFormat : uint16_t
     QOI
 };
 
+// Destination of the data produced by the write() methods of the library.
+class BGCODE_CORE_EXPORT OutputSink
+{
+public:
+    virtual ~OutputSink() = default;
+
+    // Writes the given data.
+    // Returns false if the data could not be written entirely.
+    virtual bool write(const void* data, size_t data_size) = 0;
+    // Forwards any data cached by the sink to its final destination.
+    virtual bool flush() { return true; }
+    // Returns the current write position, used to set the position of the written blocks.
+    virtual long tell() const = 0;
+};
+
+// Sink writing into a FILE, position is the FILE position.
+class BGCODE_CORE_EXPORT FileOutputSink : public OutputSink
+{
+public:
+    explicit FileOutputSink(FILE& file) : m_file(file) {}
+
+    bool write(const void* data, size_t data_size) override;
+    bool flush() override;
+    long tell() const override;
+
+private:
+    FILE& m_file;
+};
+
+// Sink writing into a growable memory buffer.
+class BGCODE_CORE_EXPORT MemoryOutputSink : public OutputSink
+{
+public:
+    bool write(const void* data, size_t data_size) override;
+    long tell() const override;
+
+    const std::vector<std::byte>& get_data() const { return m_data; }
+    // Moves the written data out of the sink, leaving it empty.
+    std::vector<std::byte> release();
+
+private:
+    std::vector<std::byte> m_data;
+};
+
+// Sink writing into a raw file descriptor (socket, pipe, file) through its own buffer, no stdio involved.
+// The file descriptor is not closed by the sink.
+// Position is the count of bytes written through the sink.
+class BGCODE_CORE_EXPORT FdOutputSink : public OutputSink
+{
+public:
+    explicit FdOutputSink(int fd, size_t buffer_size = 65536);
+    // Flushes the buffered data, errors are lost, call flush() explicitly to detect them.
+    ~FdOutputSink() override;
+
+    FdOutputSink(const FdOutputSink&) = delete;
+    FdOutputSink& operator=(const FdOutputSink&) = delete;
+
+    bool write(const void* data, size_t data_size) override;
+    bool flush() override;
+    long tell() const override;
+
+private:
+    int m_fd;
+    std::vector<std::byte> m_buffer;
+    size_t m_buffer_used{ 0 };
+    long m_position{ 0 };
+
+    bool write_to_fd(const std::byte* data, size_t data_size);
+};
+
+// Sink forwarding the data to a user callback.
+// Position is the count of bytes passed to the callback.
+class BGCODE_CORE_EXPORT CallbackOutputSink : public OutputSink
+{
+public:
+    // The callback must return false if it is unable to consume the data.
+    using Callback = std::function<bool(const void* data, size_t data_size)>;
+
+    explicit CallbackOutputSink(Callback callback) : m_callback(std::move(callback)) {}
+
+    bool write(const void* data, size_t data_size) override;
+    long tell() const override;
+
+private:
+    Callback m_callback;
+    long m_position{ 0 };
+};
+
+// Read only memory mapping of the whole content of a file.
+class BGCODE_CORE_EXPORT MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps the content of the given file, which must be open for reading.
+    // Returns false if the file cannot be mapped (empty files cannot be mapped).
+    bool map(FILE& file);
+    void unmap();
+
+    bool is_mapped() const { return m_data != nullptr; }
+    const std::byte* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const std::byte* m_data{ nullptr };
+    size_t m_size{ 0 };
+    // file mapping object, used on Windows only
+    void* m_mapping{ nullptr };
+};
+
 struct BGCODE_CORE_EXPORT FileHeader
 {
     uint32_t magic;
@@ -101,6 +217,7 @@ struct BGCODE_CORE_EXPORT FileHeader
     FileHeader(uint32_t mg, uint32_t ver, uint16_t chk_type);
 
     EResult write(FILE& file) const;
+    EResult write(OutputSink& sink) const;
     EResult read(FILE& file, const uint32_t* const max_version);
 };
 
@@ -119,6 +236,7 @@ struct BGCODE_CORE_EXPORT BlockHeader
     long get_position() const;
 
     EResult write(FILE& file);
+    EResult write(OutputSink& sink);
     EResult read(FILE& file);
 
     // Returs the size of this BlockHeader, in bytes
@@ -135,6 +253,7 @@ struct BGCODE_CORE_EXPORT ThumbnailParams
     uint16_t height;
 
     EResult write(FILE& file) const;
+    EResult write(OutputSink& sink) const;
     EResult read(FILE& file);
 };
 
@@ -110,6 +110,9 @@ public:
     explicit Checksum(EChecksumType type);
 
     EChecksumType get_type() const noexcept { return m_type; }
+    // Size and raw bytes of the checksum, as stored in the file
+    size_t get_size() const noexcept { return m_size; }
+    const std::byte* get_data() const noexcept { return m_checksum.data(); }
 
     // Append vector of data to checksum
     void append(const std::vector<std::byte>& data);
@@ -126,6 +129,7 @@ public:
     bool matches(Checksum& other);
 
     EResult write(FILE& file);
+    EResult write(OutputSink& sink);
     EResult read(FILE& file);
 
 private:
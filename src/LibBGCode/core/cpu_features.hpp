@@ -0,0 +1,128 @@
+#ifndef CORE_CPU_FEATURES_HPP
+#define CORE_CPU_FEATURES_HPP
+
+#include <cstdint>
+
+//
+// Runtime detection of the instruction set extensions used by the vectorized code paths.
+// Kernels for x86 are compiled with per function target attributes (BGCODE_TARGET), so that the
+// library does not require any specific compiler flag, and are selected at runtime.
+//
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BGCODE_SIMD_X86
+#elif (defined(__aarch64__) || defined(_M_ARM64)) && defined(BGCODE_ENABLE_NEON)
+// NEON is part of the base instruction set, its code paths are enabled by the LibBGCode_ENABLE_NEON option
+#define BGCODE_SIMD_NEON
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#if defined(BGCODE_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define BGCODE_TARGET(isa) __attribute__((target(isa)))
+#else
+#define BGCODE_TARGET(isa)
+#endif
+
+namespace bgcode { namespace core {
+
+enum class ESimdLevel : uint8_t
+{
+    None,
+    SSSE3,
+    AVX2,
+    NEON
+};
+
+// Index of the lowest set bit of the given value, which must not be zero
+inline unsigned int count_trailing_zeros(uint64_t value)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+#if defined(_M_X64) || defined(_M_ARM64)
+    _BitScanForward64(&index, value);
+#else
+    if (!_BitScanForward(&index, static_cast<unsigned long>(value))) {
+        _BitScanForward(&index, static_cast<unsigned long>(value >> 32));
+        index += 32;
+    }
+#endif
+    return static_cast<unsigned int>(index);
+#else
+    return static_cast<unsigned int>(__builtin_ctzll(value));
+#endif
+}
+
+// Count of the zero bits above the highest set bit of the given value, which must not be zero
+inline unsigned int count_leading_zeros(uint64_t value)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+#if defined(_M_X64) || defined(_M_ARM64)
+    _BitScanReverse64(&index, value);
+#else
+    if (_BitScanReverse(&index, static_cast<unsigned long>(value >> 32)))
+        index += 32;
+    else
+        _BitScanReverse(&index, static_cast<unsigned long>(value));
+#endif
+    return 63 - static_cast<unsigned int>(index);
+#else
+    return static_cast<unsigned int>(__builtin_clzll(value));
+#endif
+}
+
+// Best instruction set extension supported by the running CPU, detected once
+inline ESimdLevel detect_simd_level()
+{
+    static const ESimdLevel level = []() {
+#if defined(BGCODE_SIMD_X86)
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return ESimdLevel::AVX2;
+        if (__builtin_cpu_supports("ssse3"))
+            return ESimdLevel::SSSE3;
+#elif defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        const bool ssse3 = (info[2] & (1 << 9)) != 0;
+        // AVX registers must be enabled by the OS
+        const bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+        __cpuidex(info, 7, 0);
+        if (avx && (info[1] & (1 << 5)) != 0)
+            return ESimdLevel::AVX2;
+        if (ssse3)
+            return ESimdLevel::SSSE3;
+#endif
+        return ESimdLevel::None;
+#elif defined(BGCODE_SIMD_NEON)
+        return ESimdLevel::NEON;
+#else
+        return ESimdLevel::None;
+#endif
+    }();
+    return level;
+}
+
+// Returns the given level if supported by the running CPU, otherwise the best supported one lower than it.
+// Used to select a specific code path, for testing.
+inline ESimdLevel supported_simd_level(ESimdLevel level)
+{
+    const ESimdLevel detected = detect_simd_level();
+    switch (level)
+    {
+    case ESimdLevel::SSSE3: { return (detected == ESimdLevel::SSSE3 || detected == ESimdLevel::AVX2) ? level : ESimdLevel::None; }
+    case ESimdLevel::AVX2:  { return (detected == ESimdLevel::AVX2) ? level : supported_simd_level(ESimdLevel::SSSE3); }
+    case ESimdLevel::NEON:  { return (detected == ESimdLevel::NEON) ? level : ESimdLevel::None; }
+    default:
+    case ESimdLevel::None:  { return ESimdLevel::None; }
+    }
+}
+
+} // namespace core
+} // namespace bgcode
+
+#endif // CORE_CPU_FEATURES_HPP
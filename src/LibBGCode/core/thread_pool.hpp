@@ -0,0 +1,89 @@
+#ifndef CORE_THREAD_POOL_HPP
+#define CORE_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace bgcode { namespace core {
+
+// Fixed set of threads running the jobs pushed into a queue, in the order of submission.
+// If no thread can be started, the jobs are run by push() itself.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t threads_count) {
+        for (size_t i = 0; i < threads_count; ++i) {
+            try {
+                m_threads.emplace_back([this]() { run(); });
+            }
+            catch (const std::system_error&) {
+                // threads not supported, or not available
+                break;
+            }
+        }
+    }
+
+    // Jobs not yet started are dropped
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+            m_jobs.clear();
+        }
+        m_condition.notify_all();
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    void push(std::function<void()> job) {
+        if (m_threads.empty()) {
+            job();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back(std::move(job));
+        }
+        m_condition.notify_one();
+    }
+
+private:
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopped{ false };
+
+    void run() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait(lock, [this]() { return m_stopped || !m_jobs.empty(); });
+                if (m_stopped)
+                    return;
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+            job();
+        }
+    }
+};
+
+// Count of threads to use for the given requested count, 0 standing for the count of hardware threads
+inline size_t resolve_threads_count(size_t threads_count)
+{
+    return (threads_count != 0) ? threads_count : std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+} // namespace core
+} // namespace bgcode
+
+#endif // CORE_THREAD_POOL_HPP
@@ -13,18 +13,9 @@ emscripten::val ascii2bgcode_cfg(std::string in, bgcode::binarize::BinarizerConf
 
     FILE * fin = fmemopen(in.data(), in.size(), "r");
 
-    char *outbuf = nullptr;
-    size_t outsz = 0;
+    bgcode::core::MemoryOutputSink out;
 
-    FILE * fout = open_memstream(&outbuf, &outsz);
-
-    if (fout == nullptr) {
-        std::string ferrstr = std::string("console.log('Can not open writable memory stream!')");
-        emscripten_run_script(ferrstr.c_str());
-        return ret;
-    }
-
-    bgcode::core::EResult result = bgcode::convert::from_ascii_to_binary(*fin, *fout, config);
+    bgcode::core::EResult result = bgcode::convert::from_ascii_to_binary(*fin, out, config);
     if (result != bgcode::core::EResult::Success) {
         std::string astr = std::string("console.error('Error when translating gcode: ");
         astr += translate_result(result);
@@ -33,11 +24,10 @@ emscripten::val ascii2bgcode_cfg(std::string in, bgcode::binarize::BinarizerConf
     }
 
     fclose(fin);
-    fclose(fout);
-
-    ret = emscripten::val::array(outbuf, outbuf + outsz);
 
-    free(outbuf);
+    const std::vector<std::byte>& outbuf = out.get_data();
+    const char* outdata = reinterpret_cast<const char*>(outbuf.data());
+    ret = emscripten::val::array(outdata, outdata + outbuf.size());
 
     return ret;
 }
@@ -68,17 +58,12 @@ std::string bgcode2ascii_vf(std::string in, bool verify)
 
     FILE * fin = fmemopen(in.data(), in.size(), "rb");
 
-    char *outbuf = nullptr;
-    size_t outsz = 0;
+    bgcode::core::CallbackOutputSink out([&ret](const void* data, size_t data_size) {
+        ret.append(static_cast<const char*>(data), data_size);
+        return true;
+    });
 
-    FILE * fout = open_memstream(&outbuf, &outsz);
-    if (fout == nullptr) {
-        std::string ferrstr = std::string("console.log('Can not open writable memory stream!')");
-        emscripten_run_script(ferrstr.c_str());
-        return ret;
-    }
-
-    bgcode::core::EResult result = bgcode::convert::from_binary_to_ascii(*fin, *fout, verify);
+    bgcode::core::EResult result = bgcode::convert::from_binary_to_ascii(*fin, out, verify);
     if (result != bgcode::core::EResult::Success) {
         std::string astr = std::string("console.error('Error when translating gcode: ");
         astr += translate_result(result);
@@ -87,11 +72,6 @@ std::string bgcode2ascii_vf(std::string in, bool verify)
     }
 
     fclose(fin);
-    fclose(fout);
-
-    ret.reserve(outsz);
-    std::copy(outbuf, outbuf + outsz, std::back_inserter(ret));
-    free(outbuf);
 
     return ret;
 }
@@ -122,9 +102,11 @@ EMSCRIPTEN_BINDINGS(module) {
     emscripten::enum_<bgcode::core::EGCodeEncodingType>("BGCode_GCodeEncodingType")
         .value("None", bgcode::core::EGCodeEncodingType::None)
         .value("MeatPack", bgcode::core::EGCodeEncodingType::MeatPack)
-        .value("MeatPackComments", bgcode::core::EGCodeEncodingType::MeatPackComments);
+        .value("MeatPackComments", bgcode::core::EGCodeEncodingType::MeatPackComments)
+        .value("TokenPack", bgcode::core::EGCodeEncodingType::TokenPack);
     emscripten::enum_<bgcode::core::EMetadataEncodingType>("BGCode_MetadataEncodingType")
-        .value("INI", bgcode::core::EMetadataEncodingType::INI);
+        .value("INI", bgcode::core::EMetadataEncodingType::INI)
+        .value("Binary", bgcode::core::EMetadataEncodingType::Binary);
     emscripten::enum_<bgcode::core::EChecksumType>("BGCode_ChecksumType")
         .value("None", bgcode::core::EChecksumType::None)
         .value("CRC32", bgcode::core::EChecksumType::CRC32);
@@ -1,9 +1,1076 @@
 #include <catch2/catch_test_macros.hpp>
 
 #include "binarize/binarize.hpp"
+#include "binarize/embedded_decoder.hpp"
+#include "binarize/meatpack.hpp"
+#include "binarize/tokenpack.hpp"
+
+#include <boost/nowide/cstdio.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <atomic>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <new>
+
+// Count of the allocations made by the current thread, used to check that the embedded decoder profile does not allocate
+static thread_local size_t s_allocations_count = 0;
+
+void* operator new(std::size_t size)
+{
+	++s_allocations_count;
+	if (void* ptr = std::malloc(size != 0 ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) { return operator new(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	++s_allocations_count;
+	return std::malloc(size != 0 ? size : 1);
+}
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+class ScopedFile
+{
+public:
+	explicit ScopedFile(FILE* file) : m_file(file) {}
+	~ScopedFile() { if (m_file != nullptr) fclose(m_file); }
+private:
+	FILE* m_file{ nullptr };
+};
 
 TEST_CASE("Dummy", "[Binarize]")
 {
 	REQUIRE(true);
 }
 
+
+using namespace bgcode::core;
+using namespace bgcode::binarize;
+
+TEST_CASE("Single write per block", "[Binarize]")
+{
+	size_t writes_count = 0;
+	std::vector<std::byte> written;
+	CallbackOutputSink sink([&](const void* data, size_t data_size) {
+		++writes_count;
+		const std::byte* bytes = static_cast<const std::byte*>(data);
+		written.insert(written.end(), bytes, bytes + data_size);
+		return true;
+	});
+
+	FileHeader file_header;
+	file_header.checksum_type = (uint16_t)EChecksumType::CRC32;
+	REQUIRE(file_header.write(sink) == EResult::Success);
+
+	PrinterMetadataBlock printer_metadata;
+	printer_metadata.raw_data = { { "printer_model", "MINI" }, { "nozzle_diameter", "0.4" } };
+	ThumbnailBlock thumbnail;
+	thumbnail.params = { (uint16_t)EThumbnailFormat::QOI, 2, 2 };
+	thumbnail.data.assign(16, std::byte{ 0x5a });
+	GCodeBlock gcode;
+	gcode.encoding_type = (uint16_t)EGCodeEncodingType::MeatPackComments;
+	gcode.raw_data = "G1 X10.5 Y20 E0.1\nG1 X11 Y21\n";
+
+	for (ECompressionType compression : { ECompressionType::None, ECompressionType::Deflate, ECompressionType::Heatshrink_12_4 }) {
+		writes_count = 0;
+		REQUIRE(printer_metadata.write(sink, compression, EChecksumType::CRC32) == EResult::Success);
+		REQUIRE(writes_count == 1);
+		writes_count = 0;
+		REQUIRE(gcode.write(sink, compression, EChecksumType::CRC32) == EResult::Success);
+		REQUIRE(writes_count == 1);
+	}
+	writes_count = 0;
+	REQUIRE(thumbnail.write(sink, EChecksumType::CRC32) == EResult::Success);
+	REQUIRE(writes_count == 1);
+
+	// read back the blocks, verifying the checksums
+	FILE* file = std::tmpfile();
+	REQUIRE(file != nullptr);
+	ScopedFile scoped_file(file);
+	REQUIRE(fwrite(written.data(), 1, written.size(), file) == written.size());
+	rewind(file);
+	std::byte cs_buffer[256];
+	FileHeader read_file_header;
+	REQUIRE(read_header(*file, read_file_header, nullptr) == EResult::Success);
+	BlockHeader block_header;
+	for (int i = 0; i < 3; ++i) {
+		REQUIRE(read_next_block_header(*file, read_file_header, block_header, cs_buffer, sizeof(cs_buffer)) == EResult::Success);
+		PrinterMetadataBlock read_metadata;
+		REQUIRE(read_metadata.read_data(*file, read_file_header, block_header) == EResult::Success);
+		REQUIRE(read_metadata.raw_data == printer_metadata.raw_data);
+		REQUIRE(read_next_block_header(*file, read_file_header, block_header, cs_buffer, sizeof(cs_buffer)) == EResult::Success);
+		GCodeBlock read_gcode;
+		REQUIRE(read_gcode.read_data(*file, read_file_header, block_header) == EResult::Success);
+		REQUIRE(read_gcode.raw_data == gcode.raw_data);
+	}
+	REQUIRE(read_next_block_header(*file, read_file_header, block_header, cs_buffer, sizeof(cs_buffer)) == EResult::Success);
+	ThumbnailBlock read_thumbnail;
+	REQUIRE(read_thumbnail.read_data(*file, read_file_header, block_header) == EResult::Success);
+	REQUIRE(read_thumbnail.data == thumbnail.data);
+}
+
+TEST_CASE("Metadata storage", "[Binarize]")
+{
+	const std::string ini = "printer_model=MINI\nextruder_colour=\"\"\nnot an item\nempty=\nformula=a=b\nlast=no newline";
+	MetadataStorage storage;
+	REQUIRE(storage.decode(std::vector<uint8_t>(ini.begin(), ini.end()), EMetadataEncodingType::INI));
+	const std::vector<std::pair<std::string, std::string>> expected = {
+		{ "printer_model", "MINI" }, { "extruder_colour", "\"\"" }, { "empty", "" }, { "formula", "a=b" }, { "last", "no newline" }
+	};
+	REQUIRE(storage.size() == expected.size());
+	REQUIRE(storage.to_vector() == expected);
+	REQUIRE(storage[3].first == "formula");
+	REQUIRE(storage.begin()->second == "MINI");
+
+	storage.emplace_back("added", "value");
+	REQUIRE(storage.size() == expected.size() + 1);
+	REQUIRE(storage[expected.size()] == MetadataStorage::value_type("added", "value"));
+
+	REQUIRE(storage.decode({}, EMetadataEncodingType::INI));
+	REQUIRE(storage.empty());
+
+	// read back a block both in storage and in raw_data form
+	SlicerMetadataBlock block;
+	block.raw_data = expected;
+	FILE* file = std::tmpfile();
+	REQUIRE(file != nullptr);
+	ScopedFile scoped_file(file);
+	FileHeader file_header;
+	file_header.checksum_type = (uint16_t)EChecksumType::CRC32;
+	REQUIRE(block.write(*file, ECompressionType::Deflate, EChecksumType::CRC32) == EResult::Success);
+	rewind(file);
+	BlockHeader block_header;
+	REQUIRE(block_header.read(*file) == EResult::Success);
+	SlicerMetadataBlock read_block;
+	REQUIRE(read_block.read_data(*file, file_header, block_header, storage) == EResult::Success);
+	REQUIRE(storage.to_vector() == expected);
+	REQUIRE(read_block.raw_data.empty());
+	rewind(file);
+	REQUIRE(block_header.read(*file) == EResult::Success);
+	REQUIRE(read_block.read_data(*file, file_header, block_header) == EResult::Success);
+	REQUIRE(read_block.raw_data == expected);
+}
+
+TEST_CASE("Find metadata", "[Binarize]")
+{
+	// hashed index and linear search return the first of duplicated keys
+	MetadataStorage storage;
+	for (int i = 0; i < 100; ++i) {
+		storage.emplace_back("key_" + std::to_string(i), std::to_string(i));
+	}
+	storage.emplace_back("key_7", "duplicate");
+	REQUIRE(storage.find("key_7") == "7");
+	REQUIRE(!storage.find("key_100").has_value());
+	storage.build_index();
+	for (int i = 0; i < 100; ++i) {
+		REQUIRE(storage.find("key_" + std::to_string(i)) == std::to_string(i));
+	}
+	REQUIRE(storage.find("key_7") == "7");
+	REQUIRE(!storage.find("key_100").has_value());
+
+	const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+	FILE* file = boost::nowide::fopen(filename.c_str(), "rb");
+	REQUIRE(file != nullptr);
+	ScopedFile scoped_file(file);
+
+	FileHeader file_header;
+	REQUIRE(read_header(*file, file_header, nullptr) == EResult::Success);
+	for (EBlockType type : { EBlockType::FileMetadata, EBlockType::PrinterMetadata, EBlockType::PrintMetadata, EBlockType::SlicerMetadata }) {
+		// reference: the whole block
+		rewind(file);
+		REQUIRE(read_header(*file, file_header, nullptr) == EResult::Success);
+		BlockHeader block_header;
+		REQUIRE(read_next_block_header(*file, file_header, block_header, type, nullptr, 0) == EResult::Success);
+		SlicerMetadataBlock block;
+		REQUIRE(block.read_data(*file, file_header, block_header, storage) == EResult::Success);
+		REQUIRE(!storage.empty());
+
+		const std::vector<std::string_view> keys = { storage[storage.size() - 1].first, "missing key", storage[0].first, storage[storage.size() / 2].first };
+		std::vector<std::optional<std::string>> values;
+		REQUIRE(find_metadata(*file, type, keys, values) == EResult::Success);
+		REQUIRE(values.size() == keys.size());
+		REQUIRE(values[0] == std::string(storage[storage.size() - 1].second));
+		REQUIRE(!values[1].has_value());
+		REQUIRE(values[2] == std::string(storage[0].second));
+		REQUIRE(values[3] == std::string(storage.find(keys[3]).value()));
+
+		std::optional<std::string> value;
+		REQUIRE(find_metadata(*file, type, storage[0].first, value) == EResult::Success);
+		REQUIRE(value == std::string(storage[0].second));
+	}
+
+	std::optional<std::string> value;
+	REQUIRE(find_metadata(*file, EBlockType::GCode, "key", value) == EResult::InvalidBlockType);
+
+	// block larger than the chunks used for reading
+	for (ECompressionType compression : { ECompressionType::None, ECompressionType::Heatshrink_11_4, ECompressionType::Heatshrink_12_4, ECompressionType::Deflate }) {
+		MemoryOutputSink sink;
+		FileHeader header;
+		header.checksum_type = (uint16_t)EChecksumType::CRC32;
+		REQUIRE(header.write(sink) == EResult::Success);
+		PrinterMetadataBlock printer_block;
+		for (int i = 0; i < 1000; ++i) {
+			printer_block.raw_data.emplace_back("key_" + std::to_string(i), "value_" + std::to_string(i));
+		}
+		REQUIRE(printer_block.write(sink, compression, EChecksumType::CRC32) == EResult::Success);
+		FILE* mem_file = std::tmpfile();
+		REQUIRE(mem_file != nullptr);
+		ScopedFile scoped_mem_file(mem_file);
+		REQUIRE(fwrite(sink.get_data().data(), 1, sink.get_data().size(), mem_file) == sink.get_data().size());
+		std::vector<std::optional<std::string>> values;
+		REQUIRE(find_metadata(*mem_file, EBlockType::PrinterMetadata, { "key_999", "key_0", "key_500" }, values) == EResult::Success);
+		REQUIRE(values == std::vector<std::optional<std::string>>{ "value_999", "value_0", "value_500" });
+		// the search stops as soon as the key is found
+		REQUIRE(find_metadata(*mem_file, EBlockType::PrinterMetadata, { "key_0" }, values) == EResult::Success);
+		REQUIRE(values.front() == "value_0");
+		REQUIRE(ftell(mem_file) < (long)sink.get_data().size());
+		REQUIRE(find_metadata(*mem_file, EBlockType::SlicerMetadata, { "key_0" }, values) == EResult::BlockNotFound);
+	}
+}
+
+TEST_CASE("Binary metadata encoding", "[Binarize]")
+{
+	PrinterMetadataBlock block;
+	block.encoding_type = (uint16_t)EMetadataEncodingType::Binary;
+	block.raw_data = {
+		{ "printer_model", "MINI" }, { "support_material", "0" }, { "support_material_angle", "0" },
+		{ "support_material_auto", "1" }, { "custom key", "" }, { "", "empty key" }, { "long value", std::string(300, 'x') },
+		{ "Producer", "PrusaSlicer" }, { "support_material_auto", "duplicated" }, { "multi\nline key", "multi\nline\nvalue\n" },
+		{ std::string(300, 'k') + "1", "long key" }, { std::string(300, 'k') + "2", "long shared prefix" }
+	};
+	MemoryOutputSink sink;
+	REQUIRE(block.write(sink, ECompressionType::None, EChecksumType::None) == EResult::Success);
+
+	// skip block header (8 bytes) and encoding (2 bytes)
+	const std::vector<std::byte>& written = sink.get_data();
+	const std::vector<uint8_t> payload(reinterpret_cast<const uint8_t*>(written.data()) + 10, reinterpret_cast<const uint8_t*>(written.data()) + written.size());
+	MetadataStorage storage;
+	REQUIRE(storage.decode(std::vector<uint8_t>(payload), EMetadataEncodingType::Binary));
+	REQUIRE(storage.to_vector() == block.raw_data);
+
+	// the count of items, then the keys, interned ones taking a single byte
+	REQUIRE(payload[0] == block.raw_data.size());
+	REQUIRE(payload[1] == 1);
+
+	// truncated data are rejected, leaving no item
+	for (size_t size = 1; size < payload.size(); ++size) {
+		REQUIRE(!storage.decode(std::vector<uint8_t>(payload.begin(), payload.begin() + size), EMetadataEncodingType::Binary));
+		REQUIRE(storage.size() == 0);
+	}
+	REQUIRE(storage.decode({}, EMetadataEncodingType::Binary));
+	REQUIRE(storage.size() == 0);
+	// corrupted data are rejected
+	REQUIRE(!storage.decode({ 0x7f }, EMetadataEncodingType::Binary));
+	REQUIRE(!storage.decode({ 0x01, 0x00, 0x00 }, EMetadataEncodingType::Binary));
+	REQUIRE(!storage.decode({ 0x01, 0x02, 0x00, 0x00 }, EMetadataEncodingType::Binary));
+	REQUIRE(!storage.decode({ 0x01, 0x3d, 0x00 }, EMetadataEncodingType::Binary));
+	REQUIRE(!storage.decode({ 0x01, 0x01, 0x05 }, EMetadataEncodingType::Binary));
+	REQUIRE(!storage.decode({ 0x01, 0x01, 0x00, 'x' }, EMetadataEncodingType::Binary));
+	REQUIRE(!storage.decode({ 0xff, 0xff, 0xff, 0xff, 0x7f }, EMetadataEncodingType::Binary));
+	REQUIRE(storage.decode({ 0x01, 0x01, 0x00 }, EMetadataEncodingType::Binary));
+	REQUIRE(storage.to_vector() == std::vector<std::pair<std::string, std::string>>{ { "printer_model", "" } });
+	REQUIRE(storage.decode({ 0x01, 0x00, 0x01, 0x01, 'k', 'v' }, EMetadataEncodingType::Binary));
+	REQUIRE(storage.to_vector() == std::vector<std::pair<std::string, std::string>>{ { "k", "v" } });
+
+	// a key shares at most 255 bytes with the previous one
+	auto shared_prefix_data = [](uint8_t prefix_low, uint8_t prefix_high) {
+		std::vector<uint8_t> data = { 0x02, 0x00, 0xac, 0x02, prefix_low, prefix_high, 0x00, 0x00, 0x00 };
+		data.insert(data.end(), 300, 'k');
+		return data;
+	};
+	REQUIRE(storage.decode(shared_prefix_data(0xfe, 0x03), EMetadataEncodingType::Binary));
+	REQUIRE(storage[1].first == std::string(255, 'k'));
+	REQUIRE(!storage.decode(shared_prefix_data(0x80, 0x04), EMetadataEncodingType::Binary));
+
+	// the uncompressed size of the block header is not trusted when searching keys
+	FILE* file = std::tmpfile();
+	REQUIRE(file != nullptr);
+	ScopedFile scoped_file(file);
+	FileHeader file_header;
+	file_header.checksum_type = (uint16_t)EChecksumType::None;
+	REQUIRE(file_header.write(*file) == EResult::Success);
+	BlockHeader block_header((uint16_t)EBlockType::PrinterMetadata, (uint16_t)ECompressionType::None, 0xfffffff0);
+	REQUIRE(block_header.write(*file) == EResult::Success);
+	const uint16_t encoding_type = (uint16_t)EMetadataEncodingType::Binary;
+	REQUIRE(fwrite(&encoding_type, sizeof(encoding_type), 1, file) == 1);
+	REQUIRE(fwrite(payload.data(), 1, payload.size(), file) == payload.size());
+	std::optional<std::string> value;
+	REQUIRE(find_metadata(*file, EBlockType::PrinterMetadata, "printer_model", value) == EResult::ReadError);
+}
+
+TEST_CASE("Thumbnail handles", "[Binarize]")
+{
+	const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+	FILE* file = boost::nowide::fopen(filename.c_str(), "rb");
+	REQUIRE(file != nullptr);
+	ScopedFile scoped_file(file);
+
+	FileHeader file_header;
+	REQUIRE(read_header(*file, file_header, nullptr) == EResult::Success);
+	std::vector<ThumbnailHandle> handles;
+	std::vector<ThumbnailBlock> blocks;
+	BlockHeader block_header;
+	while (read_next_block_header(*file, file_header, block_header, EBlockType::Thumbnail, nullptr, 0) == EResult::Success) {
+		const long params_pos = ftell(file);
+		ThumbnailHandle handle;
+		REQUIRE(handle.read(*file, file_header, block_header) == EResult::Success);
+		const long next_block_pos = ftell(file);
+		// reference: the whole block
+		REQUIRE(fseek(file, params_pos, SEEK_SET) == 0);
+		ThumbnailBlock block;
+		REQUIRE(block.read_data(*file, file_header, block_header) == EResult::Success);
+		REQUIRE(ftell(file) == next_block_pos);
+		handles.push_back(handle);
+		blocks.push_back(std::move(block));
+	}
+	REQUIRE(handles.size() == 2);
+
+	MappedFile mapped_file;
+	REQUIRE(mapped_file.map(*file));
+	for (size_t i = 0; i < handles.size(); ++i) {
+		const ThumbnailHandle& handle = handles[i];
+		const ThumbnailBlock& block = blocks[i];
+		REQUIRE(handle.params.format == block.params.format);
+		REQUIRE(handle.params.width == block.params.width);
+		REQUIRE(handle.params.height == block.params.height);
+		REQUIRE(handle.data_size == block.data.size());
+
+		std::vector<std::byte> data;
+		REQUIRE(handle.load_data(*file, data) == EResult::Success);
+		REQUIRE(data == block.data);
+
+		const std::byte* mapped_data = handle.get_data(mapped_file);
+		REQUIRE(mapped_data != nullptr);
+		REQUIRE(std::equal(block.data.begin(), block.data.end(), mapped_data));
+
+		MemoryOutputSink sink;
+		REQUIRE(handle.copy_data(*file, sink) == EResult::Success);
+		REQUIRE(sink.get_data() == block.data);
+	}
+	mapped_file.unmap();
+	REQUIRE(!mapped_file.is_mapped());
+	REQUIRE(handles.front().get_data(mapped_file) == nullptr);
+}
+
+TEST_CASE("Select thumbnail", "[Binarize]")
+{
+	MemoryOutputSink sink;
+	FileHeader file_header;
+	file_header.checksum_type = (uint16_t)EChecksumType::CRC32;
+	REQUIRE(file_header.write(sink) == EResult::Success);
+	PrinterMetadataBlock printer_metadata;
+	printer_metadata.raw_data = { { "printer_model", "MINI" } };
+	REQUIRE(printer_metadata.write(sink, ECompressionType::None, EChecksumType::CRC32) == EResult::Success);
+	const std::vector<ThumbnailParams> params = {
+		{ (uint16_t)EThumbnailFormat::PNG, 16, 16 },
+		{ (uint16_t)EThumbnailFormat::QOI, 16, 16 },
+		{ (uint16_t)EThumbnailFormat::PNG, 220, 124 },
+		{ (uint16_t)EThumbnailFormat::QOI, 480, 240 },
+		{ (uint16_t)EThumbnailFormat::PNG, 640, 480 },
+	};
+	for (size_t i = 0; i < params.size(); ++i) {
+		ThumbnailBlock thumbnail;
+		thumbnail.params = params[i];
+		thumbnail.data.assign(8 + i, std::byte(i));
+		REQUIRE(thumbnail.write(sink, EChecksumType::CRC32) == EResult::Success);
+	}
+	GCodeBlock gcode;
+	gcode.raw_data = "G1 X10\n";
+	REQUIRE(gcode.write(sink, ECompressionType::None, EChecksumType::CRC32) == EResult::Success);
+
+	FILE* file = std::tmpfile();
+	REQUIRE(file != nullptr);
+	ScopedFile scoped_file(file);
+	REQUIRE(fwrite(sink.get_data().data(), 1, sink.get_data().size(), file) == sink.get_data().size());
+
+	// returns the index of the selected thumbnail
+	auto select = [file, &params](uint16_t width, uint16_t height, const std::vector<EThumbnailFormat>& formats) {
+		ThumbnailBlock thumbnail;
+		REQUIRE(select_thumbnail(*file, width, height, formats, thumbnail) == EResult::Success);
+		const size_t id = thumbnail.data.size() - 8;
+		REQUIRE(thumbnail.params.format == params[id].format);
+		REQUIRE(thumbnail.params.width == params[id].width);
+		REQUIRE(thumbnail.data == std::vector<std::byte>(8 + id, std::byte(id)));
+		return id;
+	};
+	REQUIRE(select(16, 16, {}) == 0);
+	REQUIRE(select(16, 16, { EThumbnailFormat::QOI }) == 1);
+	REQUIRE(select(200, 100, {}) == 2);
+	REQUIRE(select(200, 100, { EThumbnailFormat::QOI, EThumbnailFormat::PNG }) == 3);
+	REQUIRE(select(1000, 1000, {}) == 4);
+	REQUIRE(select(1000, 1000, { EThumbnailFormat::QOI }) == 3);
+	REQUIRE(select(1000, 1000, { EThumbnailFormat::JPG }) == 4);
+	REQUIRE(select(400, 400, {}) == 4);
+
+	// scanning stops at the first block following the thumbnails
+	ThumbnailHandle handle;
+	REQUIRE(select_thumbnail(*file, 16, 16, {}, handle) == EResult::Success);
+	REQUIRE(ftell(file) < (long)sink.get_data().size());
+
+	// no thumbnails
+	FILE* empty_file = std::tmpfile();
+	REQUIRE(empty_file != nullptr);
+	ScopedFile scoped_empty_file(empty_file);
+	REQUIRE(file_header.write(*empty_file) == EResult::Success);
+	REQUIRE(printer_metadata.write(*empty_file, ECompressionType::None, EChecksumType::CRC32) == EResult::Success);
+	REQUIRE(select_thumbnail(*empty_file, 16, 16, {}, handle) == EResult::BlockNotFound);
+}
+
+TEST_CASE("Streaming binarizer", "[Binarize]")
+{
+	FileMetadataBlock file_metadata;
+	file_metadata.raw_data = { { "Producer", "test" } };
+	PrinterMetadataBlock printer_metadata;
+	printer_metadata.raw_data = { { "printer_model", "MINI" } };
+	ThumbnailBlock thumbnail;
+	thumbnail.params = { (uint16_t)EThumbnailFormat::PNG, 16, 16 };
+	thumbnail.data.assign(32, std::byte{ 0x11 });
+	PrintMetadataBlock print_metadata;
+	print_metadata.raw_data = { { "filament used [mm]", "123.4" } };
+	SlicerMetadataBlock slicer_metadata;
+	slicer_metadata.raw_data = { { "layer_height", "0.2" } };
+	const std::string gcode = "G1 X10\nG1 Y10\n";
+
+	BinarizerConfig config;
+	config.compression.slicer_metadata = ECompressionType::Deflate;
+	config.metadata_encoding = EMetadataEncodingType::INI;
+
+	// reference: all the blocks collected before initialize()
+	MemoryOutputSink expected_sink;
+	{
+		Binarizer binarizer;
+		binarizer.set_enabled(true);
+		BinaryData& binary_data = binarizer.get_binary_data();
+		binary_data.file_metadata = file_metadata;
+		binary_data.printer_metadata = printer_metadata;
+		binary_data.thumbnails = { thumbnail, thumbnail };
+		binary_data.print_metadata = print_metadata;
+		binary_data.slicer_metadata = slicer_metadata;
+		REQUIRE(binarizer.initialize(expected_sink, config) == EResult::Success);
+		REQUIRE(binarizer.append_gcode(gcode) == EResult::Success);
+		REQUIRE(binarizer.finalize() == EResult::Success);
+	}
+
+	MemoryOutputSink sink;
+	Binarizer binarizer;
+	binarizer.set_enabled(true);
+	REQUIRE(binarizer.begin(sink, config) == EResult::Success);
+	REQUIRE(binarizer.write_thumbnail(thumbnail) == EResult::InvalidSequenceOfBlocks);
+	REQUIRE(binarizer.write_file_metadata(file_metadata) == EResult::Success);
+	REQUIRE(binarizer.write_file_metadata(file_metadata) == EResult::InvalidSequenceOfBlocks);
+	REQUIRE(binarizer.write_printer_metadata(printer_metadata) == EResult::Success);
+	REQUIRE(binarizer.write_slicer_metadata(slicer_metadata) == EResult::InvalidSequenceOfBlocks);
+	REQUIRE(binarizer.write_thumbnail(thumbnail) == EResult::Success);
+	REQUIRE(binarizer.write_thumbnail(thumbnail) == EResult::Success);
+	REQUIRE(binarizer.append_gcode(gcode) == EResult::InvalidSequenceOfBlocks);
+	REQUIRE(binarizer.write_print_metadata(print_metadata) == EResult::Success);
+	REQUIRE(binarizer.write_thumbnail(thumbnail) == EResult::InvalidSequenceOfBlocks);
+	REQUIRE(binarizer.write_slicer_metadata(slicer_metadata) == EResult::Success);
+	REQUIRE(binarizer.append_gcode(gcode) == EResult::Success);
+	REQUIRE(binarizer.finalize() == EResult::Success);
+	REQUIRE(binarizer.append_gcode(gcode) == EResult::InvalidSequenceOfBlocks);
+	REQUIRE(sink.get_data() == expected_sink.get_data());
+	REQUIRE(binarizer.get_binary_data().thumbnails.empty());
+
+	// mandatory blocks
+	REQUIRE(binarizer.begin(sink, config) == EResult::Success);
+	PrinterMetadataBlock empty_printer_metadata;
+	REQUIRE(binarizer.write_printer_metadata(empty_printer_metadata) == EResult::MissingPrinterMetadata);
+
+	// gcode and the given count of thumbnails spooled before begin(), which must be passed a config producing the same blocks
+	auto spool = [&](const BinarizerConfig& begin_config, MemoryOutputSink& spool_sink, size_t spooled_thumbnails_count = 0) {
+		Binarizer spool_binarizer;
+		spool_binarizer.set_enabled(true);
+		REQUIRE(spool_binarizer.spool_thumbnail(thumbnail) == EResult::InvalidSequenceOfBlocks);
+		REQUIRE(spool_binarizer.begin_gcode_spool(config) == EResult::Success);
+		REQUIRE(spool_binarizer.append_gcode(gcode) == EResult::Success);
+		for (size_t i = 0; i < spooled_thumbnails_count; ++i) {
+			REQUIRE(spool_binarizer.spool_thumbnail(thumbnail) == EResult::Success);
+		}
+		const EResult res = spool_binarizer.begin(spool_sink, begin_config);
+		if (res != EResult::Success)
+			return res;
+		REQUIRE(spool_binarizer.spool_thumbnail(thumbnail) == EResult::InvalidSequenceOfBlocks);
+		REQUIRE(spool_binarizer.write_file_metadata(file_metadata) == EResult::Success);
+		REQUIRE(spool_binarizer.write_printer_metadata(printer_metadata) == EResult::Success);
+		for (size_t i = spooled_thumbnails_count; i < 2; ++i) {
+			REQUIRE(spool_binarizer.write_thumbnail(thumbnail) == EResult::Success);
+		}
+		REQUIRE(spool_binarizer.write_print_metadata(print_metadata) == EResult::Success);
+		REQUIRE(spool_binarizer.write_slicer_metadata(slicer_metadata) == EResult::Success);
+		return spool_binarizer.finalize();
+	};
+	for (size_t spooled_thumbnails_count = 0; spooled_thumbnails_count <= 2; ++spooled_thumbnails_count) {
+		MemoryOutputSink spool_sink;
+		REQUIRE(spool(config, spool_sink, spooled_thumbnails_count) == EResult::Success);
+		REQUIRE(spool_sink.get_data() == expected_sink.get_data());
+	}
+
+	BinarizerConfig other_config = config;
+	other_config.checksum = EChecksumType::None;
+	MemoryOutputSink rejected_sink;
+	REQUIRE(spool(other_config, rejected_sink) == EResult::InvalidChecksumType);
+	other_config = config;
+	other_config.compression.gcode = ECompressionType::Heatshrink_12_4;
+	REQUIRE(spool(other_config, rejected_sink) == EResult::InvalidCompressionType);
+	other_config = config;
+	other_config.gcode_encoding = EGCodeEncodingType::MeatPack;
+	REQUIRE(spool(other_config, rejected_sink) == EResult::InvalidGCodeEncodingType);
+	REQUIRE(rejected_sink.get_data().empty());
+}
+
+static std::string load_text_file(const std::string& filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	REQUIRE(file.good());
+	std::stringstream ss;
+	ss << file.rdbuf();
+	return ss.str();
+}
+
+// gcode lines made of random characters, biased toward the ones which MeatPack handles specially
+static std::string random_gcode(size_t lines_count, unsigned int seed)
+{
+	static const std::string alphabet = "G0123456789.XYZEFSMxyzegf *;\t\r";
+	std::mt19937 rng(seed);
+	std::string ret;
+	for (size_t i = 0; i < lines_count; ++i) {
+		const size_t line_size = rng() % 40;
+		if (rng() % 4 == 0)
+			ret += "G1 ";
+		for (size_t j = 0; j < line_size; ++j) {
+			ret += (rng() % 50 == 0) ? static_cast<char>(rng() % 256) : alphabet[rng() % alphabet.size()];
+		}
+		ret += '\n';
+	}
+	return ret;
+}
+
+// reference encoder, line by line
+static std::vector<uint8_t> meatpack_lines(const std::string& src, uint8_t flags)
+{
+	std::vector<uint8_t> dst;
+	MeatPack::MPBinarizer binarizer(flags);
+	binarizer.initialize(dst);
+	size_t begin = 0;
+	while (begin < src.size()) {
+		const size_t end = src.find('\n', begin);
+		const size_t line_end = (end == std::string::npos) ? src.size() : end + 1;
+		binarizer.binarize_line(src.substr(begin, line_end - begin), dst);
+		begin = line_end;
+	}
+	binarizer.finalize(dst);
+	return dst;
+}
+
+static const std::vector<std::pair<const char*, bgcode::core::ESimdLevel>> SimdLevels = {
+	{ "scalar", bgcode::core::ESimdLevel::None },
+	{ "SSSE3", bgcode::core::ESimdLevel::SSSE3 },
+	{ "AVX2", bgcode::core::ESimdLevel::AVX2 },
+	{ "NEON", bgcode::core::ESimdLevel::NEON }
+};
+
+static const std::vector<uint8_t> MeatPackFlags = {
+	MeatPack::Flag_OmitWhitespaces,
+	MeatPack::Flag_OmitWhitespaces | MeatPack::Flag_RemoveComments,
+	0,
+	MeatPack::Flag_RemoveComments
+};
+
+TEST_CASE("MeatPack block encoder", "[Binarize]")
+{
+	std::vector<std::string> inputs = { load_text_file(std::string(TEST_DATA_DIR) + "/mini_cube_a.gcode"),
+		"G1 X1 Y2*12 ; comment\n  \t\n;only comment\nM73 P0 R5\ng1 x1.5 e2\n\r\nG1 X1\r\n",
+		"g1 x10.5 y20.25 z0.3 e1.2345 f1800 x 1 *77\nG1 X10.5 Y20.25 Z0.3 E1.2345 F1800\nM117 A\tB\n" + std::string(40, '\0') + "\n",
+		// lines longer than the staging buffer
+		"G1 X1\ng1 x" + std::string(20000, '5') + " e1\nM117 " + std::string(9000, 'a') + "\nG1 Y2\n" };
+	for (unsigned int seed = 0; seed < 20; ++seed) {
+		inputs.emplace_back(random_gcode(500, seed));
+	}
+#if defined(BGCODE_SIMD_NEON)
+	// the NEON code paths, enabled by LibBGCode_ENABLE_NEON, are the ones tested
+	REQUIRE(bgcode::core::supported_simd_level(bgcode::core::ESimdLevel::NEON) == bgcode::core::ESimdLevel::NEON);
+#endif
+	for (const std::string& input : inputs) {
+		for (uint8_t flags : MeatPackFlags) {
+			const std::vector<uint8_t> expected = meatpack_lines(input, flags);
+			for (const auto& [name, level] : SimdLevels) {
+				std::vector<uint8_t> encoded = { 0xAB };
+				MeatPack::MPBinarizer binarizer(flags);
+				binarizer.set_simd_level(level);
+				binarizer.binarize(input, encoded);
+				REQUIRE(encoded.front() == 0xAB);
+				REQUIRE(std::equal(encoded.begin() + 1, encoded.end(), expected.begin(), expected.end()));
+			}
+		}
+	}
+}
+
+TEST_CASE("MeatPack decoder", "[Binarize]")
+{
+	const std::string gcode = "G1 X10.5 Y20 E1.5 F1800\nM73 P0 R5\n; comment\ng2 x1 y2 i3 j4\nG1X1\n\nG28 W\nM117 Hello\n";
+	auto decode = [](const std::vector<uint8_t>& src) {
+		std::string dst = "prefix";
+		MeatPack::unbinarize(src, dst);
+		REQUIRE(dst.substr(0, 6) == "prefix");
+		return dst.substr(6);
+	};
+	for (uint8_t flags : MeatPackFlags) {
+		std::vector<uint8_t> encoded;
+		MeatPack::MPBinarizer binarizer(flags);
+		binarizer.binarize(gcode, encoded);
+		// spaces are added between the G lines parameters, empty lines are removed
+		const std::string expected = ((flags & MeatPack::Flag_RemoveComments) != 0) ?
+			"G1 X10.5 Y20 E1.5 F1800\nM73 P0 R5\ng2 x1 y2 i3 j4\nG1 X1\nG28 W\nM117 Hello\n" :
+			"G1 X10.5 Y20 E1.5 F1800\nM73 P0 R5\n; comment\ng2 x1 y2 i3 j4\nG1 X1\nG28 W\nM117 Hello\n";
+		REQUIRE(decode(encoded) == expected);
+	}
+
+	// unpacked data
+	REQUIRE(decode({ 'G', '1', 'X', '1', '\n', '\n', 'M', '1' }) == "G1 X1\nM1");
+	// a signal byte not followed by a second one is a character
+	REQUIRE(decode({ 0xFF, 'A', 0xFF, 0xFF, 0xFB, 0x0F, 0xFF, 0xF9 }) == "\xFF" "A\xFF" "09");
+	// packed space and 'E', depending on the EnableNoSpaces command
+	REQUIRE(decode({ 0xFF, 0xFF, 0xFB, 0xB1, 0xFF, 0xFF, 0xF7, 0xB1, 0xFF, 0xFF, 0xF6, 0xB1 }) == "1 1E1 ");
+}
+
+TEST_CASE("MeatPack vectorized decoder", "[Binarize]")
+{
+	std::vector<std::vector<uint8_t>> inputs;
+	for (unsigned int seed = 0; seed < 20; ++seed) {
+		for (uint8_t flags : MeatPackFlags) {
+			std::vector<uint8_t> encoded;
+			MeatPack::MPBinarizer binarizer(flags);
+			binarizer.binarize(random_gcode(500, seed), encoded);
+			inputs.emplace_back(std::move(encoded));
+		}
+	}
+	// packed data with few full width characters and commands, the random characters being used as packed pairs
+	std::mt19937 rng(0);
+	for (size_t i = 0; i < 200; ++i) {
+		std::vector<uint8_t> input = { 0xFF, 0xFF, 0xFB };
+		if (i % 2 == 0)
+			input.insert(input.end(), { 0xFF, 0xFF, 0xF7 });
+		const size_t size = rng() % 10000;
+		for (size_t j = 0; j < size; ++j) {
+			const uint32_t r = rng();
+			input.emplace_back((r % 64 == 0) ? static_cast<uint8_t>(r >> 8) : static_cast<uint8_t>(((r >> 8) % 15) | (((r >> 16) % 15) << 4)));
+		}
+		inputs.emplace_back(std::move(input));
+	}
+
+#if defined(BGCODE_SIMD_NEON)
+	// the NEON code paths, enabled by LibBGCode_ENABLE_NEON, are the ones tested
+	REQUIRE(bgcode::core::supported_simd_level(bgcode::core::ESimdLevel::NEON) == bgcode::core::ESimdLevel::NEON);
+#endif
+	for (const std::vector<uint8_t>& input : inputs) {
+		std::string expected;
+		MeatPack::unbinarize(input, expected, bgcode::core::ESimdLevel::None);
+		for (const auto& [name, level] : SimdLevels) {
+			std::string decoded;
+			MeatPack::unbinarize(input, decoded, level);
+			REQUIRE(decoded == expected);
+		}
+	}
+}
+
+TEST_CASE("MeatPack streaming decoder", "[Binarize]")
+{
+	std::vector<std::vector<uint8_t>> inputs;
+	for (uint8_t flags : MeatPackFlags) {
+		std::vector<uint8_t> encoded;
+		MeatPack::MPBinarizer binarizer(flags);
+		binarizer.binarize(load_text_file(std::string(TEST_DATA_DIR) + "/mini_cube_a.gcode"), encoded);
+		inputs.emplace_back(std::move(encoded));
+		for (unsigned int seed = 0; seed < 5; ++seed) {
+			encoded.clear();
+			binarizer.binarize(random_gcode(500, seed), encoded);
+			inputs.emplace_back(std::move(encoded));
+		}
+	}
+	// chunks ending inside the commands, the full width characters and the lines
+	inputs.push_back({ 0xFF, 0xFF, 0xFB, 0xFF, 0xFF, 0xF7, 0x1D, 0xCE, 0xCC, 0xDC, 0xCC, 0xE1, 0x0F, 'A', 0xFF, 0xFF, 0xF6, 0x1D, 0xBE, 0xF1 });
+
+	for (const std::vector<uint8_t>& input : inputs) {
+		std::string expected;
+		MeatPack::unbinarize(input, expected);
+		for (const auto& [name, level] : SimdLevels) {
+			for (size_t chunk_size : { size_t(1), size_t(3), size_t(1000), size_t(4096) }) {
+				std::string decoded;
+				CallbackOutputSink sink([&decoded](const void* data, size_t data_size) {
+					decoded.append(static_cast<const char*>(data), data_size);
+					return true;
+				});
+				MeatPack::MPUnbinarizer unbinarizer(level);
+				bool written = true;
+				for (size_t begin = 0; begin < input.size(); begin += chunk_size) {
+					written &= unbinarizer.unbinarize(input.data() + begin, std::min(chunk_size, input.size() - begin), sink);
+				}
+				REQUIRE(written);
+				REQUIRE(decoded == expected);
+			}
+		}
+	}
+
+	// sink failures are reported
+	CallbackOutputSink failing_sink([](const void*, size_t) { return false; });
+	MeatPack::MPUnbinarizer unbinarizer;
+	REQUIRE(!unbinarizer.unbinarize(inputs.front().data(), inputs.front().size(), failing_sink));
+}
+
+TEST_CASE("Streaming GCode block reading", "[Binarize]")
+{
+	FileHeader file_header;
+	file_header.checksum_type = (uint16_t)EChecksumType::CRC32;
+	GCodeBlock gcode;
+	gcode.raw_data = load_text_file(std::string(TEST_DATA_DIR) + "/mini_cube_a.gcode").substr(0, 60000);
+
+	for (EGCodeEncodingType encoding : { EGCodeEncodingType::None, EGCodeEncodingType::MeatPack, EGCodeEncodingType::MeatPackComments,
+		EGCodeEncodingType::TokenPack }) {
+		gcode.encoding_type = (uint16_t)encoding;
+		for (ECompressionType compression : { ECompressionType::None, ECompressionType::Deflate, ECompressionType::Heatshrink_11_4,
+			ECompressionType::Heatshrink_12_4 }) {
+			FILE* file = std::tmpfile();
+			REQUIRE(file != nullptr);
+			ScopedFile scoped_file(file);
+			REQUIRE(gcode.write(*file, compression, EChecksumType::CRC32) == EResult::Success);
+			rewind(file);
+			BlockHeader block_header;
+			REQUIRE(read_next_block_header(*file, file_header, block_header, nullptr, 0) == EResult::Success);
+			GCodeBlock whole;
+			REQUIRE(whole.read_data(*file, file_header, block_header) == EResult::Success);
+			const long block_end = ftell(file);
+
+			// the chunks written to the sink make up the same data, the file is left after the block
+			fseek(file, block_header.get_position(), SEEK_SET);
+			REQUIRE(read_next_block_header(*file, file_header, block_header, nullptr, 0) == EResult::Success);
+			size_t writes_count = 0;
+			std::string streamed;
+			CallbackOutputSink sink([&](const void* data, size_t data_size) {
+				++writes_count;
+				streamed.append(static_cast<const char*>(data), data_size);
+				return true;
+			});
+			GCodeBlock block;
+			REQUIRE(block.read_data(*file, file_header, block_header, sink) == EResult::Success);
+			REQUIRE(block.raw_data.empty());
+			REQUIRE(streamed == whole.raw_data);
+			REQUIRE(ftell(file) == block_end);
+			if (encoding == EGCodeEncodingType::MeatPack || (encoding == EGCodeEncodingType::None && compression != ECompressionType::None))
+				REQUIRE(writes_count > 1);
+
+			fseek(file, block_header.get_position(), SEEK_SET);
+			REQUIRE(read_next_block_header(*file, file_header, block_header, nullptr, 0) == EResult::Success);
+			CallbackOutputSink failing_sink([](const void*, size_t) { return false; });
+			REQUIRE(block.read_data(*file, file_header, block_header, failing_sink) == EResult::WriteError);
+		}
+	}
+}
+
+TEST_CASE("Embedded decoder profile", "[Binarize]")
+{
+	using SmallDecoder = EmbeddedGCodeDecoder<11, 16>;
+	REQUIRE(sizeof(EmbeddedGCodeDecoder<>) <= EmbeddedGCodeDecoder<>::MaxFootprint);
+	REQUIRE(EmbeddedGCodeDecoder<>::MaxFootprint <= 4288);
+	REQUIRE(sizeof(SmallDecoder) <= SmallDecoder::MaxFootprint);
+	REQUIRE(SmallDecoder::MaxFootprint <= 2048 + 16 + 128);
+	// the allocations are counted
+	s_allocations_count = 0;
+	::operator delete(::operator new(16));
+	REQUIRE(s_allocations_count == 1);
+
+	std::string gcode = load_text_file(std::string(TEST_DATA_DIR) + "/mini_cube_a.gcode").substr(0, 60000);
+	gcode.resize(gcode.rfind('\n') + 1);
+	FileHeader file_header;
+	file_header.checksum_type = (uint16_t)EChecksumType::CRC32;
+
+	struct Context
+	{
+		FILE* file{ nullptr };
+		std::string lines;
+		size_t max_lines_count{ SIZE_MAX };
+	};
+	auto read = [](void* user_data, uint8_t* data, size_t size) {
+		return fread(data, 1, size, static_cast<Context*>(user_data)->file);
+	};
+	auto line = [](void* user_data, const char* line, size_t size) {
+		Context& context = *static_cast<Context*>(user_data);
+		if (context.max_lines_count-- == 0)
+			return false;
+		// the capacity is reserved in advance, to not allocate
+		context.lines.append(line, size);
+		context.lines.push_back('\n');
+		return true;
+	};
+
+	std::array<char, 256> line_buffer;
+	EmbeddedGCodeDecoder<> decoder(line_buffer.data(), line_buffer.size());
+	SmallDecoder small_window_decoder(line_buffer.data(), line_buffer.size());
+	for (EGCodeEncodingType encoding : { EGCodeEncodingType::None, EGCodeEncodingType::MeatPack, EGCodeEncodingType::MeatPackComments,
+		EGCodeEncodingType::TokenPack }) {
+		for (ECompressionType compression : { ECompressionType::None, ECompressionType::Deflate, ECompressionType::Heatshrink_11_4,
+			ECompressionType::Heatshrink_12_4 }) {
+			GCodeBlock gcode_block;
+			gcode_block.encoding_type = (uint16_t)encoding;
+			gcode_block.raw_data = gcode;
+			FILE* file = std::tmpfile();
+			REQUIRE(file != nullptr);
+			ScopedFile scoped_file(file);
+			REQUIRE(gcode_block.write(*file, compression, EChecksumType::CRC32) == EResult::Success);
+			rewind(file);
+			BlockHeader block_header;
+			REQUIRE(read_next_block_header(*file, file_header, block_header, nullptr, 0) == EResult::Success);
+			GCodeBlock desktop;
+			REQUIRE(desktop.read_data(*file, file_header, block_header) == EResult::Success);
+			const long block_end = ftell(file);
+
+			fseek(file, block_header.get_position() + (long)block_header.get_size(), SEEK_SET);
+			Context context;
+			context.file = file;
+			context.lines.reserve(2 * gcode.size());
+			s_allocations_count = 0;
+			const EResult res = decoder.decode_block(block_header, read, line, &context);
+			REQUIRE(s_allocations_count == 0);
+			if (compression == ECompressionType::Deflate)
+				REQUIRE(res == EResult::InvalidCompressionType);
+			else if (encoding == EGCodeEncodingType::TokenPack)
+				REQUIRE(res == EResult::InvalidGCodeEncodingType);
+			else {
+				REQUIRE(res == EResult::Success);
+				REQUIRE(context.lines == desktop.raw_data);
+				// the checksum is left to the caller
+				REQUIRE(ftell(file) + 4 == block_end);
+
+				// smaller window and input buffer
+				fseek(file, block_header.get_position() + (long)block_header.get_size(), SEEK_SET);
+				context.lines.clear();
+				s_allocations_count = 0;
+				const EResult small_res = small_window_decoder.decode_block(block_header, read, line, &context);
+				REQUIRE(s_allocations_count == 0);
+				if (compression == ECompressionType::Heatshrink_12_4)
+					REQUIRE(small_res == EResult::InvalidCompressionType);
+				else {
+					REQUIRE(small_res == EResult::Success);
+					REQUIRE(context.lines == desktop.raw_data);
+					REQUIRE(ftell(file) + 4 == block_end);
+				}
+
+				// errors
+				fseek(file, block_header.get_position() + (long)block_header.get_size(), SEEK_SET);
+				context.max_lines_count = 10;
+				REQUIRE(decoder.decode_block(block_header, read, line, &context) == EResult::WriteError);
+				fseek(file, block_header.get_position() + (long)block_header.get_size(), SEEK_SET);
+				EmbeddedGCodeDecoder<> small_decoder(line_buffer.data(), 8);
+				REQUIRE(small_decoder.decode_block(block_header, read, line, &context) == EResult::InvalidBuffer);
+				fseek(file, block_end - 10, SEEK_SET);
+				REQUIRE(decoder.decode_block(block_header, read, line, &context) != EResult::Success);
+			}
+		}
+	}
+}
+
+TEST_CASE("MeatPack concurrent encoding", "[Binarize]")
+{
+	// binarizers with different flags running at the same time must not interfere
+	std::vector<std::string> inputs;
+	for (unsigned int seed = 0; seed < 4; ++seed) {
+		inputs.emplace_back(random_gcode(2000, seed));
+	}
+	std::vector<std::vector<std::vector<uint8_t>>> expected(inputs.size());
+	for (size_t i = 0; i < inputs.size(); ++i) {
+		for (uint8_t flags : MeatPackFlags) {
+			expected[i].emplace_back(meatpack_lines(inputs[i], flags));
+		}
+	}
+
+	std::atomic<size_t> mismatches{ 0 };
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < 16; ++t) {
+		threads.emplace_back([&, t]() {
+			for (size_t iteration = 0; iteration < 20; ++iteration) {
+				const size_t input_id = (t + iteration) % inputs.size();
+				const size_t flags_id = (t + 3 * iteration) % MeatPackFlags.size();
+				const uint8_t flags = MeatPackFlags[flags_id];
+				const std::vector<uint8_t>& reference = expected[input_id][flags_id];
+				std::vector<uint8_t> encoded;
+				MeatPack::MPBinarizer binarizer(flags);
+				binarizer.binarize(inputs[input_id], encoded);
+				if (encoded != reference || meatpack_lines(inputs[input_id], flags) != reference)
+					++mismatches;
+				std::string decoded;
+				MeatPack::unbinarize(encoded, decoded);
+			}
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	REQUIRE(mismatches == 0);
+}
+
+TEST_CASE("MeatPack encoder benchmark", "[.][benchmark]")
+{
+	const std::string gcode = load_text_file(std::string(TEST_DATA_DIR) + "/mini_cube_a.gcode");
+	std::string input;
+	while (input.size() < 64 * 1024 * 1024) {
+		input += gcode;
+	}
+
+	auto measure = [&](const std::string& name, auto encode) {
+		const auto start = std::chrono::steady_clock::now();
+		const size_t size = encode();
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << name << ": " << input.size() / (1024.0 * 1024.0) / elapsed.count() << " MiB/s (" << size << " bytes)\n";
+		return size;
+	};
+	const uint8_t flags = MeatPack::Flag_OmitWhitespaces;
+	const size_t lines_size = measure("line by line", [&]() { return meatpack_lines(input, flags).size(); });
+	for (const auto& [name, level] : SimdLevels) {
+		const size_t block_size = measure(std::string("whole block, ") + name, [&]() {
+			std::vector<uint8_t> dst;
+			MeatPack::MPBinarizer binarizer(flags);
+			binarizer.set_simd_level(level);
+			binarizer.binarize(input, dst);
+			return dst.size();
+		});
+		REQUIRE(lines_size == block_size);
+	}
+}
+
+TEST_CASE("MeatPack decoder benchmark", "[.][benchmark]")
+{
+	const std::string gcode = load_text_file(std::string(TEST_DATA_DIR) + "/mini_cube_a.gcode");
+	std::string input;
+	while (input.size() < 64 * 1024 * 1024) {
+		input += gcode;
+	}
+
+	for (uint8_t flags : MeatPackFlags) {
+		std::vector<uint8_t> encoded;
+		MeatPack::MPBinarizer binarizer(flags);
+		binarizer.binarize(input, encoded);
+		std::string expected;
+		for (const auto& [name, level] : SimdLevels) {
+			std::string decoded;
+			const auto start = std::chrono::steady_clock::now();
+			MeatPack::unbinarize(encoded, decoded, level);
+			const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			std::cout << "flags " << static_cast<int>(flags) << ", " << name << ": " << decoded.size() / (1024.0 * 1024.0) / elapsed.count() <<
+				" MiB/s (" << decoded.size() << " bytes)\n";
+			if (expected.empty())
+				expected = decoded;
+			REQUIRE(decoded == expected);
+		}
+	}
+}
+
+TEST_CASE("TokenPack encoding", "[Binarize]")
+{
+	std::vector<std::string> inputs = { "", "\n", "G1 X", "G1 X1", " ", " X", "\n\n\n",
+		load_text_file(std::string(TEST_DATA_DIR) + "/mini_cube_a.gcode"),
+		load_text_file(std::string(TEST_DATA_DIR) + "/mini_cube_ps2.8.1.gcode"),
+		"G1 X1 Y2*12 ; comment\n  \t\n;only comment\nM73 P0 R5\ng1 x1.5 e2\n\r\nG1 X1\r\n",
+		"G1 X-10.5 Y20.25 Z0.3 E1.2345 F1800\nG2 X1 Y2 I-3 J4\nM117 " + std::string(300, 'A') + "\n" + std::string(40, '\0') };
+	for (unsigned int seed = 0; seed < 20; ++seed) {
+		inputs.emplace_back(random_gcode(500, seed));
+	}
+	for (const std::string& input : inputs) {
+		std::vector<uint8_t> encoded = { 0xAB };
+		TokenPack::encode(input, encoded);
+		REQUIRE(encoded.front() == 0xAB);
+		encoded.erase(encoded.begin());
+		// lossless
+		std::string decoded = "prefix";
+		REQUIRE(TokenPack::decode(encoded, decoded));
+		REQUIRE(decoded == "prefix" + input);
+		// decoded in chunks
+		for (size_t chunk_size : { size_t(1), size_t(3), size_t(7), TokenPack::Decoder::PieceSize + 1 }) {
+			TokenPack::Decoder decoder;
+			std::string chunks_decoded;
+			for (size_t pos = 0; pos < encoded.size(); pos += chunk_size) {
+				REQUIRE(decoder.decode(encoded.data() + pos, std::min(chunk_size, encoded.size() - pos), chunks_decoded));
+			}
+			REQUIRE(decoder.finish());
+			REQUIRE(chunks_decoded == input);
+		}
+		// data after the end
+		encoded.emplace_back(0);
+		REQUIRE(!TokenPack::decode(encoded, decoded));
+		encoded.pop_back();
+		// truncated data
+		if (!input.empty()) {
+			encoded.pop_back();
+			REQUIRE(!TokenPack::decode(encoded, decoded));
+			REQUIRE(decoded == "prefix" + input);
+		}
+	}
+
+	std::string decoded;
+	// missing size, dst is left untouched on errors
+	REQUIRE(!TokenPack::decode({}, decoded));
+	// size larger than the data can hold
+	REQUIRE(!TokenPack::decode({ 0x80, 0x80, 0x80, 0x80, 0x0F }, decoded));
+	REQUIRE(!TokenPack::decode({ 100, 0x00 }, decoded));
+	// symbols exceeding the size
+	REQUIRE(!TokenPack::decode({ 3, 0x00 }, decoded));
+	// line start, escape, raw byte 'A'
+	REQUIRE(decoded.empty());
+	REQUIRE(TokenPack::decode({ 1, 0xFF, 0x1F, 0x04 }, decoded));
+	REQUIRE(decoded == "A");
+	// the padding nibble must be zero
+	REQUIRE(!TokenPack::decode({ 1, 0xFF, 0x1F, 0x14 }, decoded));
+	REQUIRE(!TokenPack::decode({ 2, 0x5F, 0x1B }, decoded));
+	// line start, escape, '5', new line
+	REQUIRE(TokenPack::decode({ 2, 0x5F, 0x0B }, decoded));
+	REQUIRE(decoded == "A5\n");
+}
+
+TEST_CASE("G-code encodings benchmark", "[.][benchmark]")
+{
+	for (const std::string filename : { "mini_cube_a.gcode", "mini_cube_ps2.8.1.gcode" }) {
+		const std::string gcode = load_text_file(std::string(TEST_DATA_DIR) + "/" + filename);
+		std::string input;
+		while (input.size() < 64 * 1024 * 1024) {
+			input += gcode;
+		}
+
+		auto report = [&](const std::string& name, size_t encoded_size, auto decode) {
+			const auto start = std::chrono::steady_clock::now();
+			const std::string decoded = decode();
+			const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			if (name == "TokenPack")
+				REQUIRE(decoded == input);
+			std::cout << filename << ", " << name << ": ratio " << static_cast<double>(encoded_size) / input.size() << ", decoding " <<
+				decoded.size() / (1024.0 * 1024.0) / elapsed.count() << " MiB/s\n";
+		};
+		report("None", input.size(), [&]() { return std::string(input.begin(), input.end()); });
+		for (uint8_t flags : { MeatPackFlags[1], MeatPackFlags[0] }) {
+			std::vector<uint8_t> encoded;
+			MeatPack::MPBinarizer binarizer(flags);
+			binarizer.binarize(input, encoded);
+			report((flags & MeatPack::Flag_RemoveComments) ? "MeatPack" : "MeatPackComments", encoded.size(), [&]() {
+				std::string decoded;
+				MeatPack::unbinarize(encoded, decoded);
+				return decoded;
+			});
+		}
+		std::vector<uint8_t> encoded;
+		TokenPack::encode(input, encoded);
+		report("TokenPack", encoded.size(), [&]() {
+			std::string decoded;
+			REQUIRE(TokenPack::decode(encoded, decoded));
+			return decoded;
+		});
+	}
+}
@@ -1,9 +1,18 @@
 #include <catch2/catch_test_macros.hpp>
 
+#include "convert/base64.hpp"
 #include "convert/convert.hpp"
+#include "convert/line_scanner.hpp"
 
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <random>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif // _WIN32
 
 #include <boost/nowide/cstdio.hpp>
 
@@ -186,3 +195,799 @@ TEST_CASE("Convert from ascii to binary PS 2.8.1", "[Convert]")
   // compare results
   compare_text_files(ba_dst_filename, ab_src_filename);
 }
+
+TEST_CASE("Convert to memory sink", "[Convert]")
+{
+    std::cout << "\nTEST: Convert to memory sink\n";
+
+    auto read_all = [](FILE& file) {
+        fseek(&file, 0, SEEK_END);
+        std::vector<std::byte> data(ftell(&file));
+        rewind(&file);
+        REQUIRE(fread(data.data(), 1, data.size(), &file) == data.size());
+        return data;
+    };
+
+    const std::string src_filename = std::string(TEST_DATA_DIR) + "/mini_cube_a.gcode";
+    FILE* src_file = boost::nowide::fopen(src_filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+
+    BinarizerConfig config;
+    config.compression.slicer_metadata = ECompressionType::Deflate;
+    config.compression.gcode = ECompressionType::Heatshrink_12_4;
+    config.gcode_encoding = EGCodeEncodingType::MeatPackComments;
+
+    // ascii to binary, FILE vs memory
+    FILE* binary_file = std::tmpfile();
+    REQUIRE(binary_file != nullptr);
+    ScopedFile scoped_binary_file(binary_file);
+    REQUIRE(from_ascii_to_binary(*src_file, *binary_file, config) == EResult::Success);
+    rewind(src_file);
+    MemoryOutputSink binary_sink;
+    REQUIRE(from_ascii_to_binary(*src_file, binary_sink, config) == EResult::Success);
+    REQUIRE(binary_sink.get_data() == read_all(*binary_file));
+
+    // binary to ascii, FILE vs memory
+    rewind(binary_file);
+    FILE* ascii_file = std::tmpfile();
+    REQUIRE(ascii_file != nullptr);
+    ScopedFile scoped_ascii_file(ascii_file);
+    REQUIRE(from_binary_to_ascii(*binary_file, *ascii_file, true) == EResult::Success);
+    rewind(binary_file);
+    MemoryOutputSink ascii_sink;
+    REQUIRE(from_binary_to_ascii(*binary_file, ascii_sink, true) == EResult::Success);
+    REQUIRE(ascii_sink.get_data() == read_all(*ascii_file));
+}
+
+TEST_CASE("Convert with binary metadata encoding", "[Convert]")
+{
+    std::cout << "\nTEST: Convert with binary metadata encoding\n";
+
+    const std::string src_filename = std::string(TEST_DATA_DIR) + "/mini_cube_ps2.8.1.gcode";
+    FILE* src_file = boost::nowide::fopen(src_filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+
+    auto slicer_metadata_size = [](const std::vector<std::byte>& data, ECompressionType compression) {
+        FILE* file = std::tmpfile();
+        REQUIRE(file != nullptr);
+        ScopedFile scoped_file(file);
+        REQUIRE(fwrite(data.data(), 1, data.size(), file) == data.size());
+        FileHeader file_header;
+        REQUIRE(read_header(*file, file_header, nullptr) == EResult::Success);
+        BlockHeader block_header;
+        REQUIRE(read_next_block_header(*file, file_header, block_header, EBlockType::SlicerMetadata) == EResult::Success);
+        return (compression == ECompressionType::None) ? block_header.uncompressed_size : block_header.compressed_size;
+    };
+
+    for (ECompressionType compression : { ECompressionType::None, ECompressionType::Deflate }) {
+        BinarizerConfig config;
+        config.compression.slicer_metadata = compression;
+        config.compression.gcode = ECompressionType::Heatshrink_12_4;
+        config.gcode_encoding = EGCodeEncodingType::MeatPackComments;
+
+        rewind(src_file);
+        MemoryOutputSink ini_sink;
+        REQUIRE(from_ascii_to_binary(*src_file, ini_sink, config) == EResult::Success);
+
+        config.metadata_encoding = EMetadataEncodingType::Binary;
+        rewind(src_file);
+        MemoryOutputSink binary_sink;
+        REQUIRE(from_ascii_to_binary(*src_file, binary_sink, config) == EResult::Success);
+
+        const uint32_t ini_size = slicer_metadata_size(ini_sink.get_data(), compression);
+        const uint32_t binary_size = slicer_metadata_size(binary_sink.get_data(), compression);
+        std::cout << "Slicer metadata size (" << (compression == ECompressionType::None ? "None" : "Deflate") << "): INI " << ini_size << " bytes, Binary " << binary_size << " bytes\n";
+        if (compression == ECompressionType::None)
+            REQUIRE(binary_size < ini_size);
+        else
+            // the lengths section, needed to decode without searching, costs a few percent once compressed
+            REQUIRE(binary_size < ini_size + ini_size / 16);
+
+        // both files convert back to the same ascii
+        std::vector<std::vector<std::byte>> ascii;
+        for (const MemoryOutputSink* sink : { &ini_sink, &binary_sink }) {
+            FILE* file = std::tmpfile();
+            REQUIRE(file != nullptr);
+            ScopedFile scoped_file(file);
+            REQUIRE(fwrite(sink->get_data().data(), 1, sink->get_data().size(), file) == sink->get_data().size());
+            MemoryOutputSink ascii_sink;
+            REQUIRE(from_binary_to_ascii(*file, ascii_sink, true) == EResult::Success);
+            ascii.emplace_back(ascii_sink.get_data());
+        }
+        REQUIRE(ascii[0] == ascii[1]);
+    }
+}
+
+TEST_CASE("Convert with TokenPack encoding", "[Convert]")
+{
+    std::cout << "\nTEST: Convert with TokenPack encoding\n";
+
+    const std::string src_filename = std::string(TEST_DATA_DIR) + "/mini_cube_ps2.8.1.gcode";
+    FILE* src_file = boost::nowide::fopen(src_filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+
+    auto to_ascii = [](const std::vector<std::byte>& data) {
+        FILE* file = std::tmpfile();
+        REQUIRE(file != nullptr);
+        ScopedFile scoped_file(file);
+        REQUIRE(fwrite(data.data(), 1, data.size(), file) == data.size());
+        MemoryOutputSink ascii_sink;
+        REQUIRE(from_binary_to_ascii(*file, ascii_sink, true) == EResult::Success);
+        return ascii_sink.get_data();
+    };
+
+    for (const auto& [name, compression] : { std::make_pair("None", ECompressionType::None), std::make_pair("Deflate", ECompressionType::Deflate),
+        std::make_pair("Heatshrink_12_4", ECompressionType::Heatshrink_12_4) }) {
+        BinarizerConfig config;
+        config.checksum = EChecksumType::CRC32;
+        config.compression.gcode = compression;
+        config.gcode_encoding = EGCodeEncodingType::MeatPackComments;
+
+        rewind(src_file);
+        MemoryOutputSink meatpack_sink;
+        REQUIRE(from_ascii_to_binary(*src_file, meatpack_sink, config) == EResult::Success);
+
+        config.gcode_encoding = EGCodeEncodingType::TokenPack;
+        rewind(src_file);
+        MemoryOutputSink tokenpack_sink;
+        REQUIRE(from_ascii_to_binary(*src_file, tokenpack_sink, config) == EResult::Success);
+
+        const size_t meatpack_size = meatpack_sink.get_data().size();
+        const size_t tokenpack_size = tokenpack_sink.get_data().size();
+        std::cout << "File size (" << name << "): MeatPackComments " << meatpack_size << " bytes, TokenPack " << tokenpack_size << " bytes\n";
+        if (compression == ECompressionType::None)
+            REQUIRE(tokenpack_size < meatpack_size);
+
+        // both files convert back to the same ascii
+        REQUIRE(to_ascii(tokenpack_sink.get_data()) == to_ascii(meatpack_sink.get_data()));
+    }
+}
+
+TEST_CASE("Convert with CRLF line endings", "[Convert]")
+{
+    std::cout << "\nTEST: Convert with CRLF line endings\n";
+
+    const std::string src_filename = std::string(TEST_DATA_DIR) + "/mini_cube_a.gcode";
+    FILE* src_file = boost::nowide::fopen(src_filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+    fseek(src_file, 0, SEEK_END);
+    std::string lf_data(ftell(src_file), '\0');
+    rewind(src_file);
+    REQUIRE(fread(lf_data.data(), 1, lf_data.size(), src_file) == lf_data.size());
+
+    std::string crlf_data;
+    for (const char c : lf_data) {
+        if (c == '\n')
+            crlf_data.push_back('\r');
+        crlf_data.push_back(c);
+    }
+    // pad with a blank line, removed by the conversion, so that a '\r' is the last character of the first
+    // read of the reader (640 kB) and its '\n' the first of the second one
+    static const size_t ReadSize = 65536 * 10;
+    REQUIRE(crlf_data.size() > ReadSize);
+    size_t cr_pos = crlf_data.rfind('\r', ReadSize - 1);
+    if (ReadSize - 1 - cr_pos < 2)
+        cr_pos = crlf_data.rfind('\r', cr_pos - 1);
+    size_t pad_pos = 0;
+    for (int i = 0; i < 10; ++i) {
+        pad_pos = crlf_data.find('\n', pad_pos) + 1;
+    }
+    crlf_data.insert(pad_pos, std::string(ReadSize - 1 - cr_pos - 2, ' ') + "\r\n");
+    REQUIRE(crlf_data[ReadSize - 1] == '\r');
+    REQUIRE(crlf_data[ReadSize] == '\n');
+
+    BinarizerConfig config;
+    config.compression.gcode = ECompressionType::Heatshrink_12_4;
+    config.gcode_encoding = EGCodeEncodingType::MeatPackComments;
+
+    MemoryOutputSink lf_sink;
+    rewind(src_file);
+    REQUIRE(from_ascii_to_binary(*src_file, lf_sink, config) == EResult::Success);
+
+    FILE* crlf_file = std::tmpfile();
+    REQUIRE(crlf_file != nullptr);
+    ScopedFile scoped_crlf_file(crlf_file);
+    REQUIRE(fwrite(crlf_data.data(), 1, crlf_data.size(), crlf_file) == crlf_data.size());
+    rewind(crlf_file);
+    MemoryOutputSink crlf_sink;
+    REQUIRE(from_ascii_to_binary(*crlf_file, crlf_sink, config) == EResult::Success);
+    REQUIRE(crlf_sink.get_data() == lf_sink.get_data());
+}
+
+static const std::vector<std::pair<const char*, ESimdLevel>> SimdLevels = {
+    { "scalar", ESimdLevel::None },
+    { "SSSE3", ESimdLevel::SSSE3 },
+    { "AVX2", ESimdLevel::AVX2 },
+    { "NEON", ESimdLevel::NEON }
+};
+
+struct ScannedLine
+{
+    std::string raw;
+    std::string content;
+    bool operator == (const ScannedLine& other) const { return raw == other.raw && content == other.content; }
+};
+
+// Lines found by scan_lines(), and the size of the unterminated last line
+static std::pair<std::vector<ScannedLine>, size_t> scan_all_lines(const std::string& data, ESimdLevel level)
+{
+    std::vector<ScannedLine> lines;
+    const char* tail = scan_lines(data.data(), data.data() + data.size(), level, [&lines](std::string_view raw, std::string_view content) {
+        lines.push_back({ std::string(raw), std::string(content) });
+        return true;
+    });
+    return { lines, static_cast<size_t>(data.data() + data.size() - tail) };
+}
+
+// Character by character version of scan_all_lines()
+static std::pair<std::vector<ScannedLine>, size_t> scan_all_lines_reference(const std::string& data)
+{
+    std::vector<ScannedLine> lines;
+    size_t begin = 0;
+    for (size_t i = 0; i < data.size(); ++i) {
+        if (data[i] != '\r' && data[i] != '\n')
+            continue;
+        const std::string raw = std::string(data.c_str() + begin, i - begin).c_str();
+        lines.push_back({ raw, std::string(line_content(raw)) });
+        if (data[i] == '\r' && i + 1 < data.size() && data[i + 1] == '\n')
+            ++i;
+        begin = i + 1;
+    }
+    return { lines, data.size() - begin };
+}
+
+static const std::string Base64Alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Bit by bit base64 encoding, with padding
+static std::string base64_encode_reference(const std::vector<std::byte>& data)
+{
+    std::string encoded;
+    for (size_t i = 0; i < data.size() * 8; i += 6) {
+        unsigned int value = 0;
+        for (size_t j = i; j < i + 6; ++j) {
+            const unsigned int bit = (j < data.size() * 8) ? (static_cast<unsigned int>(data[j / 8]) >> (7 - j % 8)) & 1 : 0;
+            value = (value << 1) | bit;
+        }
+        encoded.push_back(Base64Alphabet[value]);
+    }
+    while (encoded.size() % 4 != 0) {
+        encoded.push_back('=');
+    }
+    return encoded;
+}
+
+// Bit by bit base64 decoding, up to the first invalid character, of the whole bytes
+static std::pair<std::vector<std::byte>, size_t> base64_decode_reference(const std::string& encoded)
+{
+    std::vector<bool> bits;
+    size_t read = 0;
+    for (; read < encoded.size(); ++read) {
+        const size_t value = Base64Alphabet.find(encoded[read]);
+        if (value == std::string::npos)
+            break;
+        for (int j = 5; j >= 0; --j) {
+            bits.push_back(((value >> j) & 1) != 0);
+        }
+    }
+    std::vector<std::byte> decoded(bits.size() / 8);
+    for (size_t i = 0; i < decoded.size() * 8; ++i) {
+        decoded[i / 8] |= static_cast<std::byte>(bits[i] ? 0x80 >> (i % 8) : 0);
+    }
+    return { decoded, read };
+}
+
+TEST_CASE("Base64", "[Convert]")
+{
+    std::cout << "\nTEST: Base64\n";
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> any_byte(0, 255);
+    // sizes around the blocks of the vectorized code paths: 12 and 24 bytes for x86, 48 bytes for NEON
+    for (size_t size : { 0, 1, 2, 3, 11, 12, 13, 35, 36, 47, 48, 49, 95, 96, 97, 100, 143, 144, 145, 1000, 4096 }) {
+        for (int i = 0; i < 20; ++i) {
+            std::vector<std::byte> data(size);
+            for (std::byte& b : data) {
+                b = static_cast<std::byte>(any_byte(rng));
+            }
+            std::string encoded = base64_encode_reference(data);
+            // also with an invalid character, or a truncated group
+            if (i % 4 == 1 && !encoded.empty())
+                encoded[std::uniform_int_distribution<size_t>(0, encoded.size() - 1)(rng)] = static_cast<char>(any_byte(rng) | 0x80);
+            else if (i % 4 == 2 && !encoded.empty())
+                encoded[std::uniform_int_distribution<size_t>(0, encoded.size() - 1)(rng)] = "=\n ;.\0"[i % 6];
+            else if (i % 4 == 3)
+                encoded.resize(std::uniform_int_distribution<size_t>(0, encoded.size())(rng));
+
+            const auto expected = base64_decode_reference(encoded);
+            if (i % 4 == 0) {
+                REQUIRE(expected.first == data);
+                for (const auto& [name, level] : SimdLevels) {
+                    // exactly sized, for the sanitizers
+                    std::string chars(base64_encoded_size(size), ' ');
+                    REQUIRE(base64_encode(data.data(), data.size(), chars.data(), supported_simd_level(level)) == chars.size());
+                    REQUIRE(chars == encoded);
+                }
+                // rows holding one vectorized block at most, or more of them, and splitting them
+                for (size_t row_length : { 1, 2, 3, 4, 5, 7, 63, 64, 65, 76, 78, 80, 129 }) {
+                    std::string expected_rows;
+                    for (size_t pos = 0; pos < encoded.size(); pos += row_length) {
+                        expected_rows += "; " + encoded.substr(pos, row_length) + "\n";
+                    }
+                    for (const auto& [name, level] : SimdLevels) {
+                        std::string rows(base64_rows_size(size, row_length, 2), ' ');
+                        REQUIRE(base64_encode_rows(data.data(), data.size(), "; ", row_length, rows.data(), supported_simd_level(level)) == rows.size());
+                        REQUIRE(rows == expected_rows);
+                    }
+                }
+            }
+            for (const auto& [name, level] : SimdLevels) {
+                // exactly sized, for the sanitizers
+                std::vector<std::byte> decoded(base64_decoded_size(encoded.size()));
+                const auto [written, read] = base64_decode(encoded.data(), encoded.size(), decoded.data(), supported_simd_level(level));
+                decoded.resize(written);
+                REQUIRE(decoded == expected.first);
+                REQUIRE(read == expected.second);
+            }
+        }
+    }
+
+#if defined(BGCODE_SIMD_NEON)
+    // the NEON code paths, enabled by LibBGCode_ENABLE_NEON, are the ones tested
+    REQUIRE(supported_simd_level(ESimdLevel::NEON) == ESimdLevel::NEON);
+#endif
+    // a malformed character at every position of the first vectorized blocks, also padding in the middle
+    std::vector<std::byte> data(200);
+    for (std::byte& b : data) {
+        b = static_cast<std::byte>(any_byte(rng));
+    }
+    const std::string valid = base64_encode_reference(data);
+    for (size_t pos = 0; pos < 160; ++pos) {
+        for (char c : { '=', '\n', '\x80', '\xFF', '@', '[', '`', '{', ':', ',', '.', '*', '\0' }) {
+            std::string encoded = valid;
+            encoded[pos] = c;
+            const auto expected = base64_decode_reference(encoded);
+            for (const auto& [name, level] : SimdLevels) {
+                std::vector<std::byte> decoded(base64_decoded_size(encoded.size()));
+                const auto [written, read] = base64_decode(encoded.data(), encoded.size(), decoded.data(), supported_simd_level(level));
+                decoded.resize(written);
+                REQUIRE(decoded == expected.first);
+                REQUIRE(read == expected.second);
+            }
+        }
+    }
+}
+
+TEST_CASE("Base64 benchmark", "[.][benchmark]")
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> any_byte(0, 255);
+    // a multiple of 3 bytes, without padding
+    std::vector<std::byte> data(48 * 1024 * 1024);
+    for (std::byte& b : data) {
+        b = static_cast<std::byte>(any_byte(rng));
+    }
+    const std::string encoded = base64_encode_reference(data);
+    std::string chars(encoded.size(), ' ');
+    std::vector<std::byte> decoded(base64_decoded_size(encoded.size()));
+    for (const auto& [name, level] : SimdLevels) {
+        if (supported_simd_level(level) != level)
+            continue;
+        auto start = std::chrono::steady_clock::now();
+        REQUIRE(base64_encode(data.data(), data.size(), chars.data(), level) == chars.size());
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "base64 encoding, " << name << ": " << encoded.size() / 1e9 / elapsed.count() << " GB/s\n";
+        REQUIRE(chars == encoded);
+    }
+    for (const auto& [name, level] : SimdLevels) {
+        if (supported_simd_level(level) != level)
+            continue;
+        const auto start = std::chrono::steady_clock::now();
+        const auto [written, read] = base64_decode(encoded.data(), encoded.size(), decoded.data(), level);
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "base64 decoding, " << name << ": " << encoded.size() / 1e9 / elapsed.count() << " GB/s\n";
+        REQUIRE(written == data.size());
+        REQUIRE(read == encoded.size());
+    }
+}
+
+TEST_CASE("Convert large thumbnails", "[Convert]")
+{
+    std::cout << "\nTEST: Convert large thumbnails\n";
+
+    const std::string src_filename = std::string(TEST_DATA_DIR) + "/mini_cube_ps2.8.1.gcode";
+    std::ifstream file(src_filename, std::ios::binary);
+    std::string gcode((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    // the first thumbnail replaced by one spanning many chunks of rows of the output
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> any_byte(0, 255);
+    std::vector<std::byte> data(1000 * 1000 + 1);
+    for (std::byte& b : data) {
+        b = static_cast<std::byte>(any_byte(rng));
+    }
+    const std::string encoded = base64_encode_reference(data);
+    std::string thumbnail = "; thumbnail_QOI begin 16x16 " + std::to_string(encoded.size()) + "\n";
+    for (size_t pos = 0; pos < encoded.size(); pos += 78) {
+        thumbnail += "; " + encoded.substr(pos, 78) + "\n";
+    }
+    thumbnail += "; thumbnail_QOI end\n";
+    const size_t begin = gcode.find("; thumbnail_QOI begin 16x16");
+    const size_t end = gcode.find("; thumbnail_QOI end\n", begin) + std::string("; thumbnail_QOI end\n").size();
+    REQUIRE(begin != std::string::npos);
+    gcode.replace(begin, end - begin, thumbnail);
+
+    FILE* ascii_file = std::tmpfile();
+    REQUIRE(ascii_file != nullptr);
+    ScopedFile scoped_ascii_file(ascii_file);
+    REQUIRE(fwrite(gcode.data(), 1, gcode.size(), ascii_file) == gcode.size());
+    rewind(ascii_file);
+    MemoryOutputSink binary_sink;
+    REQUIRE(from_ascii_to_binary(*ascii_file, binary_sink, BinarizerConfig()) == EResult::Success);
+
+    FILE* binary_file = std::tmpfile();
+    REQUIRE(binary_file != nullptr);
+    ScopedFile scoped_binary_file(binary_file);
+    REQUIRE(fwrite(binary_sink.get_data().data(), 1, binary_sink.get_data().size(), binary_file) == binary_sink.get_data().size());
+    rewind(binary_file);
+    MemoryOutputSink ascii_sink;
+    REQUIRE(from_binary_to_ascii(*binary_file, ascii_sink, true) == EResult::Success);
+    const std::string output(reinterpret_cast<const char*>(ascii_sink.get_data().data()), ascii_sink.get_data().size());
+    REQUIRE(output.find(thumbnail) != std::string::npos);
+}
+
+TEST_CASE("Convert from binary to ascii in parallel", "[Convert]")
+{
+    std::cout << "\nTEST: Convert from binary to ascii in parallel\n";
+
+    const std::string src_filename = std::string(TEST_DATA_DIR) + "/mini_cube_ps2.8.1.gcode";
+    FILE* src_file = boost::nowide::fopen(src_filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+
+    // converts the given binary data, returns the result and the output
+    auto convert = [](const std::vector<std::byte>& data, size_t threads_count) {
+        FILE* file = std::tmpfile();
+        REQUIRE(file != nullptr);
+        ScopedFile scoped_file(file);
+        REQUIRE(fwrite(data.data(), 1, data.size(), file) == data.size());
+        rewind(file);
+        MemoryOutputSink sink;
+        const EResult res = from_binary_to_ascii(*file, sink, true, threads_count);
+        return std::make_pair(res, sink.release());
+    };
+
+    for (ECompressionType compression : { ECompressionType::None, ECompressionType::Deflate, ECompressionType::Heatshrink_11_4,
+        ECompressionType::Heatshrink_12_4 }) {
+        for (EGCodeEncodingType encoding : { EGCodeEncodingType::None, EGCodeEncodingType::MeatPack, EGCodeEncodingType::MeatPackComments,
+            EGCodeEncodingType::TokenPack }) {
+            BinarizerConfig config;
+            config.checksum = EChecksumType::CRC32;
+            config.compression.gcode = compression;
+            config.gcode_encoding = encoding;
+            rewind(src_file);
+            MemoryOutputSink binary_sink;
+            REQUIRE(from_ascii_to_binary(*src_file, binary_sink, config) == EResult::Success);
+            const std::vector<std::byte>& binary = binary_sink.get_data();
+
+            const auto serial = convert(binary, 1);
+            REQUIRE(serial.first == EResult::Success);
+            for (size_t threads_count : { 0, 2, 3, 16 }) {
+                REQUIRE(convert(binary, threads_count) == serial);
+            }
+
+            // a truncated file fails the same way, after the same output
+            const std::vector<std::byte> truncated(binary.begin(), binary.begin() + binary.size() * 2 / 3);
+            const auto truncated_serial = convert(truncated, 1);
+            REQUIRE(truncated_serial.first != EResult::Success);
+            REQUIRE(convert(truncated, 4) == truncated_serial);
+
+            // a corrupted gcode block, the last one of the file, fails the checksum verification after the same output
+            std::vector<std::byte> corrupted = binary;
+            corrupted[corrupted.size() - 32] ^= std::byte{ 0x01 };
+            const auto corrupted_serial = convert(corrupted, 1);
+            REQUIRE(corrupted_serial.first == EResult::InvalidChecksum);
+            REQUIRE(convert(corrupted, 4) == corrupted_serial);
+        }
+    }
+}
+
+TEST_CASE("Convert from ascii to binary in parallel", "[Convert]")
+{
+    std::cout << "\nTEST: Convert from ascii to binary in parallel\n";
+
+    for (const char* filename : { "mini_cube_a.gcode", "mini_cube_ps2.8.1.gcode" }) {
+        const std::string src_filename = std::string(TEST_DATA_DIR) + "/" + filename;
+        FILE* src_file = boost::nowide::fopen(src_filename.c_str(), "rb");
+        REQUIRE(src_file != nullptr);
+        ScopedFile scoped_src_file(src_file);
+
+        // converts the source file, returns the result and the output
+        auto convert = [src_file](const BinarizerConfig& config, size_t threads_count) {
+            rewind(src_file);
+            MemoryOutputSink sink;
+            const EResult res = from_ascii_to_binary(*src_file, sink, config, threads_count);
+            return std::make_pair(res, sink.release());
+        };
+
+        for (ECompressionType compression : { ECompressionType::None, ECompressionType::Deflate, ECompressionType::Heatshrink_11_4,
+            ECompressionType::Heatshrink_12_4 }) {
+            for (EGCodeEncodingType encoding : { EGCodeEncodingType::None, EGCodeEncodingType::MeatPack, EGCodeEncodingType::MeatPackComments,
+                EGCodeEncodingType::TokenPack }) {
+                BinarizerConfig config;
+                config.checksum = EChecksumType::CRC32;
+                config.compression.gcode = compression;
+                config.gcode_encoding = encoding;
+
+                const auto serial = convert(config, 1);
+                REQUIRE(serial.first == EResult::Success);
+                for (size_t threads_count : { 0, 2, 3, 16 }) {
+                    REQUIRE(convert(config, threads_count) == serial);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Line scanner", "[Convert]")
+{
+    std::cout << "\nTEST: Line scanner\n";
+
+    REQUIRE(line_content("") == "");
+    REQUIRE(line_content(" \t ") == "");
+    REQUIRE(line_content(" ; ") == "");
+    REQUIRE(line_content(" G1 X1 ") == "G1 X1");
+    REQUIRE(line_content("\t; key = value\t") == "key = value");
+    REQUIRE(line_content(";;") == ";");
+
+    std::mt19937 rng(42);
+    // characters of interest, and some others
+    static const std::string Alphabet = "\n\r;; \t  GX1.\0";
+    std::uniform_int_distribution<size_t> char_id(0, Alphabet.size() - 1);
+    for (size_t size : { 0, 1, 63, 64, 65, 127, 128, 129, 1000 }) {
+        for (int i = 0; i < 50; ++i) {
+            std::string data(size, ' ');
+            for (char& c : data) {
+                c = Alphabet[char_id(rng)];
+            }
+            const auto expected = scan_all_lines_reference(data);
+            for (const auto& [name, level] : SimdLevels) {
+                const auto lines = scan_all_lines(data, supported_simd_level(level));
+                REQUIRE(lines.first == expected.first);
+                REQUIRE(lines.second == expected.second);
+            }
+        }
+    }
+
+    // masks of all the levels, all the byte values
+    std::uniform_int_distribution<int> any_char(0, 255);
+    std::string window(ScanWindowSize, ' ');
+    for (int i = 0; i < 1000; ++i) {
+        for (char& c : window) {
+            c = (i % 2 == 0) ? Alphabet[char_id(rng)] : static_cast<char>(any_char(rng));
+        }
+        CharMasks expected;
+        for (size_t i = 0; i < window.size(); ++i) {
+            const uint64_t bit = uint64_t(1) << i;
+            expected.new_lines |= (window[i] == '\n') ? bit : 0;
+            expected.returns |= (window[i] == '\r') ? bit : 0;
+            expected.nulls |= (window[i] == '\0') ? bit : 0;
+            expected.comments |= (window[i] == ';') ? bit : 0;
+            expected.blanks |= (window[i] == ' ' || window[i] == '\t') ? bit : 0;
+        }
+        for (const auto& [name, level] : SimdLevels) {
+            CharMasks masks;
+            classify_chars(window.data(), 1, &masks, supported_simd_level(level));
+            REQUIRE(masks.new_lines == expected.new_lines);
+            REQUIRE(masks.returns == expected.returns);
+            REQUIRE(masks.nulls == expected.nulls);
+            REQUIRE(masks.comments == expected.comments);
+            REQUIRE(masks.blanks == expected.blanks);
+        }
+    }
+
+    // scanning stops when requested
+    size_t count = 0;
+    const std::string data = "G1\r\nG2\nG3\n";
+    const char* next = scan_lines(data.data(), data.data() + data.size(), detect_simd_level(), [&count](std::string_view, std::string_view) {
+        return ++count < 2;
+    });
+    REQUIRE(count == 2);
+    REQUIRE(next == data.data() + 7);
+}
+
+TEST_CASE("Line scanner benchmark", "[.][benchmark]")
+{
+    const std::string src_filename = std::string(TEST_DATA_DIR) + "/mini_cube_a.gcode";
+    std::ifstream file(src_filename, std::ios::binary);
+    const std::string gcode((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::string input;
+    while (input.size() < 256 * 1024 * 1024) {
+        input += gcode;
+    }
+
+    auto measure = [&](const std::string& name, auto scan) {
+        const auto start = std::chrono::steady_clock::now();
+        const size_t count = scan();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << name << ": " << input.size() / 1e9 / elapsed.count() << " GB/s (" << count << ")\n";
+        return count;
+    };
+
+    const size_t expected = measure("char by char", [&]() {
+        size_t count = 0;
+        size_t begin = 0;
+        for (size_t i = 0; i < input.size(); ++i) {
+            if (input[i] == '\r' || input[i] == '\n') {
+                if (!line_content(std::string_view(input.data() + begin, i - begin)).empty())
+                    ++count;
+                begin = i + 1;
+            }
+        }
+        return count;
+    });
+    measure("line by line (memchr)", [&]() {
+        size_t count = 0;
+        size_t begin = 0;
+        for (size_t end = input.find('\n'); end != std::string::npos; end = input.find('\n', begin)) {
+            if (!line_content(std::string_view(input.data() + begin, end - begin)).empty())
+                ++count;
+            begin = end + 1;
+        }
+        return count;
+    });
+    for (const auto& [name, level] : SimdLevels) {
+        if (supported_simd_level(level) != level)
+            continue;
+        const size_t count = measure(std::string("lines, ") + name, [&, level = level]() {
+            size_t count = 0;
+            scan_lines(input.data(), input.data() + input.size(), level, [&count](std::string_view, std::string_view content) {
+                count += content.empty() ? 0 : 1;
+                return true;
+            });
+            return count;
+        });
+        REQUIRE(count == expected);
+        measure(std::string("masks only, ") + name, [&, level = level]() {
+            uint64_t new_lines = 0;
+            const size_t batch_size = ScanBatchSize * ScanWindowSize;
+            CharMasks batch[ScanBatchSize];
+            for (size_t i = 0; i + batch_size <= input.size(); i += batch_size) {
+                classify_chars(input.data() + i, ScanBatchSize, batch, level);
+                new_lines += batch[0].new_lines & 1;
+            }
+            return static_cast<size_t>(new_lines);
+        });
+    }
+
+    // conversions, whose gcode lines are all scanned
+    FILE* src_file = boost::nowide::fopen(src_filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+    MemoryOutputSink binary_sink;
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(from_ascii_to_binary(*src_file, binary_sink, BinarizerConfig()) == EResult::Success);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "ascii to binary: " << gcode.size() / 1e9 / elapsed.count() << " GB/s\n";
+    for (size_t threads_count : { 2, 4, 8, 16 }) {
+        rewind(src_file);
+        MemoryOutputSink parallel_sink;
+        start = std::chrono::steady_clock::now();
+        REQUIRE(from_ascii_to_binary(*src_file, parallel_sink, BinarizerConfig(), threads_count) == EResult::Success);
+        elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "ascii to binary, " << threads_count << " threads: " << gcode.size() / 1e9 / elapsed.count() << " GB/s\n";
+        REQUIRE(parallel_sink.get_data() == binary_sink.get_data());
+    }
+
+    FILE* binary_file = std::tmpfile();
+    REQUIRE(binary_file != nullptr);
+    ScopedFile scoped_binary_file(binary_file);
+    REQUIRE(fwrite(binary_sink.get_data().data(), 1, binary_sink.get_data().size(), binary_file) == binary_sink.get_data().size());
+    // scaling with the count of threads, the checksums being verified by the threads decoding the blocks
+    MemoryOutputSink ascii_sink;
+    REQUIRE(from_binary_to_ascii(*binary_file, ascii_sink, false) == EResult::Success);
+    for (bool verify_checksum : { false, true }) {
+        double serial_time = 0.0;
+        for (size_t threads_count : { 1, 2, 4, 8, 16 }) {
+            rewind(binary_file);
+            MemoryOutputSink parallel_sink;
+            start = std::chrono::steady_clock::now();
+            REQUIRE(from_binary_to_ascii(*binary_file, parallel_sink, verify_checksum, threads_count) == EResult::Success);
+            elapsed = std::chrono::steady_clock::now() - start;
+            if (threads_count == 1)
+                serial_time = elapsed.count();
+            std::cout << "binary to ascii, " << (verify_checksum ? "checksum verified, " : "") << threads_count << " threads: " <<
+                parallel_sink.get_data().size() / 1e9 / elapsed.count() << " GB/s, speedup " << serial_time / elapsed.count() << "\n";
+            REQUIRE(parallel_sink.get_data() == ascii_sink.get_data());
+        }
+    }
+}
+
+#ifndef _WIN32
+TEST_CASE("Convert from a pipe", "[Convert]")
+{
+    std::cout << "\nTEST: Convert from a pipe\n";
+
+    auto read_file = [](const std::string& filename) {
+        FILE* file = boost::nowide::fopen(filename.c_str(), "rb");
+        REQUIRE(file != nullptr);
+        ScopedFile scoped_file(file);
+        fseek(file, 0, SEEK_END);
+        std::vector<std::byte> data(ftell(file));
+        rewind(file);
+        REQUIRE(fread(data.data(), 1, data.size(), file) == data.size());
+        return data;
+    };
+
+    // converts the given data, written into a pipe by another thread
+    auto convert_from_pipe = [](const std::vector<std::byte>& data, const BinarizerConfig& config, MemoryOutputSink& sink,
+        size_t threads_count) {
+        int fds[2];
+        REQUIRE(pipe(fds) == 0);
+        std::thread writer([&data, fd = fds[1]]() {
+            size_t written = 0;
+            while (written < data.size()) {
+                const ssize_t size = write(fd, data.data() + written, data.size() - written);
+                if (size <= 0)
+                    break;
+                written += static_cast<size_t>(size);
+            }
+            close(fd);
+        });
+        FILE* src_file = fdopen(fds[0], "rb");
+        REQUIRE(src_file != nullptr);
+        const EResult res = from_ascii_to_binary(*src_file, sink, config, threads_count);
+        // let the writer end, if the conversion stopped early
+        std::vector<char> buffer(65536);
+        while (fread(buffer.data(), 1, buffer.size(), src_file) > 0) {
+        }
+        writer.join();
+        fclose(src_file);
+        return res;
+    };
+
+    const std::string src_filename = std::string(TEST_DATA_DIR) + "/mini_cube_a.gcode";
+    const std::vector<std::byte> src_data = read_file(src_filename);
+
+    for (EGCodeEncodingType encoding : { EGCodeEncodingType::None, EGCodeEncodingType::MeatPackComments, EGCodeEncodingType::TokenPack }) {
+        BinarizerConfig config;
+        config.compression.slicer_metadata = ECompressionType::Deflate;
+        config.compression.gcode = ECompressionType::Heatshrink_12_4;
+        config.gcode_encoding = encoding;
+
+        FILE* src_file = boost::nowide::fopen(src_filename.c_str(), "rb");
+        REQUIRE(src_file != nullptr);
+        ScopedFile scoped_src_file(src_file);
+        MemoryOutputSink file_sink;
+        REQUIRE(from_ascii_to_binary(*src_file, file_sink, config) == EResult::Success);
+
+        // same output from the non seekable input
+        MemoryOutputSink pipe_sink;
+        REQUIRE(convert_from_pipe(src_data, config, pipe_sink, 1) == EResult::Success);
+        REQUIRE(pipe_sink.get_data() == file_sink.get_data());
+
+        // also when encoded in parallel
+        MemoryOutputSink parallel_pipe_sink;
+        REQUIRE(convert_from_pipe(src_data, config, parallel_pipe_sink, 4) == EResult::Success);
+        REQUIRE(parallel_pipe_sink.get_data() == file_sink.get_data());
+    }
+
+    // binary input is detected without seeking
+    const std::vector<std::byte> binary_data = read_file(std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode");
+    MemoryOutputSink sink;
+    REQUIRE(convert_from_pipe(binary_data, BinarizerConfig(), sink, 1) == EResult::AlreadyBinarized);
+    REQUIRE(sink.get_data().empty());
+
+    // and as by is_valid_binary_gcode() in a seekable file, whatever the position
+    const std::string binary_filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    FILE* binary_file = boost::nowide::fopen(binary_filename.c_str(), "rb");
+    REQUIRE(binary_file != nullptr);
+    ScopedFile scoped_binary_file(binary_file);
+    REQUIRE(fseek(binary_file, 10, SEEK_SET) == 0);
+    REQUIRE(from_ascii_to_binary(*binary_file, sink, BinarizerConfig()) == EResult::AlreadyBinarized);
+    REQUIRE(sink.get_data().empty());
+}
+#endif // _WIN32
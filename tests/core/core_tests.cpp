@@ -57,7 +57,8 @@ static std::string metadata_encoding_as_string(EMetadataEncodingType type)
 {
     switch (type)
     {
-    case EMetadataEncodingType::INI: { return "INI"; }
+    case EMetadataEncodingType::INI:    { return "INI"; }
+    case EMetadataEncodingType::Binary: { return "Binary"; }
     }
     return "";
 };
@@ -69,6 +70,7 @@ static std::string gcode_encoding_as_string(EGCodeEncodingType type)
     case EGCodeEncodingType::None:             { return "None"; }
     case EGCodeEncodingType::MeatPack:         { return "MeatPack"; }
     case EGCodeEncodingType::MeatPackComments: { return "MeatPackComments"; }
+    case EGCodeEncodingType::TokenPack:        { return "TokenPack"; }
     }
     return "";
 };
@@ -196,3 +198,64 @@ static std::string thumbnail_format_as_string(EThumbnailFormat type)
              break;
      } while (true);
  }
+
+ TEST_CASE("Output sinks", "[Core]")
+ {
+     std::cout << "\nTEST: Output sinks\n";
+
+     FileHeader file_header;
+     BlockHeader block_header((uint16_t)EBlockType::Thumbnail, (uint16_t)ECompressionType::None, 12);
+     ThumbnailParams thumbnail_params{ (uint16_t)EThumbnailFormat::PNG, 16, 16 };
+
+     auto write_all = [&](OutputSink& sink) {
+         REQUIRE(file_header.write(sink) == EResult::Success);
+         REQUIRE(block_header.write(sink) == EResult::Success);
+         REQUIRE(thumbnail_params.write(sink) == EResult::Success);
+         REQUIRE(sink.flush());
+     };
+
+     // reference output written to FILE
+     FILE* file = std::tmpfile();
+     REQUIRE(file != nullptr);
+     ScopedFile scoped_file(file);
+     FileOutputSink file_sink(*file);
+     write_all(file_sink);
+     const long file_size = ftell(file);
+     REQUIRE(file_size == (long)(10 + block_header.get_size() + 6));
+     std::vector<std::byte> expected(file_size);
+     rewind(file);
+     REQUIRE(fread(expected.data(), 1, expected.size(), file) == expected.size());
+
+     MemoryOutputSink memory_sink;
+     write_all(memory_sink);
+     REQUIRE(memory_sink.tell() == file_size);
+     REQUIRE(memory_sink.get_data() == expected);
+
+     std::vector<std::byte> callback_data;
+     CallbackOutputSink callback_sink([&callback_data](const void* data, size_t data_size) {
+         const std::byte* bytes = static_cast<const std::byte*>(data);
+         callback_data.insert(callback_data.end(), bytes, bytes + data_size);
+         return true;
+     });
+     write_all(callback_sink);
+     REQUIRE(callback_sink.tell() == file_size);
+     REQUIRE(callback_data == expected);
+
+     // a failing callback is reported as write error
+     CallbackOutputSink failing_sink([](const void*, size_t) { return false; });
+     REQUIRE(file_header.write(failing_sink) == EResult::WriteError);
+
+     FILE* fd_file = std::tmpfile();
+     REQUIRE(fd_file != nullptr);
+     ScopedFile scoped_fd_file(fd_file);
+     {
+         // small buffer to exercise both the buffered and the direct path
+         FdOutputSink fd_sink(fileno(fd_file), 8);
+         write_all(fd_sink);
+         REQUIRE(fd_sink.tell() == file_size);
+     }
+     std::vector<std::byte> fd_data(file_size);
+     fseek(fd_file, 0, SEEK_SET);
+     REQUIRE(fread(fd_data.data(), 1, fd_data.size(), fd_file) == fd_data.size());
+     REQUIRE(fd_data == expected);
+ }